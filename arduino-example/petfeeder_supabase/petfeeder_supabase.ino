@@ -17,7 +17,7 @@
  * - Optional: Battery level monitoring
  * 
  * Debug Features:
- * - Serial debug output with timestamps
+ * - Leveled, timestamped Serial logging that never blocks the loop
  * - LED status indicators
  * - Detailed API response logging
  * - Sensor reading verification
@@ -30,6 +30,10 @@
 #include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
 #include <ESP32Servo.h>
+#include <Preferences.h>
+#include <driver/gpio.h>
+#include <esp_timer.h>
+#include <stdarg.h>
 #include <time.h>
 
 // WiFi credentials
@@ -41,10 +45,25 @@
 #define SUPABASE_API_KEY "your-supabase-anon-key"
 #define SUPABASE_JWT_TOKEN "your-jwt-token" // Generated after user authentication
 
+// Log levels. Messages above LOG_LEVEL are compiled out together with
+// their arguments, so disabled logging costs nothing at run time.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG // Use LOG_LEVEL_INFO or lower in production
+#endif
+#define LOG_RING_SIZE 4096        // bytes of log lines waiting for Serial, power of two
+#define LOG_LINE_SIZE 192         // longer messages are truncated
+#define LOG_TASK_STACK 3072
+#define LOG_FLUSH_INTERVAL 50     // ms between ring drains when not woken
+
 // Debug configuration
-#define DEBUG_MODE true           // Set to false to disable detailed debug output
 #define DEBUG_LED_ENABLED true    // Set to false to disable debug LED patterns
 #define DEBUG_BLINK_DURATION 100  // Duration of debug LED blinks in ms
+#define BLINK_IDLE 0xFFFFFFFFUL   // updateBlinker() result with no pattern playing
 
 // Hardware pins
 #define SERVO_PIN 13
@@ -58,16 +77,102 @@
 // Constants
 #define FEED_AMOUNT_PER_SECOND 5 // grams per second
 #define MAX_FEED_AMOUNT 100 // maximum amount in grams
+#define FEED_QUEUE_SIZE 4 // feed requests waiting for the dispenser
+#define SERVO_TRAVEL_MS 300 // time for the servo to reach its position
+#define FEED_SETTLE_MS 1000 // time for food to settle after closing
+#define HISTORY_BATCH_SIZE 6 // feeding events per bulk insert
+
+// Ultrasonic sampling
+#define SONAR_SAMPLE_INTERVAL 60 // ms between pings, lets echoes die out
+#define SONAR_ECHO_TIMEOUT 25000 // us, about 4 m round trip
+#define SONAR_MEDIAN_WINDOW 5    // pings the median is taken over
+#define SONAR_EMA_SHIFT 2        // each sample moves the average by 1/4
+
+// Battery sampling
+#define BATTERY_OVERSAMPLE 64       // conversions averaged per reading
+#define BATTERY_ADC_FREQUENCY 20000 // Hz, lowest the ESP32 ADC DMA allows
+#define BATTERY_DIVIDER_RATIO 2     // battery voltage / pin voltage
+#define BATTERY_EMA_SHIFT 3         // each reading moves the average by 1/8
+
+// Leveled logging, printf-style. Enabled levels format into the log ring
+// without waiting on Serial; the rest compile to nothing.
+#define LOG_AT(level, tag, ...) \
+  do { if (LOG_LEVEL >= (level)) logWrite(tag, __VA_ARGS__); } while (0)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, 'E', __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, 'W', __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, 'I', __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, 'D', __VA_ARGS__)
+
+// Request buffers, sized once so REST calls do not build Strings
+#define SUPABASE_AUTH_HEADER "Bearer " SUPABASE_JWT_TOKEN
+#define REQUEST_URL_SIZE 384  // fits an id=in.(...) list of a full feed queue
+#define REQUEST_BODY_SIZE 1280 // fits a feeding history batch
 
 // Global variables
 Servo feederServo;
 WiFiClientSecure client;
 HTTPClient http;
 
-unsigned long lastStatusUpdate = 0;
-unsigned long lastScheduleCheck = 0;
-unsigned long lastTimeSync = 0;
-unsigned long debugTimestamp = 0;  // For tracking debug message timestamps
+// Device identity, resolved once. The UUID of the devices row is cached in
+// NVS so it is looked up only the first time the board talks to Supabase.
+Preferences identityPrefs;
+char deviceId[13] = "";   // MAC without separators
+char deviceUuid[37] = ""; // devices.id, empty until resolved
+char requestUrl[REQUEST_URL_SIZE];
+char requestBody[REQUEST_BODY_SIZE];
+
+// Deadline-ordered periodic jobs run from loop(). A job may start up to
+// its jitter late so nearby deadlines share one wakeup; starting later
+// than that counts as an overrun.
+struct PeriodicTask {
+  const char* name;
+  unsigned long period;    // ms between runs
+  unsigned long jitter;    // ms the job may run late
+  int priority;            // higher runs first when several are due
+  void (*run)();
+  unsigned long nextRun;
+  unsigned long runs;
+  unsigned long overruns;
+};
+
+// Log ring, filled by logWrite() and sent to Serial by logTask(). The
+// positions run freely and are masked to index the ring.
+char logRing[LOG_RING_SIZE];
+size_t logHead = 0;        // total bytes written
+size_t logTail = 0;        // total bytes sent
+uint32_t logDropped = 0;   // lines lost to a full ring since the last drain
+portMUX_TYPE logMux = portMUX_INITIALIZER_UNLOCKED;
+TaskHandle_t logTaskHandle = NULL;
+
+// LED pattern played out by updateBlinker()
+int blinkToggles = 0;      // LED changes left in the pattern
+unsigned long blinkInterval = 0;
+unsigned long blinkLastToggle = 0;
+
+// Ultrasonic sensor sampled in the background: an esp_timer sends a ping
+// every SONAR_SAMPLE_INTERVAL and the echo edge interrupt times it, so
+// readFoodLevel() never waits on pulseIn(). Pings go through a median
+// filter to drop outliers and a moving average to smooth the rest.
+esp_timer_handle_t sonarTimer = NULL;
+volatile int64_t echoStart = 0;     // set by the echo interrupt
+volatile uint32_t echoWidth = 0;
+volatile bool echoReady = false;
+uint16_t sonarWindow[SONAR_MEDIAN_WINDOW]; // filter state, owned by the timer
+uint8_t sonarWindowCount = 0;
+uint8_t sonarWindowPos = 0;
+int32_t sonarAverage = -1;          // mm << SONAR_EMA_SHIFT
+bool sonarPinging = false;
+volatile int32_t sonarDistanceMm = -1; // filtered distance, -1 until the first echo
+volatile uint32_t sonarTimeouts = 0;
+
+// Battery voltage read with the ADC in continuous (DMA) mode. The driver
+// averages a burst of BATTERY_OVERSAMPLE conversions and calibrates it to
+// millivolts; collectBatteryBurst() folds each burst into a moving average
+// and starts the next one, so the CPU never waits on the ADC.
+volatile bool batteryBurstReady = false; // set from the ADC interrupt
+bool batteryAdcRunning = false;
+int32_t batteryAverage = -1;        // mV << BATTERY_EMA_SHIFT
+int32_t batteryMillivolts = -1;     // smoothed, -1 until the first burst
 
 // Debug status tracking
 bool wifiConnected = false;
@@ -85,6 +190,45 @@ struct FeedingSchedule {
 
 FeedingSchedule schedules[10]; // Maximum 10 schedules
 int scheduleCount = 0;
+int lastScheduleMinute = -1; // minute of week of the last scheduled feed
+
+// Non-blocking dispenser: loop() advances it through open, hold, close
+// and settle so WiFi and command polling keep running while feeding
+enum DispenseState {
+  DISPENSE_IDLE,
+  DISPENSE_OPENING,
+  DISPENSE_HOLDING,
+  DISPENSE_CLOSING,
+  DISPENSE_SETTLING
+};
+
+struct FeedRequest {
+  int amount;
+  String type;
+  String commandId; // feed_commands row, empty for scheduled feeds
+};
+
+FeedRequest feedQueue[FEED_QUEUE_SIZE];
+int feedQueueHead = 0;
+int feedQueueCount = 0;
+FeedRequest activeFeed;
+DispenseState dispenseState = DISPENSE_IDLE;
+unsigned long dispenseStateStart = 0;
+unsigned long feederOpenedAt = 0;
+unsigned long feedHoldMs = 0;
+unsigned long feedActualMs = 0;
+
+// Completed feeds waiting for the next bulk insert into feeding_history.
+// A row with a command id also completes that command on the server.
+struct FeedingRecord {
+  int amount;
+  char type[12];
+  char commandId[37]; // empty for scheduled feeds
+  time_t timestamp;
+};
+
+FeedingRecord pendingHistory[HISTORY_BATCH_SIZE];
+int pendingHistoryCount = 0;
 
 struct tm timeinfo;
 
@@ -93,60 +237,266 @@ void updateDeviceStatus();
 void loadSchedules();
 void checkSchedules();
 void checkForManualFeedCommand();
-void updateCommandStatus(String commandId, String status);
-void logFeedingEvent(int amount, String type);
+void updateCommandStatus(const char* idList, const char* status);
+void logFeedingEvent(int amount, String type, String commandId = "");
+void flushFeedingHistory();
+void formatFeedTime(time_t t, char* out, size_t size);
 void updateFoodLevel();
 void updateBatteryLevel();
 int readFoodLevel();
 int readBatteryLevel();
-void feed(int amount);
-void debugPrint(String message, bool newLine = true);
+bool startFoodSensor();
+void sonarTick(void* arg);
+void addEchoSample(uint32_t widthUs);
+bool startBatteryMonitor();
+void collectBatteryBurst();
+int batteryPercentFromMillivolts(int32_t millivolts);
+bool feed(int amount, String type, String commandId = "");
+void updateDispenser();
+void setDispenseState(DispenseState state);
+void onFeedComplete(FeedRequest request, unsigned long actualDuration);
+void syncTime();
+void runDueTasks();
+unsigned long msUntilNextTask();
+void loadDeviceIdentity();
+bool resolveDeviceUuid();
+const char* supabaseUrl(const char* pathFormat, ...);
+void beginSupabaseRequest(const char* url, bool minimal);
+void logWrite(char level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void logTask(void* arg);
+void startLogTask();
 void debugBlink(int times, int speed = DEBUG_BLINK_DURATION);
+unsigned long updateBlinker();
+void blinkerDelay(unsigned long ms);
 
-// Debug print function with timestamp
-void debugPrint(String message, bool newLine) {
-  if (!DEBUG_MODE) return;
-  
+PeriodicTask tasks[] = {
+  // name, period, jitter, priority, job, first run
+  {"time", 3600000, 60000, 0, syncTime, 3600000},
+  {"status", 60000, 5000, 1, updateDeviceStatus, 60000},
+  {"schedules", 30000, 1000, 2, checkSchedules, 30000},
+  {"commands", 1000, 200, 2, checkForManualFeedCommand, 0},
+  {"food", 1000, 200, 0, updateFoodLevel, 0},
+  {"battery", 500, 200, 0, collectBatteryBurst, 0},
+  {"heartbeat", 10000, 1000, 0, []() { debugBlink(1, 50); }, 10000}
+};
+const int taskCount = sizeof(tasks) / sizeof(tasks[0]);
+
+// Format a timestamped line into the log ring. Never waits on Serial: if
+// the ring is full the line is dropped and counted instead.
+void logWrite(char level, const char* format, ...) {
+  char line[LOG_LINE_SIZE];
   unsigned long currentMillis = millis();
   unsigned long seconds = currentMillis / 1000;
-  unsigned long minutes = seconds / 60;
-  unsigned long hours = minutes / 60;
-  
-  // Format: [HH:MM:SS.mmm]
-  String timestamp = String("[") + 
-                    String(hours % 24) + String(":") + 
-                    String(minutes % 60) + String(":") + 
-                    String(seconds % 60) + String(".") + 
-                    String(currentMillis % 1000) + String("] ");
-  
-  if (newLine) {
-    Serial.println(timestamp + message);
+  
+  // Format: [HH:MM:SS.mmm] L message
+  int length = snprintf(line, sizeof(line), "[%02lu:%02lu:%02lu.%03lu] %c ",
+                        (seconds / 3600) % 24, (seconds / 60) % 60, seconds % 60,
+                        currentMillis % 1000, level);
+  
+  // Leave room for the newline
+  int room = sizeof(line) - length - 1;
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(line + length, room, format, args);
+  va_end(args);
+  length += constrain(written, 0, room - 1);
+  line[length++] = '\n';
+  
+  portENTER_CRITICAL(&logMux);
+  if (LOG_RING_SIZE - (logHead - logTail) < (size_t)length) {
+    logDropped++;
   } else {
-    Serial.print(timestamp + message);
+    size_t start = logHead & (LOG_RING_SIZE - 1);
+    size_t first = min((size_t)length, LOG_RING_SIZE - start);
+    memcpy(logRing + start, line, first);
+    memcpy(logRing, line + first, length - first);
+    logHead += length;
+  }
+  portEXIT_CRITICAL(&logMux);
+  
+  if (logTaskHandle != NULL) {
+    xTaskNotifyGive(logTaskHandle);
   }
 }
 
-// Debug LED patterns
+// Low-priority task that moves the log ring to Serial, so only this task
+// ever waits for the UART
+void logTask(void* arg) {
+  char chunk[128];
+  
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOG_FLUSH_INTERVAL));
+    
+    for (;;) {
+      portENTER_CRITICAL(&logMux);
+      size_t start = logTail & (LOG_RING_SIZE - 1);
+      size_t count = min(logHead - logTail, min(sizeof(chunk), LOG_RING_SIZE - start));
+      memcpy(chunk, logRing + start, count);
+      logTail += count;
+      uint32_t dropped = logDropped;
+      logDropped = 0;
+      portEXIT_CRITICAL(&logMux);
+      
+      if (dropped > 0) {
+        Serial.printf("[log] %u lines dropped\n", (unsigned)dropped);
+      }
+      if (count == 0) {
+        break;
+      }
+      Serial.write((const uint8_t*)chunk, count);
+    }
+  }
+}
+
+// Start draining the log ring. Lines logged before this wait in the ring.
+void startLogTask() {
+  if (LOG_LEVEL == LOG_LEVEL_NONE) return;
+  
+  if (xTaskCreate(logTask, "log", LOG_TASK_STACK, NULL, tskIDLE_PRIORITY + 1, &logTaskHandle) != pdPASS) {
+    Serial.println("Failed to start log task");
+  }
+}
+
+// Start an LED pattern of times blinks, replacing any pattern still
+// playing. Returns at once; updateBlinker() plays it out.
 void debugBlink(int times, int speed) {
-  if (!DEBUG_MODE || !DEBUG_LED_ENABLED) return;
+  if (!DEBUG_LED_ENABLED) return;
+  
+  blinkToggles = times * 2;
+  blinkInterval = speed;
+  blinkLastToggle = millis() - speed; // first change is due now
+}
+
+// Advance the LED pattern. Returns ms until the next change, or
+// BLINK_IDLE with no pattern playing. The dispenser owns the LED while it
+// runs, so a pattern waits for it.
+unsigned long updateBlinker() {
+  if (blinkToggles == 0 || dispenseState != DISPENSE_IDLE) {
+    return BLINK_IDLE;
+  }
+  
+  unsigned long now = millis();
+  unsigned long elapsed = now - blinkLastToggle;
+  if (elapsed < blinkInterval) {
+    return blinkInterval - elapsed;
+  }
   
-  for (int i = 0; i < times; i++) {
-    digitalWrite(DEBUG_LED_PIN, HIGH);
-    delay(speed);
-    digitalWrite(DEBUG_LED_PIN, LOW);
-    delay(speed);
+  // Odd counts turn the LED on, so every pattern ends with it off
+  blinkToggles--;
+  digitalWrite(DEBUG_LED_PIN, (blinkToggles % 2) ? HIGH : LOW);
+  blinkLastToggle = now;
+  return blinkToggles > 0 ? blinkInterval : BLINK_IDLE;
+}
+
+// Block for ms while the LED pattern keeps playing, for the places that
+// still have to wait
+void blinkerDelay(unsigned long ms) {
+  unsigned long start = millis();
+  for (;;) {
+    unsigned long elapsed = millis() - start;
+    if (elapsed >= ms) {
+      return;
+    }
+    delay(min(updateBlinker(), ms - elapsed));
+  }
+}
+
+// Read the MAC-derived device ID and the UUID cached for it in NVS
+void loadDeviceIdentity() {
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  snprintf(deviceId, sizeof(deviceId), "%02X%02X%02X%02X%02X%02X",
+           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  
+  // The cached UUID only counts if it was stored for this MAC
+  char cachedId[sizeof(deviceId)] = "";
+  identityPrefs.begin("identity", true);
+  identityPrefs.getString("mac", cachedId, sizeof(cachedId));
+  if (strcmp(cachedId, deviceId) == 0) {
+    identityPrefs.getString("uuid", deviceUuid, sizeof(deviceUuid));
+  }
+  identityPrefs.end();
+}
+
+// Look up the devices row UUID for this MAC. Only the first call after
+// flashing a new board goes to the network; later calls use the cache.
+bool resolveDeviceUuid() {
+  if (deviceUuid[0] != '\0') {
+    return true;
+  }
+  
+  LOG_INFO("Resolving device UUID...");
+  beginSupabaseRequest(supabaseUrl("/rest/v1/devices?mac_address=eq.%s&select=id", deviceId), false);
+  
+  int httpResponseCode = http.GET();
+  if (httpResponseCode != 200) {
+    LOG_ERROR("Failed to get device UUID: %d", httpResponseCode);
+    debugBlink(4, 200); // Error indicator
+    http.end();
+    return false;
+  }
+  
+  JsonDocument deviceDoc;
+  DeserializationError error = deserializeJson(deviceDoc, http.getString());
+  http.end();
+  
+  if (error) {
+    LOG_ERROR("deserializeJson() failed: %s", error.c_str());
+    debugBlink(4, 200); // Error indicator
+    return false;
+  }
+  
+  // Check if device exists in database
+  const char* uuid = deviceDoc[0]["id"];
+  if (uuid == nullptr) {
+    LOG_ERROR("Device not found in database");
+    debugBlink(4, 200); // Error indicator
+    return false;
+  }
+  
+  strlcpy(deviceUuid, uuid, sizeof(deviceUuid));
+  identityPrefs.begin("identity", false);
+  identityPrefs.putString("mac", deviceId);
+  identityPrefs.putString("uuid", deviceUuid);
+  identityPrefs.end();
+  
+  LOG_INFO("Device UUID: %s", deviceUuid);
+  return true;
+}
+
+// Format a REST path onto the project URL in the shared request buffer
+const char* supabaseUrl(const char* pathFormat, ...) {
+  int offset = strlcpy(requestUrl, SUPABASE_URL, sizeof(requestUrl));
+  
+  va_list args;
+  va_start(args, pathFormat);
+  vsnprintf(requestUrl + offset, sizeof(requestUrl) - offset, pathFormat, args);
+  va_end(args);
+  
+  return requestUrl;
+}
+
+// Open a request with the standard Supabase headers, all constant strings
+void beginSupabaseRequest(const char* url, bool minimal) {
+  http.begin(client, url);
+  http.addHeader("Content-Type", "application/json");
+  http.addHeader("apikey", SUPABASE_API_KEY);
+  http.addHeader("Authorization", SUPABASE_AUTH_HEADER);
+  if (minimal) {
+    http.addHeader("Prefer", "return=minimal");
   }
 }
 
 void setup() {
   Serial.begin(115200);
   delay(500); // Give serial monitor time to start
+  startLogTask();
   
-  debugPrint("========================================");
-  debugPrint("PetFeeder ESP32 Supabase Integration");
-  debugPrint("========================================");
-  debugPrint("Firmware version: 1.0.0");
-  debugPrint("Debug mode: ENABLED");
+  LOG_INFO("========================================");
+  LOG_INFO("PetFeeder ESP32 Supabase Integration");
+  LOG_INFO("========================================");
+  LOG_INFO("Firmware version: 1.0.0");
+  LOG_INFO("Log level: %d", LOG_LEVEL);
   
   // Initialize LED pin
   pinMode(DEBUG_LED_PIN, OUTPUT);
@@ -154,20 +504,27 @@ void setup() {
   debugBlink(3); // Startup indicator
   
   // Initialize hardware
-  debugPrint("Initializing servo motor...", false);
   feederServo.attach(SERVO_PIN);
   feederServo.write(0); // Initial position
   servoInitialized = true;
-  debugPrint("OK");
+  LOG_INFO("Servo motor initialized");
   
-  // Initialize ultrasonic sensor pins
-  debugPrint("Initializing ultrasonic sensor...", false);
-  pinMode(TRIG_PIN, OUTPUT);
-  pinMode(ECHO_PIN, INPUT);
-  debugPrint("OK");
+  // Start sampling the ultrasonic sensor in the background
+  if (startFoodSensor()) {
+    LOG_INFO("Ultrasonic sensor initialized");
+  } else {
+    LOG_ERROR("Ultrasonic sensor timer failed to start");
+  }
+  
+  // Start sampling the battery voltage in the background
+  if (startBatteryMonitor()) {
+    LOG_INFO("Battery monitor initialized");
+  } else {
+    LOG_ERROR("Battery ADC continuous mode setup failed");
+  }
   
   // Connect to WiFi
-  debugPrint("Connecting to WiFi SSID: " + String(WIFI_SSID), false);
+  LOG_INFO("Connecting to WiFi SSID: %s", WIFI_SSID);
   
   // Explicitly set WiFi mode to station before attempting to connect
   WiFi.mode(WIFI_STA);
@@ -175,23 +532,22 @@ void setup() {
   
   int wifiAttempts = 0;
   while (WiFi.status() != WL_CONNECTED && wifiAttempts < 20) { // 10 second timeout
-    Serial.print(".");
     debugBlink(1, 100);
-    delay(500);
+    blinkerDelay(500);
     wifiAttempts++;
   }
   
   if (WiFi.status() == WL_CONNECTED) {
     wifiConnected = true;
-    debugPrint("\nConnected with IP: " + WiFi.localIP().toString());
-    debugPrint("Signal strength: " + String(WiFi.RSSI()) + " dBm");
+    LOG_INFO("Connected with IP: %s", WiFi.localIP().toString().c_str());
+    LOG_INFO("Signal strength: %d dBm", (int)WiFi.RSSI());
     debugBlink(2); // Success indicator
   } else {
-    debugPrint("\nWiFi connection FAILED");
+    LOG_ERROR("WiFi connection FAILED");
     debugBlink(5, 200); // Error indicator
     
     // Start AP mode for configuration
-    debugPrint("Starting Access Point for configuration...");
+    LOG_INFO("Starting Access Point for configuration...");
     
     // Disconnect from any previous WiFi connection attempts
     WiFi.disconnect();
@@ -206,26 +562,25 @@ void setup() {
     
     // Start the access point with a stronger signal
     if (WiFi.softAP(apSSID.c_str(), "petfeeder123", 1, 0, 4)) {
-      debugPrint("AP started successfully with SSID: " + apSSID);
-      debugPrint("AP IP address: " + WiFi.softAPIP().toString());
+      LOG_INFO("AP started successfully with SSID: %s", apSSID.c_str());
+      LOG_INFO("AP IP address: %s", WiFi.softAPIP().toString().c_str());
       debugBlink(3); // AP mode indicator
     } else {
-      debugPrint("Failed to start AP mode");
+      LOG_WARN("Failed to start AP mode");
       
       // Try one more time with default settings
       delay(1000);
       if (WiFi.softAP(apSSID.c_str(), "petfeeder123")) {
-        debugPrint("AP started with default settings, SSID: " + apSSID);
-        debugPrint("AP IP address: " + WiFi.softAPIP().toString());
+        LOG_INFO("AP started with default settings, SSID: %s", apSSID.c_str());
+        LOG_INFO("AP IP address: %s", WiFi.softAPIP().toString().c_str());
         debugBlink(3); // AP mode indicator
       } else {
-        debugPrint("AP mode completely failed");
+        LOG_ERROR("AP mode completely failed");
       }
     }
   }
 
   // Initialize time
-  debugPrint("Initializing time synchronization...", false);
   configTime(0, 0, "pool.ntp.org", "time.nist.gov");
   
   // Check if time was initialized successfully
@@ -233,150 +588,180 @@ void setup() {
     timeInitialized = true;
     char timeStringBuff[50];
     strftime(timeStringBuff, sizeof(timeStringBuff), "%Y-%m-%d %H:%M:%S", &timeinfo);
-    debugPrint("OK - Current time: " + String(timeStringBuff));
+    LOG_INFO("Time synchronized, current time: %s", timeStringBuff);
   } else {
-    debugPrint("FAILED");
+    LOG_ERROR("Time synchronization FAILED");
     debugBlink(4, 200); // Error indicator
   }
   
   // Skip SSL certificate verification (for development only)
-  debugPrint("Setting up secure client (insecure mode)...", false);
   client.setInsecure();
-  debugPrint("OK");
+  LOG_INFO("Secure client set up (insecure mode)");
   
   // Test Supabase connection
-  debugPrint("Testing Supabase connection...");
-  String deviceId = WiFi.macAddress();
-  deviceId.replace(":", "");
-  debugPrint("Device ID: " + deviceId);
+  LOG_INFO("Testing Supabase connection...");
+  loadDeviceIdentity();
+  LOG_INFO("Device ID: %s", deviceId);
+  resolveDeviceUuid();
   
   // Update device status
-  debugPrint("Updating device status...");
+  LOG_INFO("Updating device status...");
   updateDeviceStatus();
   
   // Load feeding schedules
-  debugPrint("Loading feeding schedules...");
+  LOG_INFO("Loading feeding schedules...");
   loadSchedules();
   
-  debugPrint("Setup complete!");
-  debugPrint("========================================");
+  LOG_INFO("Setup complete!");
+  LOG_INFO("========================================");
   
   // Final status report
-  debugPrint("SYSTEM STATUS:");
-  debugPrint("WiFi: " + String(wifiConnected ? "CONNECTED" : "DISCONNECTED"));
-  debugPrint("Time sync: " + String(timeInitialized ? "OK" : "FAILED"));
-  debugPrint("Servo: " + String(servoInitialized ? "OK" : "FAILED"));
-  debugPrint("Supabase: " + String(supabaseConnected ? "CONNECTED" : "DISCONNECTED"));
-  debugPrint("========================================");
+  LOG_INFO("SYSTEM STATUS:");
+  LOG_INFO("WiFi: %s", wifiConnected ? "CONNECTED" : "DISCONNECTED");
+  LOG_INFO("Time sync: %s", timeInitialized ? "OK" : "FAILED");
+  LOG_INFO("Servo: %s", servoInitialized ? "OK" : "FAILED");
+  LOG_INFO("Supabase: %s", supabaseConnected ? "CONNECTED" : "DISCONNECTED");
+  LOG_INFO("========================================");
 }
 
 void loop() {
+  // Advance any feed in progress
+  updateDispenser();
+  
   // Check WiFi connection
   if (WiFi.status() != WL_CONNECTED) {
-    debugPrint("WiFi disconnected. Reconnecting...");
+    // Finish dispensing before blocking on a reconnect
+    if (dispenseState != DISPENSE_IDLE || feedQueueCount > 0) {
+      delay(20);
+      return;
+    }
+    
+    LOG_WARN("WiFi disconnected. Reconnecting...");
     debugBlink(3, 200); // Error indicator
     wifiConnected = false;
     WiFi.reconnect();
-    delay(5000);
+    blinkerDelay(5000);
     
     if (WiFi.status() == WL_CONNECTED) {
       wifiConnected = true;
-      debugPrint("WiFi reconnected with IP: " + WiFi.localIP().toString());
+      LOG_INFO("WiFi reconnected with IP: %s", WiFi.localIP().toString().c_str());
       debugBlink(2); // Success indicator
     }
     return;
   }
   
-  // Update time
-  if (millis() - lastTimeSync > 3600000) { // Every hour
-    debugPrint("Synchronizing time...", false);
-    if (getLocalTime(&timeinfo)) {
-      char timeStringBuff[50];
-      strftime(timeStringBuff, sizeof(timeStringBuff), "%Y-%m-%d %H:%M:%S", &timeinfo);
-      debugPrint("OK - Current time: " + String(timeStringBuff));
-      timeInitialized = true;
-    } else {
-      debugPrint("FAILED");
-      timeInitialized = false;
-      debugBlink(4, 200); // Error indicator
+  // Run periodic jobs that are due
+  runDueTasks();
+  
+  // Sleep until the next job, LED change or dispenser step is due
+  unsigned long wait = min(msUntilNextTask(), updateBlinker());
+  if (dispenseState != DISPENSE_IDLE || feedQueueCount > 0) {
+    wait = min(wait, 20UL);
+  }
+  if (wait > 0) {
+    delay(wait);
+  }
+}
+
+// Run every due job, highest priority first
+void runDueTasks() {
+  unsigned long now = millis();
+  int due[taskCount];
+  int dueCount = 0;
+  
+  for (int i = 0; i < taskCount; i++) {
+    if ((long)(now - tasks[i].nextRun) < 0) {
+      continue;
+    }
+    int pos = dueCount++;
+    while (pos > 0 && tasks[due[pos - 1]].priority < tasks[i].priority) {
+      due[pos] = due[pos - 1];
+      pos--;
     }
-    lastTimeSync = millis();
+    due[pos] = i;
   }
   
-  // Update device status periodically
-  if (millis() - lastStatusUpdate > 60000) { // Every minute
-    debugPrint("Updating device status...");
-    updateDeviceStatus();
-    lastStatusUpdate = millis();
+  for (int i = 0; i < dueCount; i++) {
+    PeriodicTask& task = tasks[due[i]];
+    unsigned long late = millis() - task.nextRun;
+    if (late > task.jitter) {
+      task.overruns++;
+      LOG_WARN("Task '%s' overrun by %lu ms (%lu total)", task.name, late, task.overruns);
+    }
+    
+    task.run();
+    task.runs++;
+    
+    // Keep the phase unless we fell a whole period behind
+    task.nextRun += task.period;
+    if ((long)(millis() - task.nextRun) >= 0) {
+      task.nextRun = millis() + task.period;
+    }
   }
-  
-  // Check feeding schedules
-  if (millis() - lastScheduleCheck > 30000) { // Every 30 seconds
-    debugPrint("Checking feeding schedules...");
-    checkSchedules();
-    lastScheduleCheck = millis();
+}
+
+// Milliseconds until the earliest job window closes
+unsigned long msUntilNextTask() {
+  unsigned long now = millis();
+  long wait = 0x7FFFFFFF;
+  
+  for (int i = 0; i < taskCount; i++) {
+    long remaining = (long)(tasks[i].nextRun + tasks[i].jitter - now);
+    if (remaining < wait) {
+      wait = remaining;
+    }
   }
   
-  // Check for manual feed commands
-  debugPrint("Checking for manual feed commands...");
-  checkForManualFeedCommand();
-  
-  // Check food level and update
-  debugPrint("Updating food and battery levels...");
-  updateFoodLevel();
-  
-  // Blink LED once to indicate normal operation
-  if (DEBUG_LED_ENABLED && millis() - debugTimestamp > 10000) { // Every 10 seconds
-    debugBlink(1, 50);
-    debugTimestamp = millis();
+  return wait > 0 ? (unsigned long)wait : 0;
+}
+
+// Refresh local time from NTP
+void syncTime() {
+  if (getLocalTime(&timeinfo)) {
+    char timeStringBuff[50];
+    strftime(timeStringBuff, sizeof(timeStringBuff), "%Y-%m-%d %H:%M:%S", &timeinfo);
+    LOG_INFO("Time synchronized, current time: %s", timeStringBuff);
+    timeInitialized = true;
+  } else {
+    LOG_ERROR("Time synchronization FAILED");
+    timeInitialized = false;
+    debugBlink(4, 200); // Error indicator
   }
-  
-  delay(1000); // Small delay to prevent excessive API calls
 }
 
 // Update device status in Supabase
 void updateDeviceStatus() {
-  String deviceId = WiFi.macAddress();
-  deviceId.replace(":", "");
+  if (!resolveDeviceUuid()) {
+    supabaseConnected = false;
+    return;
+  }
   
-  debugPrint("Updating device status for ID: " + deviceId, true);
+  LOG_DEBUG("Updating device status for ID: %s", deviceUuid);
   
   // Get current time
   time_t now;
   time(&now);
   
-  // Create JSON payload - only include fields that exist in the database
-  JsonDocument doc;
-  doc["status"] = "online";
-  doc["last_seen"] = now;
-  doc["wifi_strength"] = WiFi.RSSI();
-  // Note: ip_address field removed as it doesn't exist in the schema
-  
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
+  // JSON payload - only include fields that exist in the database
+  snprintf(requestBody, sizeof(requestBody),
+           "{\"status\":\"online\",\"last_seen\":%ld,\"wifi_strength\":%d}",
+           (long)now, (int)WiFi.RSSI());
   
-  debugPrint("Status payload: " + jsonPayload, true);
+  LOG_DEBUG("Status payload: %s", requestBody);
   
   // Send to Supabase
-  String url = String(SUPABASE_URL) + "/rest/v1/devices?id=eq." + deviceId;
-  debugPrint("Sending PATCH request to: " + url, true);
-  
-  http.begin(client, url);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("apikey", SUPABASE_API_KEY);
-  http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-  http.addHeader("Prefer", "return=minimal");
+  beginSupabaseRequest(supabaseUrl("/rest/v1/devices?id=eq.%s", deviceUuid), true);
   
   unsigned long requestStartTime = millis();
-  int patchResponseCode = http.PATCH(jsonPayload);
+  int patchResponseCode = http.PATCH((uint8_t*)requestBody, strlen(requestBody));
   unsigned long requestDuration = millis() - requestStartTime;
   
   if (patchResponseCode == 204) {
-    debugPrint("Device status updated successfully (" + String(requestDuration) + "ms)", true);
+    LOG_INFO("Device status updated successfully (%lu ms)", requestDuration);
     supabaseConnected = true;
   } else {
-    debugPrint("Error updating device status: " + String(patchResponseCode), true);
-    debugPrint("Response: " + http.getString(), true);
+    LOG_ERROR("Error updating device status: %d", patchResponseCode);
+    LOG_DEBUG("Response: %s", http.getString().c_str());
     supabaseConnected = false;
     debugBlink(3, 200); // Error indicator
   }
@@ -386,87 +771,40 @@ void updateDeviceStatus() {
 
 // Load feeding schedules from Supabase
 void loadSchedules() {
-  String deviceId = WiFi.macAddress();
-  deviceId.replace(":", "");
-  
-  debugPrint("Loading feeding schedules for device: " + deviceId, true);
-  
-  // Note: The device_id in the database is a UUID, not a MAC address
-  // We need to first query the devices table to get the UUID for this device
-  String url = String(SUPABASE_URL) + "/rest/v1/devices?mac_address=eq." + deviceId + "&select=id";
-  debugPrint("Sending GET request to get device UUID: " + url, true);
+  // The device_id in the database is the devices row UUID, not the MAC
+  if (!resolveDeviceUuid()) {
+    return;
+  }
   
-  http.begin(client, url);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("apikey", SUPABASE_API_KEY);
-  http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
+  LOG_DEBUG("Loading feeding schedules for device: %s", deviceUuid);
+  beginSupabaseRequest(supabaseUrl("/rest/v1/feeding_schedules?device_id=eq.%s&select=*", deviceUuid), false);
   
   unsigned long requestStartTime = millis();
   int httpResponseCode = http.GET();
   unsigned long requestDuration = millis() - requestStartTime;
   
   if (httpResponseCode == 200) {
-    String response = http.getString();
-    debugPrint("Received device data (" + String(requestDuration) + "ms)", true);
-    debugPrint("Response size: " + String(response.length()) + " bytes", true);
+    String schedulesResponse = http.getString();
+    LOG_DEBUG("Received schedule data (%lu ms)", requestDuration);
+    LOG_DEBUG("Response size: %u bytes", schedulesResponse.length());
     
-    // Parse JSON response to get device UUID
-    JsonDocument deviceDoc;
-    DeserializationError error = deserializeJson(deviceDoc, response);
+    // Parse JSON response
+    JsonDocument doc;
+    DeserializationError error = deserializeJson(doc, schedulesResponse);
     
     if (error) {
-      debugPrint("ERROR: deserializeJson() failed: " + String(error.c_str()), true);
-      debugBlink(4, 200); // Error indicator
-      return;
-    }
-    
-    // Check if device exists in database
-    JsonArray deviceArray = deviceDoc.as<JsonArray>();
-    if (deviceArray.size() == 0) {
-      debugPrint("ERROR: Device not found in database", true);
+      LOG_ERROR("deserializeJson() failed: %s", error.c_str());
       debugBlink(4, 200); // Error indicator
+      http.end();
       return;
     }
     
-    // Get the UUID for this device
-    String deviceUuid = deviceArray[0]["id"].as<String>();
-    debugPrint("Device UUID: " + deviceUuid, true);
-    
-    // Now get the feeding schedules using the UUID
-    http.end();
-    String schedulesUrl = String(SUPABASE_URL) + "/rest/v1/feeding_schedules?device_id=eq." + deviceUuid + "&select=*";
-    debugPrint("Sending GET request for schedules: " + schedulesUrl, true);
-    
-    http.begin(client, schedulesUrl);
-    http.addHeader("Content-Type", "application/json");
-    http.addHeader("apikey", SUPABASE_API_KEY);
-    http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-    
-    requestStartTime = millis();
-    httpResponseCode = http.GET();
-    requestDuration = millis() - requestStartTime;
+    // Clear existing schedules
+    scheduleCount = 0;
     
-    if (httpResponseCode == 200) {
-      String schedulesResponse = http.getString();
-      debugPrint("Received schedule data (" + String(requestDuration) + "ms)", true);
-      debugPrint("Response size: " + String(schedulesResponse.length()) + " bytes", true);
-      
-      // Parse JSON response
-      JsonDocument doc;
-      DeserializationError error = deserializeJson(doc, schedulesResponse);
-      
-      if (error) {
-        debugPrint("ERROR: deserializeJson() failed: " + String(error.c_str()), true);
-        debugBlink(4, 200); // Error indicator
-        return;
-      }
-      
-      // Clear existing schedules
-      scheduleCount = 0;
-      
-      // Process schedules
-      JsonArray array = doc.as<JsonArray>();
-      debugPrint("Found " + String(array.size()) + " schedules in database", true);
+    // Process schedules
+    JsonArray array = doc.as<JsonArray>();
+    LOG_DEBUG("Found %u schedules in database", (unsigned)array.size());
     
     for (JsonObject obj : array) {
       if (scheduleCount < 10) { // Maximum 10 schedules
@@ -481,23 +819,22 @@ void loadSchedules() {
           schedules[scheduleCount].days[i] = days[i].as<bool>();
         }
         
-        debugPrint("Schedule " + String(scheduleCount+1) + ": " + 
-                  schedules[scheduleCount].time + ", " + 
-                  String(schedules[scheduleCount].amount) + "g, " + 
-                  (schedules[scheduleCount].enabled ? "enabled" : "disabled"));
+        LOG_DEBUG("Schedule %d: %s, %dg, %s", scheduleCount + 1,
+                  schedules[scheduleCount].time.c_str(), schedules[scheduleCount].amount,
+                  schedules[scheduleCount].enabled ? "enabled" : "disabled");
         
         scheduleCount++;
       } else {
-        debugPrint("WARNING: Maximum schedule limit reached (10). Ignoring additional schedules.");
+        LOG_WARN("Maximum schedule limit reached (10). Ignoring additional schedules.");
         break;
       }
     }
     
-    debugPrint("Successfully loaded " + String(scheduleCount) + " schedules");
+    LOG_INFO("Successfully loaded %d schedules", scheduleCount);
     debugBlink(2); // Success indicator
   } else {
-    debugPrint("ERROR: Failed to load schedules: " + String(httpResponseCode));
-    debugPrint("Response: " + http.getString());
+    LOG_ERROR("Failed to load schedules: %d", httpResponseCode);
+    LOG_DEBUG("Response: %s", http.getString().c_str());
     debugBlink(4, 200); // Error indicator
   }
   
@@ -505,13 +842,11 @@ void loadSchedules() {
 }
 
 // Check if any scheduled feeding is due
-}
-
 void checkSchedules() {
-  debugPrint("Checking feeding schedules...");
+  LOG_DEBUG("Checking feeding schedules...");
   
   if (!getLocalTime(&timeinfo)) {
-    debugPrint("ERROR: Failed to obtain time");
+    LOG_ERROR("Failed to obtain time");
     timeInitialized = false;
     debugBlink(4, 200); // Error indicator
     return;
@@ -522,124 +857,87 @@ void checkSchedules() {
   String currentTime = String(timeStr);
   int currentDay = timeinfo.tm_wday; // 0 = Sunday
   
+  int currentMinute = currentDay * 1440 + timeinfo.tm_hour * 60 + timeinfo.tm_min;
+  
   char dayNames[7][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
-  debugPrint("Current time: " + currentTime + ", Day: " + String(dayNames[currentDay]));
+  LOG_DEBUG("Current time: %s, Day: %s", timeStr, dayNames[currentDay]);
+  
+  // Schedules are checked every 30 seconds, so only fire once per minute
+  if (currentMinute == lastScheduleMinute) {
+    LOG_DEBUG("Already fed for this minute, skipping");
+    return;
+  }
   
   if (scheduleCount == 0) {
-    debugPrint("No feeding schedules found");
+    LOG_DEBUG("No feeding schedules found");
     return;
   }
   
-  debugPrint("Checking " + String(scheduleCount) + " schedules...");
+  LOG_DEBUG("Checking %d schedules...", scheduleCount);
   
   for (int i = 0; i < scheduleCount; i++) {
-    debugPrint("Schedule " + String(i+1) + ": " + schedules[i].time + 
-              ", enabled: " + (schedules[i].enabled ? "yes" : "no") + 
-              ", today: " + (schedules[i].days[currentDay] ? "yes" : "no"));
+    LOG_DEBUG("Schedule %d: %s, enabled: %s, today: %s", i + 1, schedules[i].time.c_str(),
+              schedules[i].enabled ? "yes" : "no", schedules[i].days[currentDay] ? "yes" : "no");
     
     if (schedules[i].enabled && 
         schedules[i].days[currentDay] && 
         currentTime == schedules[i].time) {
       
       // Time to feed!
-      debugPrint("MATCH FOUND! Scheduled feeding: " + 
-                String(schedules[i].amount) + " grams");
+      LOG_INFO("MATCH FOUND! Scheduled feeding: %d grams", schedules[i].amount);
       debugBlink(3); // Schedule match indicator
       
-      feed(schedules[i].amount);
-      
-      // Log feeding event
-      debugPrint("Logging scheduled feeding event...");
-      logFeedingEvent(schedules[i].amount, "scheduled");
-      
-      // Small delay to prevent multiple triggers
-      debugPrint("Waiting 60 seconds to prevent multiple triggers...");
-      delay(60000);
+      // Logged by onFeedComplete() once the hopper is closed
+      feed(schedules[i].amount, "scheduled");
+      lastScheduleMinute = currentMinute;
     }
   }
   
-  debugPrint("Schedule check complete");
+  LOG_DEBUG("Schedule check complete");
 }
  
-// Check for manual feed commands from Supabase
+// Claim manual feed commands from Supabase. One conditional PATCH moves
+// pending commands to processing and returns the rows it changed, so a
+// command is never handed out twice. At most the free feed queue slots
+// are claimed, so every claimed command is either queued or failed.
+// Completed feeds from earlier passes go out first as one bulk insert.
 void checkForManualFeedCommand() {
-  debugPrint("Checking for manual feed commands...", true);
-  
-  String deviceId = WiFi.macAddress();
-  deviceId.replace(":", "");
-  
-  // First get the device UUID
-  String deviceUrl = String(SUPABASE_URL) + "/rest/v1/devices?mac_address=eq." + deviceId + "&select=id";
-  debugPrint("Sending GET request to get device UUID: " + deviceUrl, true);
-  
-  http.begin(client, deviceUrl);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("apikey", SUPABASE_API_KEY);
-  http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-  
-  unsigned long requestStartTime = millis();
-  int httpResponseCode = http.GET();
-  unsigned long requestDuration = millis() - requestStartTime;
+  LOG_DEBUG("Checking for manual feed commands...");
   
-  if (httpResponseCode != 200) {
-    debugPrint("ERROR: Failed to get device UUID: " + String(httpResponseCode), true);
-    debugPrint("Response: " + http.getString(), true);
-    debugBlink(4, 200); // Error indicator
-    http.end();
+  if (!resolveDeviceUuid()) {
     return;
   }
   
-  String response = http.getString();
+  flushFeedingHistory();
   
-  // Parse JSON response to get device UUID
-  JsonDocument deviceDoc;
-  DeserializationError error = deserializeJson(deviceDoc, response);
-  
-  if (error) {
-    debugPrint("ERROR: deserializeJson() failed: " + String(error.c_str()), true);
-    debugBlink(4, 200); // Error indicator
-    http.end();
+  int freeSlots = FEED_QUEUE_SIZE - feedQueueCount;
+  if (freeSlots == 0) {
+    LOG_DEBUG("Feed queue full, not claiming commands");
     return;
   }
   
-  // Check if device exists in database
-  JsonArray deviceArray = deviceDoc.as<JsonArray>();
-  if (deviceArray.size() == 0) {
-    debugPrint("ERROR: Device not found in database", true);
-    debugBlink(4, 200); // Error indicator
-    http.end();
-    return;
-  }
-  
-  // Get the UUID for this device
-  String deviceUuid = deviceArray[0]["id"].as<String>();
-  debugPrint("Device UUID: " + deviceUuid, true);
-  http.end();
-  
-  // Now check for feed commands using the UUID
-  String commandsUrl = String(SUPABASE_URL) + "/rest/v1/feed_commands?device_id=eq." + deviceUuid + "&status=eq.pending&select=*";
-  debugPrint("Sending GET request for feed commands: " + commandsUrl, true);
-  
-  http.begin(client, commandsUrl);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("apikey", SUPABASE_API_KEY);
-  http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
+  // PostgREST needs an order for a limited update
+  beginSupabaseRequest(supabaseUrl("/rest/v1/feed_commands?device_id=eq.%s&status=eq.pending"
+                                   "&select=id,amount&order=created_at,id&limit=%d", deviceUuid, freeSlots), false);
+  http.addHeader("Prefer", "return=representation");
   
-  requestStartTime = millis();
-  httpResponseCode = http.GET();
-  requestDuration = millis() - requestStartTime;
+  const char* claim = "{\"status\":\"processing\"}";
+  unsigned long requestStartTime = millis();
+  int httpResponseCode = http.PATCH((uint8_t*)claim, strlen(claim));
+  unsigned long requestDuration = millis() - requestStartTime;
   
   if (httpResponseCode == 200) {
     String response = http.getString();
-    debugPrint("Received response (" + String(requestDuration) + "ms)");
-    debugPrint("Response size: " + String(response.length()) + " bytes");
+    http.end();
+    LOG_DEBUG("Received response (%lu ms)", requestDuration);
+    LOG_DEBUG("Response size: %u bytes", (unsigned)response.length());
     
     // Parse JSON response
     JsonDocument doc;
     DeserializationError error = deserializeJson(doc, response);
     
     if (error) {
-      debugPrint("ERROR: deserializeJson() failed: " + String(error.c_str()));
+      LOG_ERROR("deserializeJson() failed: %s", error.c_str());
       debugBlink(4, 200); // Error indicator
       return;
     }
@@ -649,165 +947,141 @@ void checkForManualFeedCommand() {
     int commandCount = array.size();
     
     if (commandCount == 0) {
-      debugPrint("No pending feed commands found");
+      LOG_DEBUG("No pending feed commands found");
       return;
     }
     
-    debugPrint("Found " + String(commandCount) + " pending feed commands");
+    LOG_INFO("Claimed %d feed commands", commandCount);
     debugBlink(2); // Command found indicator
     
+    // Commands the dispenser refused, marked failed together below
+    char failedIds[FEED_QUEUE_SIZE * 37] = "";
+    
     for (JsonObject obj : array) {
       String commandId = obj["id"].as<String>();
       int amount = obj["amount"].as<int>();
       
       // Execute feed command
-      debugPrint("========== MANUAL FEEDING COMMAND ==========");
+      LOG_INFO("========== MANUAL FEEDING COMMAND ==========");
       
-      // Update command status to 'processing'
-      updateCommandStatus(commandId, "processing");
-      
-      // Execute the feed command
-      debugPrint("Executing feed command: " + String(amount) + " grams");
-      feed(amount);
-      
-      // Update command status to 'completed'
-      updateCommandStatus(commandId, "completed");
-      
-      // Log feeding event
-      logFeedingEvent(amount, "manual");
+      // Queue the feed command, onFeedComplete() logs the feeding event
+      // which completes the command
+      LOG_INFO("Executing feed command: %d grams", amount);
+      if (!feed(amount, "manual", commandId)) {
+        if (failedIds[0] != '\0') {
+          strlcat(failedIds, ",", sizeof(failedIds));
+        }
+        strlcat(failedIds, commandId.c_str(), sizeof(failedIds));
+      }
+    }
+    
+    if (failedIds[0] != '\0') {
+      updateCommandStatus(failedIds, "error");
     }
   } else {
-    debugPrint("ERROR: Failed to get feed commands: " + String(httpResponseCode));
-    debugPrint("Response: " + http.getString());
+    LOG_ERROR("Failed to claim feed commands: %d", httpResponseCode);
+    LOG_DEBUG("Response: %s", http.getString().c_str());
+    http.end();
     debugBlink(4, 200); // Error indicator
   }
-  
-  http.end();
 }
 
-// Update command status in Supabase
-void updateCommandStatus(String commandId, String status) {
-  debugPrint("Updating command status for ID: " + commandId + " to '" + status + "'", true);
-  
-  JsonDocument doc;
-  doc["status"] = status;
-  
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
+// Set the status of one or more commands, idList is comma separated
+void updateCommandStatus(const char* idList, const char* status) {
+  LOG_DEBUG("Updating command status for IDs: %s to '%s'", idList, status);
   
-  debugPrint("Status update payload: " + jsonPayload, true);
+  snprintf(requestBody, sizeof(requestBody), "{\"status\":\"%s\"}", status);
+  LOG_DEBUG("Status update payload: %s", requestBody);
   
-  String url = String(SUPABASE_URL) + "/rest/v1/feed_commands?id=eq." + commandId;
-  debugPrint("Sending PATCH request to: " + url, true);
-  
-  http.begin(client, url);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("apikey", SUPABASE_API_KEY);
-  http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-  http.addHeader("Prefer", "return=minimal");
+  beginSupabaseRequest(supabaseUrl("/rest/v1/feed_commands?id=in.(%s)", idList), true);
   
   unsigned long requestStartTime = millis();
-  int patchResponseCode = http.PATCH(jsonPayload);
+  int patchResponseCode = http.PATCH((uint8_t*)requestBody, strlen(requestBody));
   unsigned long requestDuration = millis() - requestStartTime;
   
   if (patchResponseCode == 204) {
-    debugPrint("Command status updated successfully (" + String(requestDuration) + "ms)");
+    LOG_INFO("Command status updated successfully (%lu ms)", requestDuration);
   } else {
-    debugPrint("ERROR: Failed to update command status: " + String(patchResponseCode));
-    debugPrint("Response: " + http.getString());
+    LOG_ERROR("Failed to update command status: %d", patchResponseCode);
+    LOG_DEBUG("Response: %s", http.getString().c_str());
     debugBlink(3, 200); // Error indicator
   }
   
   http.end();
 }
 
-// Log feeding event to Supabase
-void logFeedingEvent(int amount, String type) {
-  debugPrint("Logging feeding event: " + String(amount) + "g, type: " + type, true);
-  
-  String deviceId = WiFi.macAddress();
-  deviceId.replace(":", "");
-  
-  // First get the device UUID
-  String deviceUrl = String(SUPABASE_URL) + "/rest/v1/devices?mac_address=eq." + deviceId + "&select=id";
-  debugPrint("Sending GET request to get device UUID: " + deviceUrl, true);
+// Queue a feeding event for the next bulk insert. The batch is sent by
+// the next command check, or right away once it is full.
+void logFeedingEvent(int amount, String type, String commandId) {
+  LOG_DEBUG("Logging feeding event: %dg, type: %s", amount, type.c_str());
   
-  http.begin(client, deviceUrl);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("apikey", SUPABASE_API_KEY);
-  http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-  
-  int httpResponseCode = http.GET();
-  
-  if (httpResponseCode != 200) {
-    debugPrint("ERROR: Failed to get device UUID: " + String(httpResponseCode), true);
-    debugPrint("Response: " + http.getString(), true);
-    debugBlink(4, 200); // Error indicator
-    http.end();
+  if (pendingHistoryCount == HISTORY_BATCH_SIZE) {
+    flushFeedingHistory();
+  }
+  if (pendingHistoryCount == HISTORY_BATCH_SIZE) {
+    LOG_ERROR("Feeding history batch full, event dropped");
     return;
   }
   
-  String response = http.getString();
-  http.end();
-  
-  // Parse JSON response to get device UUID
-  JsonDocument deviceDoc;
-  DeserializationError error = deserializeJson(deviceDoc, response);
-  
-  if (error) {
-    debugPrint("ERROR: deserializeJson() failed: " + String(error.c_str()), true);
-    debugBlink(4, 200); // Error indicator
+  FeedingRecord& record = pendingHistory[pendingHistoryCount++];
+  record.amount = amount;
+  strlcpy(record.type, type.c_str(), sizeof(record.type));
+  strlcpy(record.commandId, commandId.c_str(), sizeof(record.commandId));
+  time(&record.timestamp);
+}
+
+// Feed time as a quoted ISO 8601 UTC string for the fed_at column, or null
+// before the clock is set so the server uses the upload time
+void formatFeedTime(time_t t, char* out, size_t size) {
+  struct tm utc;
+  gmtime_r(&t, &utc);
+  if (utc.tm_year < 2016 - 1900) {
+    strlcpy(out, "null", size);
     return;
   }
-  
-  // Check if device exists in database
-  JsonArray deviceArray = deviceDoc.as<JsonArray>();
-  if (deviceArray.size() == 0) {
-    debugPrint("ERROR: Device not found in database", true);
-    debugBlink(4, 200); // Error indicator
+  strftime(out, size, "\"%Y-%m-%dT%H:%M:%SZ\"", &utc);
+}
+
+// Send queued feeding events to Supabase as one bulk insert. Rows with a
+// command id complete their command through a trigger on the server.
+void flushFeedingHistory() {
+  if (pendingHistoryCount == 0 || !resolveDeviceUuid()) {
     return;
   }
   
-  // Get the UUID for this device
-  String deviceUuid = deviceArray[0]["id"].as<String>();
-  debugPrint("Device UUID: " + deviceUuid, true);
-  
-  // Get current time
-  time_t now;
-  time(&now);
-  
-  // Create JSON payload without user references
-  JsonDocument doc;
-  doc["device_id"] = deviceUuid; // Use UUID instead of MAC address
-  doc["amount"] = amount;
-  doc["type"] = type;
-  doc["timestamp"] = now;
-  
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
+  // JSON array without user references, keyed by the device UUID. Every
+  // row of a bulk insert needs the same keys, so command_id may be null.
+  int length = strlcpy(requestBody, "[", sizeof(requestBody));
+  for (int i = 0; i < pendingHistoryCount; i++) {
+    const FeedingRecord& record = pendingHistory[i];
+    char commandId[40] = "null";
+    if (record.commandId[0] != '\0') {
+      snprintf(commandId, sizeof(commandId), "\"%s\"", record.commandId);
+    }
+    char fedAt[24];
+    formatFeedTime(record.timestamp, fedAt, sizeof(fedAt));
+    length += snprintf(requestBody + length, sizeof(requestBody) - length,
+                       "%s{\"device_id\":\"%s\",\"amount\":%d,\"type\":\"%s\",\"fed_at\":%s,\"command_id\":%s}",
+                       i ? "," : "", deviceUuid, record.amount, record.type, fedAt, commandId);
+  }
+  strlcat(requestBody, "]", sizeof(requestBody));
   
-  debugPrint("Feeding event payload: " + jsonPayload);
+  LOG_DEBUG("Feeding history payload: %s", requestBody);
   
   // Send to Supabase
-  String url = String(SUPABASE_URL) + "/rest/v1/feeding_history";
-  debugPrint("Sending POST request to: " + url);
-  
-  http.begin(client, url);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("apikey", SUPABASE_API_KEY);
-  http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-  http.addHeader("Prefer", "return=minimal");
+  beginSupabaseRequest(supabaseUrl("/rest/v1/feeding_history"), true);
   
   unsigned long requestStartTime = millis();
-  int postResponseCode = http.POST(jsonPayload);
+  int postResponseCode = http.POST((uint8_t*)requestBody, strlen(requestBody));
   unsigned long requestDuration = millis() - requestStartTime;
   
   if (postResponseCode == 201) {
-    debugPrint("Feeding event logged successfully (" + String(requestDuration) + "ms)");
+    LOG_INFO("Logged %d feeding events (%lu ms)", pendingHistoryCount, requestDuration);
+    pendingHistoryCount = 0;
     debugBlink(2); // Success indicator
   } else {
-    debugPrint("ERROR: Failed to log feeding event: " + String(postResponseCode));
-    debugPrint("Response: " + http.getString());
+    LOG_ERROR("Failed to log feeding events: %d", postResponseCode);
+    LOG_DEBUG("Response: %s", http.getString().c_str());
     debugBlink(3, 200); // Error indicator
   }
   
@@ -816,91 +1090,36 @@ void logFeedingEvent(int amount, String type) {
 
 // Update food level in Supabase
 void updateFoodLevel() {
-  debugPrint("Updating food level in Supabase...", true);
-  
-  String deviceId = WiFi.macAddress();
-  deviceId.replace(":", "");
+  LOG_DEBUG("Updating food level in Supabase...");
   
   // Read food level from sensor
   int foodLevel = readFoodLevel();
   
   // Check if reading was successful
   if (foodLevel < 0) {
-    debugPrint("ERROR: Failed to read food level, skipping update", true);
-    return;
-  }
-  
-  // First get the device UUID
-  String deviceUrl = String(SUPABASE_URL) + "/rest/v1/devices?mac_address=eq." + deviceId + "&select=id";
-  debugPrint("Sending GET request to get device UUID: " + deviceUrl, true);
-  
-  http.begin(client, deviceUrl);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("apikey", SUPABASE_API_KEY);
-  http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-  
-  int httpResponseCode = http.GET();
-  
-  if (httpResponseCode != 200) {
-    debugPrint("ERROR: Failed to get device UUID: " + String(httpResponseCode), true);
-    debugPrint("Response: " + http.getString(), true);
-    debugBlink(4, 200); // Error indicator
-    http.end();
+    LOG_ERROR("Failed to read food level, skipping update");
     return;
   }
   
-  String response = http.getString();
-  http.end();
-  
-  // Parse JSON response to get device UUID
-  JsonDocument deviceDoc;
-  DeserializationError error = deserializeJson(deviceDoc, response);
-  
-  if (error) {
-    debugPrint("ERROR: deserializeJson() failed: " + String(error.c_str()), true);
-    debugBlink(4, 200); // Error indicator
-    return;
-  }
-  
-  // Check if device exists in database
-  JsonArray deviceArray = deviceDoc.as<JsonArray>();
-  if (deviceArray.size() == 0) {
-    debugPrint("ERROR: Device not found in database", true);
-    debugBlink(4, 200); // Error indicator
+  if (!resolveDeviceUuid()) {
     return;
   }
   
-  // Get the UUID for this device
-  String deviceUuid = deviceArray[0]["id"].as<String>();
-  
-  // Create JSON payload
-  JsonDocument doc;
-  doc["food_level"] = foodLevel;
-  
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
-  
-  debugPrint("Food level payload: " + jsonPayload, true);
+  snprintf(requestBody, sizeof(requestBody), "{\"food_level\":%d}", foodLevel);
+  LOG_DEBUG("Food level payload: %s", requestBody);
   
   // Send to Supabase
-  String url = String(SUPABASE_URL) + "/rest/v1/devices?id=eq." + deviceUuid;
-  debugPrint("Sending PATCH request to: " + url, true);
-  
-  http.begin(client, url);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("apikey", SUPABASE_API_KEY);
-  http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-  http.addHeader("Prefer", "return=minimal");
+  beginSupabaseRequest(supabaseUrl("/rest/v1/devices?id=eq.%s", deviceUuid), true);
   
   unsigned long requestStartTime = millis();
-  int patchResponseCode = http.PATCH(jsonPayload);
+  int patchResponseCode = http.PATCH((uint8_t*)requestBody, strlen(requestBody));
   unsigned long requestDuration = millis() - requestStartTime;
   
   if (patchResponseCode == 204) {
-    debugPrint("Food level updated successfully (" + String(requestDuration) + "ms)");
+    LOG_DEBUG("Food level updated successfully (%lu ms)", requestDuration);
   } else {
-    debugPrint("ERROR: Failed to update food level: " + String(patchResponseCode));
-    debugPrint("Response: " + http.getString());
+    LOG_ERROR("Failed to update food level: %d", patchResponseCode);
+    LOG_DEBUG("Response: %s", http.getString().c_str());
     debugBlink(3, 200); // Error indicator
   }
   
@@ -912,94 +1131,131 @@ void updateFoodLevel() {
 
 // Update battery level in Supabase
 void updateBatteryLevel() {
-  debugPrint("Updating battery level in Supabase...");
+  LOG_DEBUG("Updating battery level in Supabase...");
   
-  String deviceId = WiFi.macAddress();
-  deviceId.replace(":", "");
+  if (!resolveDeviceUuid()) {
+    return;
+  }
   
   // Read battery level
   int batteryLevel = readBatteryLevel();
+  if (batteryLevel < 0) {
+    return;
+  }
   
-  // Create JSON payload
-  JsonDocument doc;
-  doc["battery_level"] = batteryLevel;
-  
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
-  
-  debugPrint("Battery level payload: " + jsonPayload);
+  snprintf(requestBody, sizeof(requestBody), "{\"battery_level\":%d}", batteryLevel);
+  LOG_DEBUG("Battery level payload: %s", requestBody);
   
   // Send to Supabase
-  String url = String(SUPABASE_URL) + "/rest/v1/devices?id=eq." + deviceId;
-  debugPrint("Sending PATCH request to: " + url);
-  
-  http.begin(client, url);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("apikey", SUPABASE_API_KEY);
-  http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-  http.addHeader("Prefer", "return=minimal");
+  beginSupabaseRequest(supabaseUrl("/rest/v1/devices?id=eq.%s", deviceUuid), true);
   
   unsigned long requestStartTime = millis();
-  int patchResponseCode = http.PATCH(jsonPayload);
+  int patchResponseCode = http.PATCH((uint8_t*)requestBody, strlen(requestBody));
   unsigned long requestDuration = millis() - requestStartTime;
   
   if (patchResponseCode == 204) {
-    debugPrint("Battery level updated successfully (" + String(requestDuration) + "ms)");
+    LOG_DEBUG("Battery level updated successfully (%lu ms)", requestDuration);
   } else {
-    debugPrint("ERROR: Failed to update battery level: " + String(patchResponseCode));
-    debugPrint("Response: " + http.getString());
+    LOG_ERROR("Failed to update battery level: %d", patchResponseCode);
+    LOG_DEBUG("Response: %s", http.getString().c_str());
     debugBlink(3, 200); // Error indicator
   }
   
   http.end();
 }
 
-// Read food level from sensor
-int readFoodLevel() {
-  debugPrint("Reading food level from ultrasonic sensor...", true);
+// Echo edge interrupt: timestamps the rising edge and measures the pulse
+// on the falling one
+void IRAM_ATTR onEcho() {
+  int64_t now = esp_timer_get_time();
+  if (gpio_get_level((gpio_num_t)ECHO_PIN)) {
+    echoStart = now;
+  } else if (echoStart != 0) {
+    echoWidth = now - echoStart;
+    echoStart = 0;
+    echoReady = true;
+  }
+}
+
+// Timer callback: collect the echo of the previous ping, then send the next
+void sonarTick(void* arg) {
+  if (echoReady) {
+    echoReady = false;
+    addEchoSample(echoWidth);
+  } else if (sonarPinging) {
+    sonarTimeouts++;
+  }
   
-  // Try up to 3 times to get a valid reading
-  long duration = 0;
-  int attempts = 0;
-  const int maxAttempts = 3;
+  echoStart = 0;
+  digitalWrite(TRIG_PIN, HIGH);
+  delayMicroseconds(10);
+  digitalWrite(TRIG_PIN, LOW);
+  sonarPinging = true;
+}
+
+// Feed one echo pulse width through the median filter and the average
+void addEchoSample(uint32_t widthUs) {
+  if (widthUs == 0 || widthUs > SONAR_ECHO_TIMEOUT) {
+    sonarTimeouts++;
+    return;
+  }
   
-  while (attempts < maxAttempts) {
-    attempts++;
-    
-    // Reset the sensor by setting TRIG low
-    digitalWrite(TRIG_PIN, LOW);
-    delayMicroseconds(5);
-    
-    // Send a pulse
-    digitalWrite(TRIG_PIN, HIGH);
-    delayMicroseconds(10);
-    digitalWrite(TRIG_PIN, LOW);
-    
-    // Measure the response with a longer timeout (50ms)
-    duration = pulseIn(ECHO_PIN, HIGH, 50000); 
-    
-    // Check if reading was successful
-    if (duration > 0) {
-      debugPrint("Ultrasonic reading successful on attempt " + String(attempts), true);
-      break;
+  // Sound travels about 0.343 mm/us, halved for the round trip
+  sonarWindow[sonarWindowPos] = widthUs * 343 / 2000;
+  sonarWindowPos = (sonarWindowPos + 1) % SONAR_MEDIAN_WINDOW;
+  if (sonarWindowCount < SONAR_MEDIAN_WINDOW) sonarWindowCount++;
+  
+  uint16_t sorted[SONAR_MEDIAN_WINDOW];
+  for (uint8_t i = 0; i < sonarWindowCount; i++) {
+    uint8_t pos = i;
+    while (pos > 0 && sorted[pos - 1] > sonarWindow[i]) {
+      sorted[pos] = sorted[pos - 1];
+      pos--;
     }
-    
-    debugPrint("Ultrasonic reading attempt " + String(attempts) + " failed, retrying...", true);
-    delay(100); // Wait before retrying
+    sorted[pos] = sonarWindow[i];
+  }
+  
+  int32_t value = (int32_t)sorted[sonarWindowCount / 2] << SONAR_EMA_SHIFT;
+  if (sonarAverage < 0) {
+    sonarAverage = value;
+  } else {
+    sonarAverage += (value - sonarAverage) >> SONAR_EMA_SHIFT;
   }
+  sonarDistanceMm = sonarAverage >> SONAR_EMA_SHIFT;
+}
+
+// Configure the sensor pins and start pinging in the background
+bool startFoodSensor() {
+  pinMode(TRIG_PIN, OUTPUT);
+  digitalWrite(TRIG_PIN, LOW);
+  pinMode(ECHO_PIN, INPUT);
+  attachInterrupt(ECHO_PIN, onEcho, CHANGE);
   
-  // Check if all readings timed out
-  if (duration == 0) {
-    debugPrint("ERROR: Ultrasonic sensor reading timed out after " + String(maxAttempts) + " attempts", true);
+  esp_timer_create_args_t args = {};
+  args.callback = sonarTick;
+  args.name = "sonar";
+  if (esp_timer_create(&args, &sonarTimer) != ESP_OK) {
+    return false;
+  }
+  return esp_timer_start_periodic(sonarTimer, (uint64_t)SONAR_SAMPLE_INTERVAL * 1000) == ESP_OK;
+}
+
+// Read food level from the filtered ultrasonic distance. Returns at once:
+// the sensor is sampled in the background by sonarTick().
+int readFoodLevel() {
+  int32_t distanceMm = sonarDistanceMm;
+  
+  // No echo received yet
+  if (distanceMm < 0) {
+    LOG_ERROR("No ultrasonic reading yet (%lu timeouts)", (unsigned long)sonarTimeouts);
     debugBlink(3, 200); // Error indicator
     return -1; // Error value
   }
   
   // Calculate distance in cm
-  float distance = duration * 0.034 / 2;
+  float distance = distanceMm / 10.0;
   
-  debugPrint("Raw ultrasonic reading: " + String(duration) + " μs, " + 
-            String(distance) + " cm");
+  LOG_DEBUG("Filtered ultrasonic reading: %.1f cm", distance);
   
   // Convert distance to food level percentage
   // Assuming 5cm is empty (0%) and 30cm is full (100%)
@@ -1008,7 +1264,7 @@ int readFoodLevel() {
   
   // Check for out-of-range readings
   if (distance < 2 || distance > 400) {
-    debugPrint("WARNING: Ultrasonic reading out of valid range");
+    LOG_WARN("Ultrasonic reading out of valid range");
     debugBlink(2, 200); // Warning indicator
   }
   
@@ -1018,125 +1274,221 @@ int readFoodLevel() {
   // Map distance to percentage (inverted: closer = more food)
   int foodLevel = map(distance, maxDistance, minDistance, 0, 100);
   
-  debugPrint("Food level: " + String(foodLevel) + "% (distance: " + 
-            String(distance) + " cm)");
+  LOG_DEBUG("Food level: %d%% (distance: %.2f cm)", foodLevel, distance);
   
   // Check for low food level
   if (foodLevel < 20) {
-    debugPrint("WARNING: Food level low (" + String(foodLevel) + "%)");
+    LOG_WARN("Food level low (%d%%)", foodLevel);
     debugBlink(3, 200); // Warning indicator
   }
   
   return foodLevel;
 }
 
-// Read battery level
-int readBatteryLevel() {
-  debugPrint("Reading battery level...");
+// ADC interrupt: a burst of conversions is ready to be read
+void ARDUINO_ISR_ATTR onBatteryBurstDone() {
+  batteryBurstReady = true;
+}
+
+// Configure continuous mode on the battery pin and start the first burst
+bool startBatteryMonitor() {
+  uint8_t pins[] = {BATTERY_LEVEL_PIN};
+  analogContinuousSetWidth(12);
+  analogContinuousSetAtten(ADC_11db);
+  if (!analogContinuous(pins, 1, BATTERY_OVERSAMPLE, BATTERY_ADC_FREQUENCY, onBatteryBurstDone)) {
+    return false;
+  }
+  batteryAdcRunning = analogContinuousStart();
+  return batteryAdcRunning;
+}
+
+// Collect a finished burst into the moving average and start the next one
+void collectBatteryBurst() {
+  if (!batteryAdcRunning || !batteryBurstReady) {
+    return;
+  }
+  batteryBurstReady = false;
   
-  // Read analog value from battery monitoring pin
-  int rawValue = analogRead(BATTERY_LEVEL_PIN);
+  adc_continuous_data_t* result = NULL;
+  bool ok = analogContinuousRead(&result, 0);
+  analogContinuousStop();
   
-  // Convert analog reading to voltage
-  // ESP32 ADC is typically 12-bit (0-4095)
-  float voltage = rawValue * (3.3 / 4095.0) * 2; // Multiply by 2 if using a voltage divider
+  if (ok && result) {
+    int32_t value = (int32_t)(result[0].avg_read_mvolts * BATTERY_DIVIDER_RATIO) << BATTERY_EMA_SHIFT;
+    if (batteryAverage < 0) {
+      batteryAverage = value;
+    } else {
+      batteryAverage += (value - batteryAverage) >> BATTERY_EMA_SHIFT;
+    }
+    batteryMillivolts = batteryAverage >> BATTERY_EMA_SHIFT;
+  } else {
+    LOG_WARN("Battery ADC burst could not be read");
+  }
   
-  debugPrint("Raw ADC value: " + String(rawValue) + ", Voltage: " + 
-            String(voltage, 2) + "V");
+  analogContinuousStart();
+}
+
+// Single-cell LiPo state of charge at rest, interpolated from a discharge
+// curve since the voltage is far from linear in the middle
+int batteryPercentFromMillivolts(int32_t millivolts) {
+  static const uint16_t curveMv[] = {
+    4200, 4150, 4110, 4080, 4020, 3980, 3950, 3910, 3870, 3850, 3840,
+    3820, 3800, 3790, 3770, 3750, 3730, 3710, 3690, 3610, 3270
+  };
+  static const uint8_t curvePercent[] = {
+    100, 95, 90, 85, 80, 75, 70, 65, 60, 55, 50,
+    45, 40, 35, 30, 25, 20, 15, 10, 5, 0
+  };
+  const int points = sizeof(curveMv) / sizeof(curveMv[0]);
+  
+  if (millivolts >= curveMv[0]) return 100;
+  for (int i = 1; i < points; i++) {
+    if (millivolts >= curveMv[i]) {
+      return curvePercent[i] + (millivolts - curveMv[i]) * (curvePercent[i - 1] - curvePercent[i]) /
+                               (curveMv[i - 1] - curveMv[i]);
+    }
+  }
+  return 0;
+}
+
+// Read battery level from the smoothed voltage, -1 until the first burst
+int readBatteryLevel() {
+  int32_t millivolts = batteryMillivolts;
+  if (millivolts < 0) {
+    LOG_DEBUG("No battery reading yet");
+    return -1;
+  }
   
-  // Convert voltage to percentage
-  // Assuming 3.0V is 0% and 4.2V is 100% (for a LiPo battery)
-  int percentage = map(voltage * 100, 300, 420, 0, 100);
-  percentage = constrain(percentage, 0, 100);
+  int percentage = batteryPercentFromMillivolts(millivolts);
   
-  debugPrint("Battery level: " + String(percentage) + "%");
+  LOG_DEBUG("Battery voltage: %ld mV, level: %d%%", (long)millivolts, percentage);
   
   // Check for low battery
   if (percentage < 20) {
-    debugPrint("WARNING: Battery level low (" + String(percentage) + "%)");
+    LOG_WARN("Battery level low (%d%%)", percentage);
     debugBlink(4, 200); // Warning indicator
   }
   
   return percentage;
 }
 
-// Feed function - dispenses food by rotating servo
-void feed(int amount) {
-  debugPrint("========== FEEDING OPERATION ==========");
+// Feed function - queues food to be dispensed by the servo
+bool feed(int amount, String type, String commandId) {
+  LOG_INFO("========== FEEDING OPERATION ==========");
   
   // Validate amount
   if (amount <= 0) {
-    debugPrint("ERROR: Invalid feed amount");
+    LOG_ERROR("Invalid feed amount");
     debugBlink(5, 100); // Error indicator
-    return;
+    return false;
   }
   
   if (amount > MAX_FEED_AMOUNT) {
-    debugPrint("WARNING: Feed amount exceeds maximum. Limiting to " + 
-              String(MAX_FEED_AMOUNT) + " grams");
+    LOG_WARN("Feed amount exceeds maximum. Limiting to %d grams", MAX_FEED_AMOUNT);
     amount = MAX_FEED_AMOUNT;
   }
   
-  // Calculate feeding time based on amount
-  int feedTimeMs = (amount * 1000) / FEED_AMOUNT_PER_SECOND;
-  
-  debugPrint("Feeding " + String(amount) + " grams for " + 
-            String(feedTimeMs) + " ms");
-  
-  // Turn on status LED
-  digitalWrite(LED_PIN, HIGH);
-  
   // Check servo status
   if (!servoInitialized) {
-    debugPrint("ERROR: Servo not initialized");
+    LOG_ERROR("Servo not initialized");
     debugBlink(5, 100); // Error indicator
-    return;
+    return false;
   }
   
-  // Open the feeder (rotate servo to open position)
-  debugPrint("Opening feeder (servo to 180°)...");
-  feederServo.write(180); // Open position
-  
-  // Wait for calculated time
-  unsigned long startTime = millis();
-  unsigned long endTime = startTime + feedTimeMs;
-  
-  debugPrint("Dispensing food...");
-  while (millis() < endTime) {
-    // Blink LED during feeding to indicate activity
-    if (DEBUG_LED_ENABLED) {
-      digitalWrite(LED_PIN, (millis() % 200 < 100) ? HIGH : LOW);
-    }
-    delay(50);
+  if (feedQueueCount >= FEED_QUEUE_SIZE) {
+    LOG_ERROR("Feed queue full, request dropped");
+    return false;
   }
   
-  // Close the feeder (rotate servo back to closed position)
-  debugPrint("Closing feeder (servo to 0°)...");
-  feederServo.write(0); // Closed position
+  int slot = (feedQueueHead + feedQueueCount) % FEED_QUEUE_SIZE;
+  feedQueue[slot].amount = amount;
+  feedQueue[slot].type = type;
+  feedQueue[slot].commandId = commandId;
+  feedQueueCount++;
   
-  // Turn off status LED
-  digitalWrite(LED_PIN, LOW);
+  LOG_INFO("Queued %d grams (%d in queue)", amount, feedQueueCount);
+  return true;
+}
+
+void setDispenseState(DispenseState state) {
+  dispenseState = state;
+  dispenseStateStart = millis();
+}
+
+// Advance the dispenser state machine, called on every loop() pass
+void updateDispenser() {
+  unsigned long now = millis();
   
-  // Calculate actual feeding duration
-  unsigned long actualDuration = millis() - startTime;
-  debugPrint("Feeding complete (actual duration: " + String(actualDuration) + " ms)");
+  switch (dispenseState) {
+    case DISPENSE_IDLE:
+      if (feedQueueCount == 0) {
+        return;
+      }
+      activeFeed = feedQueue[feedQueueHead];
+      feedQueueHead = (feedQueueHead + 1) % FEED_QUEUE_SIZE;
+      feedQueueCount--;
+      
+      // Calculate feeding time based on amount
+      feedHoldMs = (activeFeed.amount * 1000) / FEED_AMOUNT_PER_SECOND;
+      LOG_INFO("Feeding %d grams for %lu ms", activeFeed.amount, feedHoldMs);
+      
+      // Turn on status LED and open the feeder (rotate servo to open position)
+      digitalWrite(LED_PIN, HIGH);
+      LOG_DEBUG("Opening feeder (servo to 180°)...");
+      feederServo.write(180); // Open position
+      feederOpenedAt = now;
+      setDispenseState(DISPENSE_OPENING);
+      break;
+      
+    case DISPENSE_OPENING:
+    case DISPENSE_HOLDING:
+      if (now - feederOpenedAt >= feedHoldMs) {
+        // Close the feeder (rotate servo back to closed position)
+        feedActualMs = now - feederOpenedAt;
+        LOG_DEBUG("Closing feeder (servo to 0°)...");
+        feederServo.write(0); // Closed position
+        setDispenseState(DISPENSE_CLOSING);
+      } else if (dispenseState == DISPENSE_OPENING && now - dispenseStateStart >= SERVO_TRAVEL_MS) {
+        LOG_DEBUG("Dispensing food...");
+        setDispenseState(DISPENSE_HOLDING);
+      } else if (dispenseState == DISPENSE_HOLDING && DEBUG_LED_ENABLED) {
+        // Blink LED during feeding to indicate activity
+        digitalWrite(LED_PIN, (now % 200 < 100) ? HIGH : LOW);
+      }
+      break;
+      
+    case DISPENSE_CLOSING:
+      if (now - dispenseStateStart >= SERVO_TRAVEL_MS) {
+        // Turn off status LED and wait for food to settle
+        digitalWrite(LED_PIN, LOW);
+        setDispenseState(DISPENSE_SETTLING);
+      }
+      break;
+      
+    case DISPENSE_SETTLING:
+      if (now - dispenseStateStart >= FEED_SETTLE_MS) {
+        FeedRequest done = activeFeed;
+        activeFeed = FeedRequest();
+        setDispenseState(DISPENSE_IDLE);
+        onFeedComplete(done, feedActualMs);
+      }
+      break;
+  }
+}
+
+// Runs once the hopper is closed and the food has settled
+void onFeedComplete(FeedRequest request, unsigned long actualDuration) {
+  LOG_INFO("Feeding complete (actual duration: %lu ms)", actualDuration);
   
   // Verify food level change if sensor available
-  int beforeLevel = -1;
-  int afterLevel = -1;
-  
   if (FOOD_LEVEL_SENSOR_PIN > 0) {
-    delay(1000); // Wait for food to settle
-    afterLevel = readFoodLevel();
-    
-    debugPrint("Food level after feeding: " + String(afterLevel) + "%");
-    
-    if (beforeLevel > 0 && afterLevel >= beforeLevel) {
-      debugPrint("WARNING: Food level did not decrease after feeding");
-      debugPrint("This may indicate a feeding mechanism issue");
-      debugBlink(3, 200); // Warning indicator
-    }
+    int afterLevel = readFoodLevel();
+    LOG_INFO("Food level after feeding: %d%%", afterLevel);
   }
   
-  debugPrint("======= FEEDING OPERATION COMPLETE =======");
+  // Log feeding event, which also completes its command
+  LOG_DEBUG("Logging %s feeding event...", request.type.c_str());
+  logFeedingEvent(request.amount, request.type, request.commandId);
+  
+  LOG_INFO("======= FEEDING OPERATION COMPLETE =======");
 }
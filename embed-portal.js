@@ -0,0 +1,90 @@
+/**
+ * PetFeeder Portal Asset Embedder
+ *
+ * Gzips the captive portal pages in src/portal and writes them into
+ * src/PortalAssets.h as byte arrays, so the firmware serves them from flash
+ * without compressing anything at runtime. Run after editing a page:
+ *
+ *   npm run embed-portal
+ */
+
+import fs from 'fs';
+import path from 'path';
+import zlib from 'zlib';
+import crypto from 'crypto';
+import { fileURLToPath } from 'url';
+
+const root = path.dirname(fileURLToPath(import.meta.url));
+const assetDir = path.join(root, 'src', 'portal');
+const outputFile = path.join(root, 'src', 'PortalAssets.h');
+
+const contentTypes = {
+  '.html': 'text/html',
+  '.css': 'text/css',
+  '.js': 'application/javascript',
+  '.svg': 'image/svg+xml'
+};
+
+// index.html -> PORTAL_INDEX_HTML
+function symbolName(file) {
+  return 'PORTAL_' + file.replace(/[^A-Za-z0-9]/g, '_').toUpperCase();
+}
+
+function byteLines(buffer) {
+  const lines = [];
+  for (let i = 0; i < buffer.length; i += 16) {
+    const row = Array.from(buffer.subarray(i, i + 16), b => '0x' + b.toString(16).padStart(2, '0'));
+    lines.push('    ' + row.join(', ') + ',');
+  }
+  return lines.join('\n');
+}
+
+const files = fs.readdirSync(assetDir).filter(file => contentTypes[path.extname(file)]).sort();
+
+let header = `#ifndef PORTAL_ASSETS_H
+#define PORTAL_ASSETS_H
+
+// Generated by embed-portal.js from src/portal, do not edit by hand.
+// Each page is stored gzip-compressed with an ETag derived from its content.
+
+#include <Arduino.h>
+
+struct PortalAsset {
+    const char* path;
+    const char* contentType;
+    const uint8_t* data;
+    size_t length;
+    const char* etag;
+};
+`;
+
+const table = [];
+for (const file of files) {
+  const source = fs.readFileSync(path.join(assetDir, file));
+  const compressed = zlib.gzipSync(source, { level: 9 });
+  const etag = crypto.createHash('sha1').update(source).digest('hex').slice(0, 16);
+  const symbol = symbolName(file);
+
+  header += `
+// ${file}: ${source.length} bytes, ${compressed.length} gzipped
+static const uint8_t ${symbol}_GZ[] PROGMEM = {
+${byteLines(compressed)}
+};
+`;
+  const urlPath = file === 'index.html' ? '/' : '/' + file;
+  table.push(`    {"${urlPath}", "${contentTypes[path.extname(file)]}", ${symbol}_GZ, sizeof(${symbol}_GZ), "\\"${etag}\\""},`);
+  console.log(`${file}: ${source.length} -> ${compressed.length} bytes`);
+}
+
+header += `
+static const PortalAsset PORTAL_ASSETS[] = {
+${table.join('\n')}
+};
+
+#define PORTAL_ASSET_COUNT (sizeof(PORTAL_ASSETS) / sizeof(PORTAL_ASSETS[0]))
+
+#endif // PORTAL_ASSETS_H
+`;
+
+fs.writeFileSync(outputFile, header);
+console.log(`Wrote ${path.relative(root, outputFile)}`);
@@ -0,0 +1,144 @@
+#ifndef BATTERY_MONITOR_H
+#define BATTERY_MONITOR_H
+
+#include <Arduino.h>
+#include <atomic>
+
+#define BATTERY_OVERSAMPLE 64         // conversions averaged per reading
+#define BATTERY_ADC_FREQUENCY 20000   // Hz, lowest the ESP32 ADC DMA allows
+#define BATTERY_DIVIDER_RATIO 2       // battery voltage / pin voltage
+#define BATTERY_EMA_SHIFT 3           // each reading moves the average by 1/8
+
+// Battery voltage measured with the ADC in continuous (DMA) mode. Each
+// update() collects one burst of BATTERY_OVERSAMPLE conversions that the
+// driver averages and converts to millivolts with the eFuse calibration,
+// then starts the next burst, so the CPU never waits on the ADC. Readings
+// are smoothed with an exponential moving average and converted to a
+// charge percentage with a LiPo discharge curve. Both values are published
+// through atomics and can be read from any task.
+class BatteryMonitor {
+public:
+    struct Stats {
+        uint32_t readings;   // bursts collected
+        uint32_t failures;   // bursts that could not be read
+    };
+
+private:
+    struct CurvePoint {
+        uint16_t millivolts;
+        uint8_t percent;
+    };
+
+    uint8_t pin;
+    bool running;
+    int32_t average;     // mV << BATTERY_EMA_SHIFT, -1 before the first reading
+    Stats stats;
+
+    std::atomic<int32_t> latestMillivolts;
+    std::atomic<int32_t> latestPercent;
+
+    static inline volatile bool burstReady = false; // set from the ADC ISR
+
+    static void ARDUINO_ISR_ATTR onBurstDone() {
+        burstReady = true;
+    }
+
+public:
+    BatteryMonitor(uint8_t pin) {
+        this->pin = pin;
+        running = false;
+        average = -1;
+        stats = Stats();
+        latestMillivolts = -1;
+        latestPercent = -1;
+    }
+
+    // Configure continuous mode on the pin and start the first burst
+    bool begin() {
+        uint8_t pins[] = {pin};
+        analogContinuousSetWidth(12);
+        analogContinuousSetAtten(ADC_11db);
+        if (!analogContinuous(pins, 1, BATTERY_OVERSAMPLE, BATTERY_ADC_FREQUENCY, onBurstDone)) {
+            Serial.println("Battery: ADC continuous mode setup failed");
+            return false;
+        }
+        running = analogContinuousStart();
+        return running;
+    }
+
+    // Collect a finished burst and start the next one. Cheap enough to run
+    // from the scheduler; returns true if a new reading was published.
+    bool update() {
+        if (!running || !burstReady) return false;
+        burstReady = false;
+
+        adc_continuous_data_t* result = nullptr;
+        bool ok = analogContinuousRead(&result, 0);
+        analogContinuousStop();
+
+        if (ok && result) {
+            addReading(result[0].avg_read_mvolts * BATTERY_DIVIDER_RATIO);
+        } else {
+            stats.failures++;
+        }
+
+        analogContinuousStart();
+        return ok;
+    }
+
+    // Fold one calibrated battery voltage into the average. Called by
+    // update(), and directly when testing off-device.
+    void addReading(int32_t millivolts) {
+        stats.readings++;
+        int32_t value = millivolts << BATTERY_EMA_SHIFT;
+        if (average < 0) {
+            average = value;
+        } else {
+            average += (value - average) >> BATTERY_EMA_SHIFT;
+        }
+
+        int32_t smoothed = average >> BATTERY_EMA_SHIFT;
+        latestMillivolts.store(smoothed, std::memory_order_relaxed);
+        latestPercent.store(percentFromMillivolts(smoothed), std::memory_order_relaxed);
+    }
+
+    // Single-cell LiPo state of charge at rest, interpolated from a
+    // discharge curve since the voltage is far from linear in the middle
+    static int percentFromMillivolts(int32_t millivolts) {
+        static const CurvePoint curve[] = {
+            {4200, 100}, {4150, 95}, {4110, 90}, {4080, 85}, {4020, 80},
+            {3980, 75}, {3950, 70}, {3910, 65}, {3870, 60}, {3850, 55},
+            {3840, 50}, {3820, 45}, {3800, 40}, {3790, 35}, {3770, 30},
+            {3750, 25}, {3730, 20}, {3710, 15}, {3690, 10}, {3610, 5},
+            {3270, 0}
+        };
+        const uint8_t points = sizeof(curve) / sizeof(curve[0]);
+
+        if (millivolts >= curve[0].millivolts) return 100;
+        for (uint8_t i = 1; i < points; i++) {
+            if (millivolts >= curve[i].millivolts) {
+                const CurvePoint& high = curve[i - 1];
+                const CurvePoint& low = curve[i];
+                return low.percent + (millivolts - low.millivolts) * (high.percent - low.percent) /
+                                     (high.millivolts - low.millivolts);
+            }
+        }
+        return 0;
+    }
+
+    // Smoothed battery voltage, -1 until the first reading
+    int32_t millivolts() const {
+        return latestMillivolts.load(std::memory_order_relaxed);
+    }
+
+    // Charge percentage, -1 until the first reading
+    int percent() const {
+        return latestPercent.load(std::memory_order_relaxed);
+    }
+
+    const Stats& getStats() const {
+        return stats;
+    }
+};
+
+#endif // BATTERY_MONITOR_H
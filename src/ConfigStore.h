@@ -0,0 +1,119 @@
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <stddef.h>
+#include "Crc32.h"
+
+// Versioned settings records in an NVS namespace. Each record is one blob
+// holding a schema version, the payload length, the payload and a CRC, so
+// a record written by other firmware, cut short or left over from an older
+// layout is rejected on load and the caller falls back to defaults.
+//
+// NVS writes a blob as a new entry before retiring the old one, so a record
+// is either fully updated or not at all, and its wear leveling spreads the
+// writes over the partition. save() also skips records whose bytes have not
+// changed, so only settings that actually changed cost a flash write.
+// Every owner opens its own namespace, so they cannot overwrite each
+// other's data.
+class ConfigStore {
+public:
+    struct Stats {
+        uint32_t loads;      // records loaded and validated
+        uint32_t rejected;   // records present but invalid
+        uint32_t writes;     // records written
+        uint32_t unchanged;  // saves skipped because nothing changed
+    };
+
+private:
+    template <typename T>
+    struct Record {
+        uint16_t version;
+        uint16_t length;
+        T value;
+        uint32_t crc;
+    };
+
+    const char* name;
+    Preferences prefs;
+    bool opened;
+    Stats stats;
+
+    template <typename T>
+    static uint32_t recordCrc(const Record<T>& record) {
+        return crc32(&record, offsetof(Record<T>, crc));
+    }
+
+public:
+    // name is the NVS namespace, at most 15 characters
+    ConfigStore(const char* name) {
+        this->name = name;
+        opened = false;
+        stats = Stats();
+    }
+
+    // Open the namespace. NVS is only ready once setup() runs, so this is
+    // not done in the constructor.
+    bool begin() {
+        if (!opened) opened = prefs.begin(name, false);
+        return opened;
+    }
+
+    // Load key into value. Returns false, leaving value untouched, if the
+    // record is missing, damaged or from another schema version.
+    template <typename T>
+    bool load(const char* key, T& value, uint16_t version) {
+        if (!begin() || !prefs.isKey(key)) return false;
+
+        Record<T> record;
+        if (prefs.getBytesLength(key) != sizeof(record) ||
+            prefs.getBytes(key, &record, sizeof(record)) != sizeof(record) ||
+            record.version != version || record.length != sizeof(T) ||
+            record.crc != recordCrc(record)) {
+            stats.rejected++;
+            return false;
+        }
+
+        value = record.value;
+        stats.loads++;
+        return true;
+    }
+
+    // Store value under key unless the same bytes are already there
+    template <typename T>
+    bool save(const char* key, const T& value, uint16_t version) {
+        if (!begin()) return false;
+
+        Record<T> record;
+        memset(&record, 0, sizeof(record));
+        record.version = version;
+        record.length = sizeof(T);
+        record.value = value;
+        record.crc = recordCrc(record);
+
+        Record<T> stored;
+        if (prefs.getBytesLength(key) == sizeof(stored) &&
+            prefs.getBytes(key, &stored, sizeof(stored)) == sizeof(stored) &&
+            memcmp(&stored, &record, sizeof(record)) == 0) {
+            stats.unchanged++;
+            return true;
+        }
+
+        if (prefs.putBytes(key, &record, sizeof(record)) != sizeof(record)) {
+            return false;
+        }
+        stats.writes++;
+        return true;
+    }
+
+    bool remove(const char* key) {
+        return begin() && prefs.remove(key);
+    }
+
+    const Stats& getStats() const {
+        return stats;
+    }
+};
+
+#endif // CONFIG_STORE_H
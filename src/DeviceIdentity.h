@@ -0,0 +1,76 @@
+#ifndef DEVICE_IDENTITY_H
+#define DEVICE_IDENTITY_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#define DEVICE_ID_LENGTH 13   // 12 hex digits and terminator
+#define DEVICE_UUID_LENGTH 37 // devices.id and terminator
+
+// The device ID is the station MAC without separators. It is read once
+// into a fixed buffer instead of being rebuilt with String operations for
+// every request.
+//
+// Rows in Supabase reference the device by the UUID of its devices row.
+// That is looked up by MAC once and kept in flash together with the MAC it
+// was resolved for, so a stored UUID is dropped if the settings end up on
+// another board.
+class DeviceIdentity {
+public:
+    struct Snapshot {
+        char mac[DEVICE_ID_LENGTH];
+        char uuid[DEVICE_UUID_LENGTH];
+    };
+
+private:
+    char deviceId[DEVICE_ID_LENGTH];
+    char deviceUuid[DEVICE_UUID_LENGTH];
+
+public:
+    DeviceIdentity() {
+        deviceId[0] = '\0';
+        deviceUuid[0] = '\0';
+    }
+
+    // Call after WiFi.mode() so the station MAC is available
+    void begin() {
+        uint8_t mac[6];
+        WiFi.macAddress(mac);
+        snprintf(deviceId, sizeof(deviceId), "%02X%02X%02X%02X%02X%02X",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
+
+    const char* id() const {
+        return deviceId;
+    }
+
+    // UUID of the devices row, empty until resolved
+    const char* uuid() const {
+        return deviceUuid;
+    }
+
+    bool hasUuid() const {
+        return deviceUuid[0] != '\0';
+    }
+
+    void setUuid(const char* uuid) {
+        strlcpy(deviceUuid, uuid, sizeof(deviceUuid));
+    }
+
+    void save(Snapshot& snapshot) const {
+        memset(&snapshot, 0, sizeof(snapshot));
+        strlcpy(snapshot.mac, deviceId, sizeof(snapshot.mac));
+        strlcpy(snapshot.uuid, deviceUuid, sizeof(snapshot.uuid));
+    }
+
+    // Take the UUID from a snapshot saved on this board. Call after begin().
+    bool restore(const Snapshot& snapshot) {
+        if (strncmp(snapshot.mac, deviceId, sizeof(snapshot.mac)) != 0 || snapshot.uuid[0] == '\0') {
+            return false;
+        }
+        strlcpy(deviceUuid, snapshot.uuid, sizeof(deviceUuid));
+        return true;
+    }
+};
+
+#endif // DEVICE_IDENTITY_H
@@ -0,0 +1,252 @@
+#ifndef DISPENSER_H
+#define DISPENSER_H
+
+#include <Arduino.h>
+#include <ESP32Servo.h>
+#include <functional>
+
+#define DISPENSER_QUEUE_SIZE 4
+#define SERVO_OPEN_ANGLE 180
+#define SERVO_CLOSED_ANGLE 0
+#define SERVO_TRAVEL_MS 300    // time for the servo horn to reach its position
+#define DISPENSE_SETTLE_MS 1000 // time for food to settle after the hopper closes
+
+// Non-blocking dispense engine. feed requests are queued and advanced
+// through open -> hold -> close -> settle by calling update() from loop(),
+// so the rest of the firmware keeps running while food is flowing.
+class Dispenser {
+public:
+    enum State {
+        IDLE,
+        OPENING,
+        HOLDING,
+        CLOSING,
+        SETTLING
+    };
+
+    struct Request {
+        int amount;         // grams
+        String type;        // "manual", "scheduled" or "local"
+        String commandId;   // feed_commands row id, empty for local feeds
+    };
+
+    // Called on every state change and while holding, with the time spent
+    // and total hold time of the active request
+    typedef std::function<void(const Request&, State, unsigned long elapsedMs, unsigned long holdMs)> ProgressCallback;
+    // Called once the hopper is closed and the food has settled
+    typedef std::function<void(const Request&, unsigned long actualHoldMs)> CompleteCallback;
+    typedef unsigned long (*ClockFn)();
+    // Open time in ms for a number of grams
+    typedef std::function<unsigned long(int grams)> HoldTimeFn;
+
+private:
+    Servo& servo;
+    uint8_t ledPin;
+    int gramsPerSecond;
+
+    Request queue[DISPENSER_QUEUE_SIZE];
+    uint8_t queueHead;
+    uint8_t queueCount;
+
+    Request active;
+    State state;
+    unsigned long stateStart;
+    unsigned long openedAt;
+    unsigned long holdMs;
+    unsigned long actualHoldMs;
+
+    ProgressCallback progressCallback;
+    CompleteCallback completeCallback;
+    HoldTimeFn holdTime;
+    ClockFn clock;
+
+    void enterState(State next, unsigned long now) {
+        state = next;
+        stateStart = now;
+        if (progressCallback) {
+            progressCallback(active, state, now - openedAt, holdMs);
+        }
+    }
+
+    bool startNext(unsigned long now) {
+        if (queueCount == 0) return false;
+
+        active = queue[queueHead];
+        queue[queueHead] = Request();
+        queueHead = (queueHead + 1) % DISPENSER_QUEUE_SIZE;
+        queueCount--;
+
+        if (holdTime) {
+            holdMs = holdTime(active.amount);
+        } else {
+            holdMs = ((unsigned long)active.amount * 1000UL) / gramsPerSecond;
+        }
+        openedAt = now;
+
+        digitalWrite(ledPin, HIGH);
+        servo.write(SERVO_OPEN_ANGLE);
+        enterState(OPENING, now);
+        return true;
+    }
+
+public:
+    Dispenser(Servo& servo, uint8_t ledPin, int gramsPerSecond)
+        : servo(servo), ledPin(ledPin), gramsPerSecond(gramsPerSecond) {
+        queueHead = 0;
+        queueCount = 0;
+        state = IDLE;
+        stateStart = 0;
+        openedAt = 0;
+        holdMs = 0;
+        actualHoldMs = 0;
+        clock = millis;
+    }
+
+    // Work out open times with fn instead of the fixed grams per second,
+    // called as each dispense starts
+    void setHoldTime(HoldTimeFn fn) {
+        holdTime = fn;
+    }
+
+    // Replace the time source, e.g. with a VirtualClock
+    void setClock(ClockFn fn) {
+        clock = fn;
+    }
+
+    void onProgress(ProgressCallback callback) {
+        progressCallback = callback;
+    }
+
+    void onComplete(CompleteCallback callback) {
+        completeCallback = callback;
+    }
+
+    // Queue a dispense. Returns false if the queue is full.
+    bool enqueue(int amount, const String& type, const String& commandId = "") {
+        if (queueCount >= DISPENSER_QUEUE_SIZE) return false;
+
+        uint8_t slot = (queueHead + queueCount) % DISPENSER_QUEUE_SIZE;
+        queue[slot].amount = amount;
+        queue[slot].type = type;
+        queue[slot].commandId = commandId;
+        queueCount++;
+        return true;
+    }
+
+    // True if the command is already being dispensed or waiting in the queue
+    bool hasCommand(const String& commandId) const {
+        if (commandId.length() == 0) return false;
+        if (state != IDLE && active.commandId == commandId) return true;
+        for (uint8_t i = 0; i < queueCount; i++) {
+            if (queue[(queueHead + i) % DISPENSER_QUEUE_SIZE].commandId == commandId) return true;
+        }
+        return false;
+    }
+
+    // Advance the state machine. Call this on every loop() pass.
+    void update() {
+        unsigned long now = clock();
+
+        switch (state) {
+            case IDLE:
+                startNext(now);
+                break;
+
+            case OPENING:
+                // The hold time is measured from the open command, so a
+                // short feed may close before the servo is fully open
+                if (now - openedAt >= holdMs) {
+                    actualHoldMs = now - openedAt;
+                    servo.write(SERVO_CLOSED_ANGLE);
+                    enterState(CLOSING, now);
+                } else if (now - stateStart >= SERVO_TRAVEL_MS) {
+                    enterState(HOLDING, now);
+                }
+                break;
+
+            case HOLDING:
+                if (now - openedAt >= holdMs) {
+                    actualHoldMs = now - openedAt;
+                    servo.write(SERVO_CLOSED_ANGLE);
+                    enterState(CLOSING, now);
+                } else if (progressCallback) {
+                    progressCallback(active, state, now - openedAt, holdMs);
+                }
+                break;
+
+            case CLOSING:
+                if (now - stateStart >= SERVO_TRAVEL_MS) {
+                    digitalWrite(ledPin, LOW);
+                    enterState(SETTLING, now);
+                }
+                break;
+
+            case SETTLING:
+                if (now - stateStart >= DISPENSE_SETTLE_MS) {
+                    Request done = active;
+                    active = Request();
+                    state = IDLE;
+                    if (completeCallback) {
+                        completeCallback(done, actualHoldMs);
+                    }
+                }
+                break;
+        }
+    }
+
+    // Milliseconds until the state machine next needs update(), 0 if due now
+    // and 0xFFFFFFFF when idle with nothing queued
+    unsigned long msUntilNextStep() const {
+        unsigned long now = clock();
+        unsigned long deadline;
+
+        switch (state) {
+            case IDLE:
+                return queueCount > 0 ? 0 : 0xFFFFFFFFUL;
+            case OPENING: {
+                unsigned long travelEnd = stateStart + SERVO_TRAVEL_MS;
+                unsigned long holdEnd = openedAt + holdMs;
+                deadline = (long)(travelEnd - holdEnd) < 0 ? travelEnd : holdEnd;
+                break;
+            }
+            case HOLDING:
+                deadline = openedAt + holdMs;
+                break;
+            case CLOSING:
+                deadline = stateStart + SERVO_TRAVEL_MS;
+                break;
+            case SETTLING:
+            default:
+                deadline = stateStart + DISPENSE_SETTLE_MS;
+                break;
+        }
+
+        long remaining = (long)(deadline - now);
+        return remaining > 0 ? (unsigned long)remaining : 0;
+    }
+
+    bool isBusy() const {
+        return state != IDLE || queueCount > 0;
+    }
+
+    State getState() const {
+        return state;
+    }
+
+    uint8_t queued() const {
+        return queueCount;
+    }
+
+    static const char* stateName(State s) {
+        switch (s) {
+            case IDLE: return "idle";
+            case OPENING: return "opening";
+            case HOLDING: return "holding";
+            case CLOSING: return "closing";
+            case SETTLING: return "settling";
+        }
+        return "unknown";
+    }
+};
+
+#endif // DISPENSER_H
@@ -0,0 +1,69 @@
+#ifndef FEEDER_MESSAGES_H
+#define FEEDER_MESSAGES_H
+
+#include <stdint.h>
+#include "ScheduleIndex.h"
+
+#define MESSAGE_QUEUE_DEPTH 8     // power of two, one slot stays free
+#define SCHEDULE_QUEUE_DEPTH 2
+#define FEED_TYPE_LENGTH 12
+#define COMMAND_ID_LENGTH 37      // uuid and terminator
+
+// Messages passed between the network task and the control task. They are
+// plain structs with fixed-size strings so they can be copied through an
+// SpscQueue without touching the heap.
+
+// Network or local API -> control: dispense food for a command
+struct FeedRequest {
+    int16_t amount;
+    char type[FEED_TYPE_LENGTH];
+    char commandId[COMMAND_ID_LENGTH];
+    uint32_t receivedUs;          // micros() when a local request arrived, 0 otherwise
+};
+
+// Control -> network: what happened to a feed
+struct FeedEvent {
+    enum Kind : uint8_t {
+        QUEUED,       // accepted by the dispenser
+        REJECTED,     // invalid or the dispenser queue was full
+        STARTED,      // hopper opening
+        COMPLETED     // hopper closed and food settled
+    };
+
+    Kind kind;
+    int16_t amount;
+    char type[FEED_TYPE_LENGTH];
+    char commandId[COMMAND_ID_LENGTH];   // empty for scheduled feeds
+    uint32_t actualHoldMs;
+    uint32_t timestamp;                  // unix time when it happened
+};
+
+// Control -> network: latest sensor readings, -1 if not available yet
+struct SensorSample {
+    int16_t foodLevel;
+    int16_t batteryLevel;
+};
+
+// Settings edited in the web app, 0 for the built-in default
+struct DeviceConfig {
+    int16_t maxFeedAmount;      // grams
+    float feedRate;             // g/s until the flow model has learned its own
+};
+
+// Network -> control: the synced schedule list and config, and the sync
+// version they are current to. Also the layout they are stored in flash
+// with, so a reboot continues syncing from where it left off.
+struct ScheduleTable {
+    uint32_t syncVersion;
+    DeviceConfig config;
+    uint8_t count;
+    struct {
+        char id[SCHEDULE_ID_LENGTH];
+        char time[9];
+        int16_t amount;
+        bool enabled;
+        bool days[7];
+    } entries[MAX_INDEXED_SCHEDULES];
+};
+
+#endif // FEEDER_MESSAGES_H
@@ -0,0 +1,330 @@
+#ifndef FEEDING_JOURNAL_H
+#define FEEDING_JOURNAL_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "Crc32.h"
+
+#define JOURNAL_FILE "/journal.bin"
+#define JOURNAL_ACK_FILE "/journal.ack"
+#define JOURNAL_ACK_TEMP "/journal.ack.tmp"
+#define JOURNAL_CAPACITY 256 // records kept in the ring
+#define JOURNAL_TYPE_LENGTH 12
+#define JOURNAL_COMMAND_ID_LENGTH 37 // uuid and terminator
+
+// Append-only ring journal of feeding events in LittleFS. Every event is
+// written here first and uploaded later by a drainer, so history survives
+// network outages and reboots.
+//
+// Each record carries a sequence number and CRC. The slot for a record is
+// seq % JOURNAL_CAPACITY, so the newest valid record is found by scanning
+// the ring at boot. The highest uploaded sequence number is kept in a
+// separate file replaced atomically by rename. Records past it are
+// re-sent after a crash; the server ignores them by (device_id, device_seq).
+//
+// A feed that carried out a feed command keeps the command id, and the
+// server marks the command completed when the row is inserted. The
+// completion is as durable as the history entry itself. A ring file with
+// a different record size, e.g. from older firmware, is recreated.
+// Sequence numbers never go back, even then: the server ignores a
+// device_seq it has seen, so a reused one would silently lose the feed.
+class FeedingJournal {
+public:
+    struct Entry {
+        uint32_t seq;
+        uint32_t timestamp;   // unix time of the feed
+        int16_t amount;       // grams
+        char type[JOURNAL_TYPE_LENGTH];
+        char commandId[JOURNAL_COMMAND_ID_LENGTH];   // empty for scheduled feeds
+    };
+
+    struct Stats {
+        uint32_t appended;
+        uint32_t drained;        // records acknowledged by the server
+        uint32_t batches;
+        uint32_t dropped;        // unsent records overwritten when full
+        uint32_t recovered;      // valid records found at boot
+        uint32_t corrupt;        // slots that failed the CRC at boot
+        unsigned long lastDrainMs;
+        uint32_t lastDrainRecords;
+    };
+
+    // Ring position, kept across deep sleep to skip the boot scan
+    struct Cursor {
+        uint32_t headSeq;
+        uint32_t ackedSeq;
+    };
+
+private:
+    struct Record {
+        Entry entry;
+        uint32_t crc;
+    };
+
+    struct AckRecord {
+        uint32_t ackedSeq;
+        uint32_t crc;
+    };
+
+    bool mounted;
+    uint32_t headSeq;   // last sequence number written
+    uint32_t ackedSeq;  // last sequence number the server has
+    Stats stats;
+
+    static uint32_t slotOffset(uint32_t seq) {
+        return (seq % JOURNAL_CAPACITY) * sizeof(Record);
+    }
+
+    bool readRecord(File& file, uint32_t seq, Record& record) {
+        if (!file.seek(slotOffset(seq))) return false;
+        if (file.read((uint8_t*)&record, sizeof(record)) != sizeof(record)) return false;
+        return record.entry.seq == seq && record.crc == crc32(&record.entry, sizeof(record.entry));
+    }
+
+    bool createRing() {
+        File file = LittleFS.open(JOURNAL_FILE, "w");
+        if (!file) return false;
+
+        Record empty;
+        memset(&empty, 0, sizeof(empty));
+        for (uint32_t i = 0; i < JOURNAL_CAPACITY; i++) {
+            file.write((const uint8_t*)&empty, sizeof(empty));
+        }
+        file.close();
+        return true;
+    }
+
+    uint32_t loadAck() {
+        File file = LittleFS.open(JOURNAL_ACK_FILE, "r");
+        if (!file) return 0;
+
+        AckRecord ack;
+        bool valid = file.read((uint8_t*)&ack, sizeof(ack)) == sizeof(ack) &&
+                     ack.crc == crc32(&ack.ackedSeq, sizeof(ack.ackedSeq));
+        file.close();
+        return valid ? ack.ackedSeq : 0;
+    }
+
+    bool saveAck(uint32_t seq) {
+        AckRecord ack;
+        ack.ackedSeq = seq;
+        ack.crc = crc32(&ack.ackedSeq, sizeof(ack.ackedSeq));
+
+        File file = LittleFS.open(JOURNAL_ACK_TEMP, "w");
+        if (!file) return false;
+        bool ok = file.write((const uint8_t*)&ack, sizeof(ack)) == sizeof(ack);
+        file.close();
+
+        // Rename is atomic in LittleFS, so a crash leaves the old or new cursor
+        return ok && LittleFS.rename(JOURNAL_ACK_TEMP, JOURNAL_ACK_FILE);
+    }
+
+    bool resumeFrom(const Cursor& cursor) {
+        if (cursor.ackedSeq > cursor.headSeq) return false;
+        if (cursor.headSeq > 0) {
+            File file = LittleFS.open(JOURNAL_FILE, "r");
+            if (!file) return false;
+            Record record;
+            bool valid = readRecord(file, cursor.headSeq, record) &&
+                         !readRecord(file, cursor.headSeq + 1, record);
+            file.close();
+            if (!valid) return false;
+        }
+        headSeq = cursor.headSeq;
+        ackedSeq = cursor.ackedSeq;
+        return true;
+    }
+
+    // Find the newest valid record in the ring
+    void recover() {
+        File file = LittleFS.open(JOURNAL_FILE, "r");
+        if (!file) return;
+
+        Record record;
+        for (uint32_t slot = 0; slot < JOURNAL_CAPACITY; slot++) {
+            if (file.read((uint8_t*)&record, sizeof(record)) != sizeof(record)) break;
+            if (record.entry.seq == 0) continue;
+
+            if (record.crc != crc32(&record.entry, sizeof(record.entry)) ||
+                record.entry.seq % JOURNAL_CAPACITY != slot) {
+                stats.corrupt++;
+                continue;
+            }
+
+            stats.recovered++;
+            if (record.entry.seq > headSeq) headSeq = record.entry.seq;
+        }
+        file.close();
+    }
+
+public:
+    FeedingJournal() {
+        mounted = false;
+        headSeq = 0;
+        ackedSeq = 0;
+        stats = Stats();
+    }
+
+    // Mount the filesystem and recover the journal. A cursor saved before
+    // deep sleep is used instead of scanning the ring if the record it
+    // points at checks out. Returns false if flash is unavailable, in which
+    // case append() fails and callers upload directly.
+    bool begin(const Cursor* resume = nullptr) {
+        if (!LittleFS.begin(true)) {
+            Serial.println("Journal: LittleFS mount failed");
+            return false;
+        }
+
+        File file = LittleFS.open(JOURNAL_FILE, "r");
+        bool exists = file && file.size() == JOURNAL_CAPACITY * sizeof(Record);
+        if (file) file.close();
+
+        if (!exists && !createRing()) {
+            Serial.println("Journal: could not create ring file");
+            return false;
+        }
+        bool created = !exists;
+
+        mounted = true;
+        if (!created && resume && resumeFrom(*resume)) {
+            return true;
+        }
+
+        recover();
+        ackedSeq = loadAck();
+        if (created && ackedSeq > 0) {
+            // The old ring may have sent up to a full ring past the ack
+            // before it was replaced, start beyond all of those
+            headSeq = ackedSeq + JOURNAL_CAPACITY;
+            ackedSeq = headSeq;
+            saveAck(ackedSeq);
+        } else if (ackedSeq > headSeq) {
+            // Records the server has were lost, continue after them
+            headSeq = ackedSeq;
+        }
+
+        // Anything older than one ring was overwritten
+        if (headSeq - ackedSeq > JOURNAL_CAPACITY) {
+            stats.dropped += headSeq - ackedSeq - JOURNAL_CAPACITY;
+            ackedSeq = headSeq - JOURNAL_CAPACITY;
+        }
+
+        Serial.printf("Journal: head %u, acked %u, %u pending, %u corrupt\n",
+                      headSeq, ackedSeq, pending(), stats.corrupt);
+        return true;
+    }
+
+    // Record a feeding event. Returns its sequence number, or 0 on failure.
+    uint32_t append(int amount, const String& type, uint32_t timestamp, const char* commandId = "") {
+        if (!mounted) return 0;
+
+        Record record;
+        memset(&record, 0, sizeof(record));
+        record.entry.seq = headSeq + 1;
+        record.entry.timestamp = timestamp;
+        record.entry.amount = amount;
+        strncpy(record.entry.type, type.c_str(), JOURNAL_TYPE_LENGTH - 1);
+        strncpy(record.entry.commandId, commandId, JOURNAL_COMMAND_ID_LENGTH - 1);
+        record.crc = crc32(&record.entry, sizeof(record.entry));
+
+        File file = LittleFS.open(JOURNAL_FILE, "r+");
+        if (!file) return 0;
+        bool ok = file.seek(slotOffset(record.entry.seq)) &&
+                  file.write((const uint8_t*)&record, sizeof(record)) == sizeof(record);
+        file.close();
+        if (!ok) return 0;
+
+        headSeq = record.entry.seq;
+        stats.appended++;
+
+        // The ring wrapped over an unsent record
+        if (headSeq - ackedSeq > JOURNAL_CAPACITY) {
+            ackedSeq = headSeq - JOURNAL_CAPACITY;
+            stats.dropped++;
+        }
+        return headSeq;
+    }
+
+    // Copy up to max of the oldest unsent entries into out
+    uint16_t readPending(Entry* out, uint16_t max) {
+        if (!mounted || pending() == 0) return 0;
+
+        File file = LittleFS.open(JOURNAL_FILE, "r");
+        if (!file) return 0;
+
+        uint16_t count = 0;
+        uint32_t skipped = ackedSeq;
+        Record record;
+        for (uint32_t seq = ackedSeq + 1; seq <= headSeq && count < max; seq++) {
+            // Skip slots that failed their CRC rather than stall the drain
+            if (readRecord(file, seq, record)) {
+                out[count++] = record.entry;
+            } else if (count == 0) {
+                skipped = seq;
+            }
+        }
+        file.close();
+
+        // Nothing valid before these, move the cursor past them
+        if (skipped != ackedSeq) {
+            ackedSeq = skipped;
+            saveAck(skipped);
+        }
+        return count;
+    }
+
+    // Copy up to max of the newest entries into out, newest first, whether
+    // uploaded or not. Safe from another task: a record written meanwhile
+    // fails its CRC and is left out.
+    uint16_t readRecent(Entry* out, uint16_t max) {
+        if (!mounted) return 0;
+
+        File file = LittleFS.open(JOURNAL_FILE, "r");
+        if (!file) return 0;
+
+        uint32_t newest = headSeq;
+        uint32_t oldest = newest > JOURNAL_CAPACITY ? newest - JOURNAL_CAPACITY + 1 : 1;
+        uint16_t count = 0;
+        Record record;
+        for (uint32_t seq = newest; seq >= oldest && seq > 0 && count < max; seq--) {
+            if (readRecord(file, seq, record)) {
+                out[count++] = record.entry;
+            }
+        }
+        file.close();
+        return count;
+    }
+
+    // Mark everything up to seq as stored on the server
+    void acknowledge(uint32_t seq, uint16_t records, unsigned long drainMs) {
+        if (seq <= ackedSeq || seq > headSeq) return;
+        ackedSeq = seq;
+        saveAck(seq);
+
+        stats.drained += records;
+        stats.batches++;
+        stats.lastDrainMs = drainMs;
+        stats.lastDrainRecords = records;
+    }
+
+    Cursor getCursor() const {
+        Cursor cursor;
+        cursor.headSeq = headSeq;
+        cursor.ackedSeq = ackedSeq;
+        return cursor;
+    }
+
+    uint32_t pending() const {
+        return headSeq - ackedSeq;
+    }
+
+    bool isReady() const {
+        return mounted;
+    }
+
+    const Stats& getStats() const {
+        return stats;
+    }
+};
+
+#endif // FEEDING_JOURNAL_H
@@ -0,0 +1,228 @@
+#ifndef FLOW_MODEL_H
+#define FLOW_MODEL_H
+
+#include <Arduino.h>
+#include <math.h>
+
+#define FLOW_HOPPER_GRAMS 1000       // food in a full hopper, turns level % into grams
+#define FLOW_FORGETTING 0.9f         // weight kept by older samples on each new one
+#define FLOW_MIN_SAMPLES 3           // samples before the fit replaces the default rate
+#define FLOW_MIN_RATE 0.5f           // g/s, slower fits and samples are rejected
+#define FLOW_MAX_RATE 50.0f          // g/s, faster fits and samples are rejected
+#define FLOW_SAMPLE_DROP 8           // level %, feeds are pooled until the level drops this much
+#define FLOW_REFILL_RISE 10          // level %, a rise this big between feeds is a refill
+#define FLOW_CORRECTION_WINDOW 1800000 // ms after a feed in which a manual feed counts as a correction
+
+// Online model of how fast food leaves the hopper, used to turn grams into
+// open time. Flow depends on the kibble and on how full the hopper is, so
+// the rate is fitted as a line over the fill level: rate = a + b * level.
+//
+// The level sensor reads in steps of a few percent, larger than what one
+// feed takes out, so a single feed's drop is mostly quantization. Feeds are
+// pooled instead: a pool opens after a feed during which the reading
+// stepped down, so the level is just past a step, and closes after a later
+// such feed once the level has dropped FLOW_SAMPLE_DROP. Both ends then
+// sit just past a step, and the pool's open time against its drop gives
+// one unbiased sample. A refill between feeds drops the pool.
+//
+// The fit is a weighted least squares over running sums in which older
+// samples fade by FLOW_FORGETTING, so it follows a change of kibble within
+// a few samples.
+// Until FLOW_MIN_SAMPLES are in, or if the fit is implausible, the default
+// rate is used.
+//
+// The sums are small enough to keep in flash with save()/restore().
+class FlowModel {
+public:
+    struct Snapshot {
+        float sw, sx, sy, sxx, sxy;  // weighted sums of 1, level, rate, level^2, level*rate
+        uint32_t samples;
+        uint32_t corrections;
+        float errorAvg;
+    };
+
+    struct Stats {
+        uint32_t samples;       // pooled samples accepted into the fit
+        uint32_t pooled;        // feeds added to a pool
+        uint32_t rejected;      // feeds and pools dropped as refills or outliers
+        uint32_t corrections;   // manual feeds soon after another feed
+        float lastError;        // (measured - requested) / requested of the last sample
+        float errorAvg;         // running average of |lastError|
+    };
+
+private:
+    // Feeds since the level last stepped down, not kept in flash
+    struct Pool {
+        bool open;
+        int levelStart;         // reading the pool started from
+        int levelLast;          // reading after the last feed
+        int grams;              // requested over the pooled feeds
+        unsigned long openMs;
+    };
+
+    float defaultRate;
+    Snapshot fit;
+    Pool pool;
+    Stats stats;
+    unsigned long lastFeedAt;
+    bool fed;
+
+    // Fitted rate at level, or 0 if there is no usable fit
+    float fittedRate(int level) const {
+        if (fit.samples < FLOW_MIN_SAMPLES || fit.sw <= 0) return 0;
+
+        float mean = fit.sy / fit.sw;
+        float det = fit.sw * fit.sxx - fit.sx * fit.sx;
+
+        // The slope needs samples spread over the fill levels, a standard
+        // deviation of 5 %. Until then only the mean rate is known.
+        float rate = mean;
+        if (det > fit.sw * fit.sw * 25.0f) {
+            float b = (fit.sw * fit.sxy - fit.sx * fit.sy) / det;
+            float a = (fit.sy - b * fit.sx) / fit.sw;
+            rate = a + b * level;
+        }
+
+        if (rate < FLOW_MIN_RATE || rate > FLOW_MAX_RATE) return mean;
+        return rate;
+    }
+
+public:
+    FlowModel(float defaultRate) {
+        this->defaultRate = defaultRate;
+        fit = Snapshot();
+        pool = Pool();
+        stats = Stats();
+        lastFeedAt = 0;
+        fed = false;
+    }
+
+    // Rate used until the fit takes over
+    void setDefaultRate(float rate) {
+        defaultRate = rate;
+    }
+
+    // Expected flow in g/s with the hopper at level %, the default rate
+    // until the fit is usable. An unknown level (< 0) is taken as half full.
+    float rateAt(int level) const {
+        if (level < 0) level = 50;
+        float rate = fittedRate(level);
+        return rate > 0 ? rate : defaultRate;
+    }
+
+    // Open time for grams with the hopper at level %
+    unsigned long holdMs(int grams, int level) const {
+        return (unsigned long)(grams * 1000.0f / rateAt(level) + 0.5f);
+    }
+
+    // Learn from a finished feed. Returns true when it closed a pool and
+    // the fit changed, false while pooling or if the feed was not usable.
+    bool addSample(int grams, unsigned long openMs, int levelBefore, int levelAfter) {
+        if (levelBefore < 0 || levelAfter < 0 || openMs == 0) {
+            stats.rejected++;
+            return false;
+        }
+
+        // Refilled since the last feed, or during this one
+        if (pool.open && (levelBefore > pool.levelLast + FLOW_REFILL_RISE || levelAfter > levelBefore + FLOW_REFILL_RISE)) {
+            pool.open = false;
+            stats.rejected++;
+        }
+
+        bool stepped = levelAfter < levelBefore;
+        if (!pool.open) {
+            // Start counting after a feed that crossed a step
+            if (stepped) {
+                pool = Pool();
+                pool.open = true;
+                pool.levelStart = levelAfter;
+                pool.levelLast = levelAfter;
+            }
+            return false;
+        }
+
+        pool.grams += grams;
+        pool.openMs += openMs;
+        pool.levelLast = levelAfter;
+        stats.pooled++;
+
+        int drop = pool.levelStart - levelAfter;
+        if (!stepped || drop < FLOW_SAMPLE_DROP) {
+            return false;
+        }
+
+        // Close the pool, and open the next one from here
+        float measured = drop * (FLOW_HOPPER_GRAMS / 100.0f);
+        float rate = measured * 1000.0f / pool.openMs;
+        float x = (pool.levelStart + levelAfter) / 2.0f;
+        int requested = pool.grams;
+        pool = Pool();
+        pool.open = true;
+        pool.levelStart = levelAfter;
+        pool.levelLast = levelAfter;
+
+        if (rate < FLOW_MIN_RATE || rate > FLOW_MAX_RATE) {
+            stats.rejected++;
+            return false;
+        }
+
+        fit.sw = fit.sw * FLOW_FORGETTING + 1;
+        fit.sx = fit.sx * FLOW_FORGETTING + x;
+        fit.sy = fit.sy * FLOW_FORGETTING + rate;
+        fit.sxx = fit.sxx * FLOW_FORGETTING + x * x;
+        fit.sxy = fit.sxy * FLOW_FORGETTING + x * rate;
+        fit.samples++;
+        stats.samples++;
+
+        stats.lastError = requested > 0 ? (measured - requested) / requested : 0;
+        fit.errorAvg = fit.samples == 1 ? fabsf(stats.lastError)
+                                        : fit.errorAvg * 0.8f + fabsf(stats.lastError) * 0.2f;
+        stats.errorAvg = fit.errorAvg;
+        return true;
+    }
+
+    // Call for every feed that starts. A manual feed shortly after another
+    // feed is counted as correcting an under- or overshoot.
+    void noteFeed(bool manual, unsigned long now) {
+        if (manual && fed && now - lastFeedAt < FLOW_CORRECTION_WINDOW) {
+            fit.corrections++;
+            stats.corrections = fit.corrections;
+        }
+        lastFeedAt = now;
+        fed = true;
+    }
+
+    void save(Snapshot& out) const {
+        out = fit;
+    }
+
+    void restore(const Snapshot& in) {
+        fit = in;
+        stats.samples = fit.samples;
+        stats.corrections = fit.corrections;
+        stats.errorAvg = fit.errorAvg;
+    }
+
+    // Prometheus text lines for /metrics
+    void write(Print& out) const {
+        out.print("# TYPE feeder_flow_rate_grams_per_second gauge\n");
+        out.printf("feeder_flow_rate_grams_per_second{level=\"25\"} %.2f\n", rateAt(25));
+        out.printf("feeder_flow_rate_grams_per_second{level=\"75\"} %.2f\n", rateAt(75));
+        out.print("# TYPE feeder_flow_samples_total counter\n");
+        out.printf("feeder_flow_samples_total %u\n", (unsigned)stats.samples);
+        out.print("# TYPE feeder_flow_pooled_total counter\n");
+        out.printf("feeder_flow_pooled_total %u\n", (unsigned)stats.pooled);
+        out.print("# TYPE feeder_flow_rejected_total counter\n");
+        out.printf("feeder_flow_rejected_total %u\n", (unsigned)stats.rejected);
+        out.print("# TYPE feeder_flow_error_ratio gauge\n");
+        out.printf("feeder_flow_error_ratio %.3f\n", stats.errorAvg);
+        out.print("# TYPE feeder_correction_feeds_total counter\n");
+        out.printf("feeder_correction_feeds_total %u\n", (unsigned)stats.corrections);
+    }
+
+    const Stats& getStats() const {
+        return stats;
+    }
+};
+
+#endif // FLOW_MODEL_H
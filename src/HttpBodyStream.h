@@ -0,0 +1,175 @@
+#ifndef HTTP_BODY_STREAM_H
+#define HTTP_BODY_STREAM_H
+
+#include <Arduino.h>
+#include <Client.h>
+
+// Reads an HTTP response body straight from the socket as a Stream, so it
+// can be parsed without first copying it into a String. Handles
+// Content-Length, chunked transfer encoding and close-delimited bodies,
+// and stops exactly at the end of the body so a kept-alive connection is
+// left clean for the next request.
+class HttpBodyStream : public Stream {
+public:
+    enum Framing {
+        CONTENT_LENGTH,
+        CHUNKED,
+        UNTIL_CLOSE
+    };
+
+private:
+    Client* client;
+    Framing framing;
+    long remaining;         // bytes left in the body or current chunk
+    bool inChunk;           // a chunk has been started and needs its CRLF consumed
+    bool finished;
+    int peeked;             // byte read ahead by peek(), -1 if none
+    unsigned long readTimeout;
+
+    int clientRead() {
+        unsigned long start = millis();
+        do {
+            int c = client->read();
+            if (c >= 0) return c;
+            if (!client->connected()) return -1;
+            yield();
+        } while (millis() - start < readTimeout);
+        return -1;
+    }
+
+    static int hexValue(int c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    // Parse "<hex size>[;extensions]\r\n". The last chunk has size 0 and is
+    // followed by optional trailers and a blank line.
+    bool readChunkHeader() {
+        long size = 0;
+        bool digits = false;
+        bool extension = false;
+        int c;
+        while ((c = clientRead()) >= 0 && c != '\n') {
+            int value = hexValue(c);
+            if (c == ';') {
+                extension = true;
+            } else if (value >= 0 && !extension) {
+                size = size * 16 + value;
+                digits = true;
+            }
+        }
+        if (c < 0 || !digits) return false;
+
+        if (size == 0) {
+            // Skip trailer lines up to the blank line ending the body
+            int lineLength = 0;
+            while ((c = clientRead()) >= 0) {
+                if (c == '\n') {
+                    if (lineLength == 0) break;
+                    lineLength = 0;
+                } else if (c != '\r') {
+                    lineLength++;
+                }
+            }
+            return false;
+        }
+
+        remaining = size;
+        inChunk = true;
+        return true;
+    }
+
+    int nextByte() {
+        if (finished) return -1;
+
+        if (remaining == 0) {
+            if (framing != CHUNKED) {
+                finished = true;
+                return -1;
+            }
+            if (inChunk) {
+                // CRLF after the previous chunk's data
+                clientRead();
+                clientRead();
+                inChunk = false;
+            }
+            if (!readChunkHeader()) {
+                finished = true;
+                return -1;
+            }
+        }
+
+        int c = clientRead();
+        if (c < 0) {
+            finished = true;
+            return -1;
+        }
+        if (framing != UNTIL_CLOSE) remaining--;
+        return c;
+    }
+
+public:
+    HttpBodyStream() {
+        client = nullptr;
+        framing = CONTENT_LENGTH;
+        remaining = 0;
+        inChunk = false;
+        finished = true;
+        peeked = -1;
+        readTimeout = 1000;
+    }
+
+    // contentLength is ignored unless framing is CONTENT_LENGTH
+    void begin(Client& source, Framing bodyFraming, long contentLength, unsigned long timeoutMs) {
+        client = &source;
+        framing = bodyFraming;
+        remaining = framing == CONTENT_LENGTH ? contentLength : 0;
+        if (framing == UNTIL_CLOSE) remaining = 1;
+        inChunk = false;
+        finished = framing == CONTENT_LENGTH && contentLength <= 0;
+        peeked = -1;
+        readTimeout = timeoutMs;
+        setTimeout(timeoutMs);
+    }
+
+    int available() override {
+        if (peeked >= 0) return 1;
+        if (finished) return 0;
+        int buffered = client->available();
+        if (framing == CONTENT_LENGTH && buffered > remaining) return remaining;
+        return buffered;
+    }
+
+    int read() override {
+        if (peeked >= 0) {
+            int c = peeked;
+            peeked = -1;
+            return c;
+        }
+        return nextByte();
+    }
+
+    int peek() override {
+        if (peeked < 0) peeked = nextByte();
+        return peeked;
+    }
+
+    size_t write(uint8_t) override {
+        return 0;
+    }
+
+    // Discard whatever is left of the body so the connection can be reused
+    void drain() {
+        peeked = -1;
+        while (nextByte() >= 0) {
+        }
+    }
+
+    bool isFinished() const {
+        return finished && peeked < 0;
+    }
+};
+
+#endif // HTTP_BODY_STREAM_H
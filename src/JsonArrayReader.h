@@ -0,0 +1,93 @@
+#ifndef JSON_ARRAY_READER_H
+#define JSON_ARRAY_READER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Walks a top-level JSON array on a stream one element at a time. Each
+// element is deserialized through the filter into the caller's document,
+// so memory is bounded by the largest element rather than the response.
+//
+//     JsonArrayReader reader(stream, filter);
+//     JsonDocument element;
+//     while (reader.next(element)) { ... }
+//     if (reader.failed()) { ... }
+class JsonArrayReader {
+private:
+    Stream& stream;
+    const JsonDocument& filter;
+    DeserializationError error;
+    bool started;
+    bool done;
+    size_t count;
+
+    void skipWhitespace() {
+        int c;
+        while ((c = stream.peek()) == ' ' || c == '\n' || c == '\r' || c == '\t') {
+            stream.read();
+        }
+    }
+
+public:
+    JsonArrayReader(Stream& stream, const JsonDocument& filter)
+        : stream(stream), filter(filter) {
+        error = DeserializationError::Ok;
+        started = false;
+        done = false;
+        count = 0;
+    }
+
+    // Read the next element into element. Returns false at the end of the
+    // array or on an error, see failed().
+    bool next(JsonDocument& element) {
+        if (done) return false;
+
+        if (!started) {
+            started = true;
+            skipWhitespace();
+            if (stream.read() != '[') {
+                error = DeserializationError::InvalidInput;
+                done = true;
+                return false;
+            }
+            skipWhitespace();
+            if (stream.peek() == ']') {
+                stream.read();
+                done = true;
+                return false;
+            }
+        } else {
+            // Elements are separated by commas, the array ends with ]
+            skipWhitespace();
+            int c = stream.read();
+            if (c != ',') {
+                if (c != ']') error = DeserializationError::InvalidInput;
+                done = true;
+                return false;
+            }
+        }
+
+        error = deserializeJson(element, stream, DeserializationOption::Filter(filter));
+        if (error) {
+            done = true;
+            return false;
+        }
+
+        count++;
+        return true;
+    }
+
+    bool failed() const {
+        return error != DeserializationError::Ok;
+    }
+
+    const char* errorString() const {
+        return error.c_str();
+    }
+
+    size_t elementsRead() const {
+        return count;
+    }
+};
+
+#endif // JSON_ARRAY_READER_H
@@ -0,0 +1,148 @@
+#ifndef JSON_STREAM_WRITER_H
+#define JSON_STREAM_WRITER_H
+
+#include <Arduino.h>
+
+#define JSON_WRITER_BUFFER 128
+#define JSON_WRITER_MAX_DEPTH 8
+
+// Writes JSON to a Print in small buffered pieces, so a response can be
+// sent as it is generated instead of being assembled in a String first.
+// Strings are escaped, including control characters, so arbitrary SSIDs
+// cannot break the document.
+//
+//     JsonStreamWriter json(out);
+//     json.beginObject();
+//     json.beginArray("networks");
+//     ...
+//     json.endArray();
+//     json.endObject();
+//     json.flush();
+class JsonStreamWriter {
+private:
+    Print& out;
+    char buffer[JSON_WRITER_BUFFER];
+    size_t length;
+    uint8_t depth;
+    uint8_t hasMembers;    // bit per nesting level
+
+    void put(char c) {
+        if (length == sizeof(buffer)) flush();
+        buffer[length++] = c;
+    }
+
+    void put(const char* text) {
+        while (*text) put(*text++);
+    }
+
+    // Comma before every member but the first at this level
+    void separate() {
+        if (depth == 0) return;
+        uint8_t bit = 1 << (depth - 1);
+        if (hasMembers & bit) put(',');
+        hasMembers |= bit;
+    }
+
+    void putString(const char* text) {
+        static const char hex[] = "0123456789abcdef";
+        put('"');
+        for (; *text; text++) {
+            uint8_t c = *text;
+            switch (c) {
+                case '"': put("\\\""); break;
+                case '\\': put("\\\\"); break;
+                case '\n': put("\\n"); break;
+                case '\r': put("\\r"); break;
+                case '\t': put("\\t"); break;
+                default:
+                    if (c < 0x20) {
+                        put("\\u00");
+                        put(hex[c >> 4]);
+                        put(hex[c & 0x0f]);
+                    } else {
+                        put((char)c);
+                    }
+            }
+        }
+        put('"');
+    }
+
+    void key(const char* name) {
+        separate();
+        if (name) {
+            putString(name);
+            put(':');
+        }
+    }
+
+    void open(const char* name, char bracket) {
+        key(name);
+        put(bracket);
+        if (depth < JSON_WRITER_MAX_DEPTH) {
+            depth++;
+            hasMembers &= ~(1 << (depth - 1));
+        }
+    }
+
+    void close(char bracket) {
+        if (depth > 0) depth--;
+        put(bracket);
+    }
+
+public:
+    JsonStreamWriter(Print& out) : out(out) {
+        length = 0;
+        depth = 0;
+        hasMembers = 0;
+    }
+
+    ~JsonStreamWriter() {
+        flush();
+    }
+
+    // name is the member name inside an object, nullptr inside an array
+    void beginObject(const char* name = nullptr) {
+        open(name, '{');
+    }
+
+    void endObject() {
+        close('}');
+    }
+
+    void beginArray(const char* name = nullptr) {
+        open(name, '[');
+    }
+
+    void endArray() {
+        close(']');
+    }
+
+    void field(const char* name, const char* value) {
+        key(name);
+        putString(value);
+    }
+
+    void field(const char* name, long value) {
+        char number[12];
+        snprintf(number, sizeof(number), "%ld", value);
+        key(name);
+        put(number);
+    }
+
+    void field(const char* name, int value) {
+        field(name, (long)value);
+    }
+
+    void field(const char* name, bool value) {
+        key(name);
+        put(value ? "true" : "false");
+    }
+
+    void flush() {
+        if (length == 0) return;
+        out.write((const uint8_t*)buffer, length);
+        length = 0;
+    }
+};
+
+#endif // JSON_STREAM_WRITER_H
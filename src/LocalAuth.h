@@ -0,0 +1,81 @@
+#ifndef LOCAL_AUTH_H
+#define LOCAL_AUTH_H
+
+#include <Arduino.h>
+#include <mbedtls/md.h>
+
+#define LOCAL_TOKEN_LENGTH 65       // hex HMAC-SHA256 and terminator
+#define LOCAL_TOKEN_CONTEXT "petfeeder-local-api:"
+
+// Bearer token for the local HTTP and WebSocket API. It is the HMAC-SHA256
+// of the device id keyed with the device's Supabase JWT, so it needs no
+// provisioning of its own, differs per device and changes when the
+// credentials do. The device publishes it on its own devices row, which
+// only the owner can read, and the web app uses it to talk to the feeder
+// directly on the same network.
+class LocalAuth {
+public:
+    struct Stats {
+        uint32_t accepted;
+        uint32_t rejected;
+    };
+
+private:
+    char token[LOCAL_TOKEN_LENGTH];
+    Stats stats;
+
+public:
+    LocalAuth() {
+        token[0] = '\0';
+        stats = Stats();
+    }
+
+    // Derive the token. Returns false if mbedtls fails, in which case
+    // every request is rejected.
+    bool begin(const char* secret, const char* deviceId) {
+        char message[64];
+        snprintf(message, sizeof(message), "%s%s", LOCAL_TOKEN_CONTEXT, deviceId);
+
+        uint8_t digest[32];
+        const mbedtls_md_info_t* sha256 = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+        if (mbedtls_md_hmac(sha256, (const uint8_t*)secret, strlen(secret),
+                            (const uint8_t*)message, strlen(message), digest) != 0) {
+            token[0] = '\0';
+            return false;
+        }
+
+        for (uint8_t i = 0; i < sizeof(digest); i++) {
+            snprintf(token + i * 2, 3, "%02x", digest[i]);
+        }
+        return true;
+    }
+
+    // Compare in constant time so the token cannot be guessed byte by byte
+    bool check(const char* presented) {
+        bool match = token[0] != '\0' && presented && strlen(presented) == LOCAL_TOKEN_LENGTH - 1;
+        if (match) {
+            uint8_t diff = 0;
+            for (uint8_t i = 0; i < LOCAL_TOKEN_LENGTH - 1; i++) {
+                diff |= token[i] ^ presented[i];
+            }
+            match = diff == 0;
+        }
+
+        if (match) {
+            stats.accepted++;
+        } else {
+            stats.rejected++;
+        }
+        return match;
+    }
+
+    const char* getToken() const {
+        return token;
+    }
+
+    const Stats& getStats() const {
+        return stats;
+    }
+};
+
+#endif // LOCAL_AUTH_H
@@ -0,0 +1,203 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <atomic>
+#include <mutex>
+
+#define METRICS_MAX_PHASES 24
+#define METRICS_BUCKET_COUNT 12   // including +Inf
+
+// Fixed-bucket latency histogram. record() is a few integer operations, so
+// it can stay on in production. Each histogram has one writer; readers may
+// see a count and sum from slightly different moments, which is fine for
+// scraping.
+class LatencyHistogram {
+public:
+    // Bucket upper bounds in microseconds, and the same in seconds for the
+    // Prometheus "le" label
+    static constexpr uint32_t BOUNDS_US[METRICS_BUCKET_COUNT - 1] = {
+        100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000, 10000000
+    };
+    static constexpr const char* BOUNDS_LABEL[METRICS_BUCKET_COUNT] = {
+        "0.0001", "0.0005", "0.001", "0.005", "0.01", "0.05", "0.1", "0.5", "1", "5", "10", "+Inf"
+    };
+
+private:
+    uint32_t buckets[METRICS_BUCKET_COUNT];
+    uint32_t count;
+    uint64_t sumUs;
+    uint32_t maxUs;
+
+public:
+    LatencyHistogram() {
+        memset(buckets, 0, sizeof(buckets));
+        count = 0;
+        sumUs = 0;
+        maxUs = 0;
+    }
+
+    void record(uint32_t us) {
+        uint8_t i = 0;
+        while (i < METRICS_BUCKET_COUNT - 1 && us > BOUNDS_US[i]) i++;
+        buckets[i]++;
+        count++;
+        sumUs += us;
+        if (us > maxUs) maxUs = us;
+    }
+
+    uint32_t getCount() const {
+        return count;
+    }
+
+    uint32_t getMaxUs() const {
+        return maxUs;
+    }
+
+    uint32_t averageUs() const {
+        return count ? (uint32_t)(sumUs / count) : 0;
+    }
+
+    // Write the _bucket, _sum and _count lines. label is either empty or a
+    // "key=\"value\"," prefix for the label set.
+    void write(Print& out, const char* name, const char* label) const {
+        uint32_t cumulative = 0;
+        for (uint8_t i = 0; i < METRICS_BUCKET_COUNT; i++) {
+            cumulative += buckets[i];
+            out.printf("%s_bucket{%sle=\"%s\"} %u\n", name, label, BOUNDS_LABEL[i], cumulative);
+        }
+
+        // The sum and count take the same labels without the trailing comma
+        int labelLength = strlen(label);
+        if (labelLength == 0) {
+            out.printf("%s_sum %.6f\n", name, sumUs / 1e6);
+            out.printf("%s_count %u\n", name, cumulative);
+        } else {
+            out.printf("%s_sum{%.*s} %.6f\n", name, labelLength - 1, label, sumUs / 1e6);
+            out.printf("%s_count{%.*s} %u\n", name, labelLength - 1, label, cumulative);
+        }
+    }
+};
+
+// Firmware profiler. Collects a latency histogram per scheduled job,
+// HTTP round trips and TLS handshakes, and reads the heap on demand, then
+// renders them in the Prometheus text format for /metrics.
+//
+// Phases are keyed by name and added on first use. The table only grows,
+// and an entry is filled in before the count that publishes it, so the
+// web server task can list it while the worker tasks record.
+class Metrics {
+    struct Phase {
+        const char* name;
+        LatencyHistogram latency;
+    };
+
+    Phase phases[METRICS_MAX_PHASES];
+    std::atomic<uint8_t> phaseCount;
+    std::mutex addLock;          // two tasks may add phases at once
+    LatencyHistogram http;       // every Supabase request
+    LatencyHistogram handshake;  // requests that opened a new TLS connection
+    uint32_t httpFailures;
+
+    Phase* findPhase(const char* name) {
+        uint8_t n = phaseCount.load(std::memory_order_acquire);
+        for (uint8_t i = 0; i < n; i++) {
+            if (phases[i].name == name || strcmp(phases[i].name, name) == 0) return &phases[i];
+        }
+        return nullptr;
+    }
+
+    Phase* addPhase(const char* name) {
+        std::lock_guard<std::mutex> lock(addLock);
+        Phase* phase = findPhase(name);
+        if (phase) return phase;
+
+        uint8_t n = phaseCount.load(std::memory_order_relaxed);
+        if (n >= METRICS_MAX_PHASES) return nullptr;
+        phases[n].name = name;
+        phaseCount.store(n + 1, std::memory_order_release);
+        return &phases[n];
+    }
+
+public:
+    Metrics() : phaseCount(0) {
+        httpFailures = 0;
+    }
+
+    // Time spent in one run of a phase. name must outlive the Metrics,
+    // such as a string literal or a scheduler task name.
+    void recordPhase(const char* name, uint32_t us) {
+        Phase* phase = findPhase(name);
+        if (!phase) phase = addPhase(name);
+        if (phase) phase->latency.record(us);
+    }
+
+    // One Supabase request. code <= 0 means no HTTP status came back.
+    void recordRequest(uint32_t roundTripMs, bool newConnection, int code) {
+        if (code <= 0) {
+            httpFailures++;
+            return;
+        }
+        http.record(roundTripMs * 1000);
+        if (newConnection) handshake.record(roundTripMs * 1000);
+    }
+
+    // Render everything in the Prometheus text exposition format
+    void write(Print& out) const {
+        char label[48];
+
+        out.print("# HELP feeder_phase_seconds Run time of each scheduled job\n");
+        out.print("# TYPE feeder_phase_seconds histogram\n");
+        uint8_t n = phaseCount.load(std::memory_order_acquire);
+        for (uint8_t i = 0; i < n; i++) {
+            snprintf(label, sizeof(label), "phase=\"%s\",", phases[i].name);
+            phases[i].latency.write(out, "feeder_phase_seconds", label);
+        }
+
+        out.print("# HELP feeder_http_request_seconds Supabase request round trip\n");
+        out.print("# TYPE feeder_http_request_seconds histogram\n");
+        http.write(out, "feeder_http_request_seconds", "");
+
+        out.print("# HELP feeder_tls_handshake_seconds Round trip of requests that opened a new TLS connection\n");
+        out.print("# TYPE feeder_tls_handshake_seconds histogram\n");
+        handshake.write(out, "feeder_tls_handshake_seconds", "");
+
+        out.print("# TYPE feeder_http_failures_total counter\n");
+        out.printf("feeder_http_failures_total %u\n", httpFailures);
+
+        out.print("# TYPE feeder_heap_free_bytes gauge\n");
+        out.printf("feeder_heap_free_bytes %u\n", ESP.getFreeHeap());
+        out.print("# TYPE feeder_heap_min_free_bytes gauge\n");
+        out.printf("feeder_heap_min_free_bytes %u\n", ESP.getMinFreeHeap());
+        out.print("# TYPE feeder_heap_largest_free_block_bytes gauge\n");
+        out.printf("feeder_heap_largest_free_block_bytes %u\n", ESP.getMaxAllocHeap());
+
+        out.print("# TYPE feeder_uptime_seconds counter\n");
+        out.printf("feeder_uptime_seconds %lu\n", millis() / 1000);
+    }
+
+    // Compact summary for the device row: heap figures, HTTP timings and
+    // the slowest phase
+    void addToPayload(JsonObject obj) const {
+        obj["heap_free"] = ESP.getFreeHeap();
+        obj["heap_min"] = ESP.getMinFreeHeap();
+        obj["heap_largest"] = ESP.getMaxAllocHeap();
+        obj["http_avg_ms"] = http.averageUs() / 1000;
+        obj["http_max_ms"] = http.getMaxUs() / 1000;
+        obj["tls_avg_ms"] = handshake.averageUs() / 1000;
+        obj["http_failures"] = httpFailures;
+
+        const Phase* slowest = nullptr;
+        uint8_t n = phaseCount.load(std::memory_order_acquire);
+        for (uint8_t i = 0; i < n; i++) {
+            if (!slowest || phases[i].latency.getMaxUs() > slowest->latency.getMaxUs()) slowest = &phases[i];
+        }
+        if (slowest) {
+            obj["slowest_phase"] = slowest->name;
+            obj["slowest_phase_ms"] = slowest->latency.getMaxUs() / 1000;
+        }
+    }
+};
+
+#endif // METRICS_H
@@ -0,0 +1,83 @@
+#ifndef PORTAL_ASSETS_H
+#define PORTAL_ASSETS_H
+
+// Generated by embed-portal.js from src/portal, do not edit by hand.
+// Each page is stored gzip-compressed with an ETag derived from its content.
+
+#include <Arduino.h>
+
+struct PortalAsset {
+    const char* path;
+    const char* contentType;
+    const uint8_t* data;
+    size_t length;
+    const char* etag;
+};
+
+// index.html: 1846 bytes, 888 gzipped
+static const uint8_t PORTAL_INDEX_HTML_GZ[] PROGMEM = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x7d, 0x55, 0x4b, 0x8f, 0xe3, 0x36,
+    0x0c, 0xbe, 0xfb, 0x57, 0xb0, 0x46, 0x0b, 0xdb, 0x40, 0xe2, 0x3c, 0xd0, 0xc3, 0x22, 0xb1, 0x7d,
+    0xd8, 0x79, 0x00, 0x05, 0x8a, 0x6e, 0xd0, 0x99, 0xa2, 0xe8, 0x6d, 0x15, 0x89, 0x8e, 0xd5, 0xb5,
+    0x25, 0x57, 0xa2, 0x93, 0xc9, 0x0e, 0xf2, 0xdf, 0x0b, 0xc9, 0xf6, 0x64, 0x1c, 0x60, 0xf6, 0x64,
+    0x91, 0x22, 0x3f, 0x92, 0x1f, 0x29, 0x3a, 0xfb, 0xe9, 0xfe, 0xcb, 0xdd, 0xf3, 0x3f, 0xbb, 0x07,
+    0xa8, 0xa8, 0xa9, 0x8b, 0x20, 0x1b, 0x3f, 0xc8, 0x44, 0x11, 0x64, 0x0d, 0x12, 0x03, 0x5e, 0x31,
+    0x63, 0x91, 0xf2, 0xb0, 0xa3, 0x72, 0xfe, 0x29, 0x1c, 0xd5, 0x8a, 0x35, 0x98, 0x87, 0x47, 0x89,
+    0xa7, 0x56, 0x1b, 0x0a, 0x81, 0x6b, 0x45, 0xa8, 0x28, 0x0f, 0x4f, 0x52, 0x50, 0x95, 0x0b, 0x3c,
+    0x4a, 0x8e, 0x73, 0x2f, 0xcc, 0x40, 0x2a, 0x49, 0x92, 0xd5, 0x73, 0xcb, 0x59, 0x8d, 0xf9, 0xca,
+    0x81, 0x90, 0xa4, 0x1a, 0x8b, 0x1d, 0xd2, 0x23, 0xa2, 0x40, 0x03, 0x4f, 0x48, 0x5d, 0x9b, 0x2d,
+    0x7a, 0x75, 0x90, 0x59, 0x3a, 0xbb, 0xef, 0x5e, 0x8b, 0x33, 0xbc, 0x42, 0xa9, 0x15, 0xcd, 0x4b,
+    0xd6, 0xc8, 0xfa, 0xbc, 0x01, 0xcb, 0x94, 0x9d, 0x5b, 0x34, 0xb2, 0xdc, 0x42, 0xc3, 0x5e, 0xfa,
+    0x18, 0x1b, 0x58, 0x7f, 0xc2, 0xc6, 0x29, 0xcc, 0x41, 0xaa, 0x0d, 0xac, 0xb0, 0x01, 0xd6, 0x91,
+    0xde, 0x42, 0xcb, 0x84, 0x90, 0xea, 0xb0, 0x81, 0xa5, 0x53, 0x6e, 0xe1, 0x12, 0xd4, 0x12, 0x5e,
+    0xdf, 0x0c, 0x97, 0xe9, 0xaf, 0xd8, 0xc0, 0xd2, 0xe9, 0xa5, 0x6a, 0x3b, 0x9a, 0xc1, 0xbe, 0x23,
+    0xd2, 0x6a, 0x8c, 0x6a, 0xe5, 0x77, 0xdc, 0xf4, 0x9e, 0x57, 0x97, 0xf5, 0xc4, 0x05, 0x5e, 0x61,
+    0xc8, 0x61, 0xb5, 0x5c, 0xfe, 0xb2, 0x85, 0xbd, 0x7e, 0x71, 0x6e, 0x3e, 0xe8, 0x5e, 0x1b, 0x81,
+    0x66, 0xbe, 0xd7, 0x2f, 0xce, 0x3c, 0x5b, 0x0c, 0x75, 0x65, 0x8b, 0x81, 0x62, 0x57, 0xa0, 0x23,
+    0x7c, 0xf5, 0x8e, 0x8a, 0xbf, 0xe5, 0xa3, 0x1c, 0xf9, 0xa8, 0x56, 0xce, 0xa8, 0xcf, 0x48, 0x2b,
+    0x5e, 0x4b, 0xfe, 0x2d, 0x0f, 0x2d, 0x67, 0xea, 0x0f, 0xa4, 0x93, 0x36, 0xdf, 0x6c, 0x9c, 0x84,
+    0xc5, 0x13, 0x67, 0x0a, 0x46, 0x45, 0xb6, 0xe8, 0xcd, 0x8b, 0x20, 0x13, 0xf2, 0x08, 0x52, 0xe4,
+    0xa1, 0x1a, 0xae, 0xc2, 0x22, 0x5b, 0x08, 0x79, 0x2c, 0x82, 0x20, 0xab, 0xd6, 0xc5, 0x9d, 0x56,
+    0x0a, 0x39, 0x65, 0x8b, 0x6a, 0x5d, 0x04, 0x59, 0xa9, 0x4d, 0xe3, 0x8d, 0xb9, 0x56, 0xa5, 0x3c,
+    0x74, 0x06, 0x5d, 0x97, 0xfa, 0xfa, 0xfa, 0x5e, 0x5b, 0x2b, 0x45, 0xe8, 0x4d, 0xfa, 0x53, 0x5b,
+    0x33, 0x8e, 0x95, 0xae, 0x05, 0x9a, 0x3c, 0x1c, 0xa2, 0x7b, 0xd3, 0x10, 0x0c, 0xfe, 0xd7, 0x49,
+    0x83, 0xe2, 0x06, 0xa1, 0x65, 0xd6, 0x9e, 0xb4, 0x11, 0x21, 0xd0, 0xb9, 0x9d, 0xc8, 0x13, 0xac,
+    0xdd, 0xa8, 0xbe, 0x75, 0x37, 0x52, 0x1b, 0x49, 0xe7, 0xd1, 0x5d, 0x75, 0xcd, 0x1e, 0x4d, 0x08,
+    0x47, 0x56, 0x77, 0x98, 0x87, 0xcb, 0x5b, 0x98, 0xd1, 0xfc, 0x8d, 0xc1, 0xe2, 0x89, 0x1d, 0xf1,
+    0x1d, 0x3f, 0x0b, 0x57, 0x74, 0x11, 0x64, 0x6d, 0x5f, 0x15, 0x31, 0xea, 0x3c, 0x47, 0xad, 0x63,
+    0xc8, 0x72, 0x23, 0x5b, 0x2a, 0x82, 0xb2, 0x53, 0x9c, 0xa4, 0x56, 0xf0, 0x46, 0x4c, 0xec, 0xea,
+    0x4f, 0xe0, 0x35, 0x00, 0x10, 0x9a, 0x77, 0x0d, 0x2a, 0x4a, 0x0f, 0x48, 0x0f, 0x35, 0xba, 0xe3,
+    0xe7, 0xf3, 0x6f, 0x22, 0x8e, 0x9c, 0x49, 0x94, 0xa4, 0x3e, 0x35, 0xc8, 0xc1, 0x89, 0xdb, 0xe0,
+    0x12, 0x5c, 0xd1, 0xa6, 0x3d, 0xf4, 0x60, 0x25, 0x12, 0xaf, 0xe2, 0x68, 0xe1, 0xae, 0xa2, 0x24,
+    0xa5, 0x0a, 0x55, 0x6c, 0x20, 0x2f, 0xc0, 0xa4, 0xff, 0x5a, 0xad, 0xe2, 0x64, 0xd0, 0x09, 0x46,
+    0xcc, 0xa9, 0x9d, 0x0f, 0xb8, 0xb4, 0x2c, 0x41, 0x2d, 0x2d, 0x41, 0x7e, 0xcd, 0x87, 0x1b, 0x64,
+    0x84, 0x43, 0x4a, 0x71, 0xd4, 0xd5, 0x51, 0xb2, 0xf5, 0xe6, 0xce, 0x39, 0x1d, 0x07, 0x22, 0x2d,
+    0xb5, 0x79, 0x60, 0xbc, 0x8a, 0xd5, 0x15, 0x6f, 0x44, 0x94, 0x84, 0xcd, 0x0f, 0x10, 0x6b, 0x39,
+    0x22, 0x82, 0x37, 0x4d, 0x09, 0x5f, 0xe8, 0xae, 0x5f, 0x02, 0x90, 0xc3, 0xd7, 0x9f, 0x5f, 0x55,
+    0xea, 0xaa, 0xbe, 0x40, 0xec, 0x8e, 0xc6, 0x5a, 0x79, 0x11, 0x9f, 0x9b, 0x19, 0xf0, 0x0a, 0x9c,
+    0x82, 0x57, 0x4c, 0x29, 0xac, 0x2f, 0x33, 0x2f, 0x59, 0xe4, 0x9d, 0xeb, 0xd5, 0x25, 0x81, 0xaf,
+    0xdb, 0x49, 0x1a, 0xc3, 0xec, 0x7f, 0x9c, 0x48, 0x6f, 0x70, 0x4d, 0xa6, 0x97, 0x6f, 0xd2, 0x89,
+    0xee, 0xc6, 0xe6, 0x45, 0x37, 0x76, 0xc3, 0xa3, 0x82, 0x1c, 0xe2, 0xc4, 0x91, 0x70, 0xed, 0x72,
+    0x9f, 0xff, 0xb4, 0x48, 0xd6, 0xb6, 0xa8, 0xc4, 0x5d, 0x25, 0x6b, 0x11, 0xf7, 0x00, 0x6f, 0xf7,
+    0xae, 0x03, 0x93, 0x7b, 0xe7, 0x30, 0xdc, 0x5e, 0x46, 0xf2, 0x3f, 0x1a, 0x97, 0xb1, 0x21, 0x51,
+    0x92, 0x1a, 0xf4, 0x53, 0xec, 0x31, 0x0c, 0xaa, 0xd8, 0xe1, 0x0e, 0xee, 0xb2, 0x04, 0xdf, 0xfc,
+    0xd4, 0x4d, 0x88, 0x92, 0xea, 0x90, 0x80, 0x45, 0x7a, 0x96, 0x0d, 0xea, 0x8e, 0xe2, 0xf7, 0x13,
+    0x35, 0x83, 0xf5, 0x72, 0xb9, 0xf4, 0x6e, 0x2e, 0xf6, 0x25, 0x08, 0x3e, 0x0c, 0xfd, 0x56, 0x70,
+    0x94, 0xa4, 0x5a, 0xd9, 0x6e, 0xdf, 0x48, 0xc7, 0x18, 0x1e, 0x3d, 0x73, 0xfd, 0x54, 0x78, 0x21,
+    0x6d, 0x8d, 0xff, 0xde, 0x63, 0xc9, 0xba, 0x9a, 0x62, 0x8f, 0x3e, 0xce, 0xec, 0x15, 0x65, 0xe6,
+    0x96, 0x2b, 0x52, 0xa5, 0xc5, 0x06, 0xa2, 0xdd, 0x97, 0xa7, 0xe7, 0x68, 0x06, 0x6e, 0xcb, 0x6d,
+    0x40, 0xe1, 0x09, 0xfe, 0xfa, 0xf3, 0xf7, 0x27, 0x64, 0x86, 0x57, 0x3b, 0x66, 0x58, 0x63, 0x63,
+    0xa7, 0x7b, 0xd4, 0xa6, 0xb9, 0x67, 0xc4, 0xe2, 0x3e, 0x0c, 0x31, 0x73, 0x40, 0x4a, 0x12, 0xb8,
+    0x24, 0xbe, 0xea, 0xc9, 0x43, 0x70, 0x6d, 0x8d, 0x93, 0xf7, 0x17, 0x4e, 0xe3, 0xf3, 0xfc, 0xc1,
+    0x63, 0xf4, 0x2f, 0xdb, 0x3d, 0xa9, 0xc9, 0x50, 0x38, 0x69, 0xdb, 0xf3, 0xb3, 0x0d, 0x82, 0xe9,
+    0x83, 0xdc, 0xba, 0x5d, 0x3d, 0x6c, 0x80, 0x6c, 0x31, 0x6c, 0xe9, 0x45, 0xff, 0x7b, 0xfc, 0x1f,
+    0xdb, 0x1d, 0x27, 0x1e, 0x36, 0x07, 0x00, 0x00,
+};
+
+static const PortalAsset PORTAL_ASSETS[] = {
+    {"/", "text/html", PORTAL_INDEX_HTML_GZ, sizeof(PORTAL_INDEX_HTML_GZ), "\"5edd88db215056ba\""},
+};
+
+#define PORTAL_ASSET_COUNT (sizeof(PORTAL_ASSETS) / sizeof(PORTAL_ASSETS[0]))
+
+#endif // PORTAL_ASSETS_H
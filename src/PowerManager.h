@@ -0,0 +1,192 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include "Crc32.h"
+#include "FeedingJournal.h"
+#include "ScheduleIndex.h"
+
+// Deep sleep drops the realtime socket, so feed commands are only picked
+// up by the poll on each wake. Off unless the build asks for it.
+#ifndef DEEP_SLEEP_ENABLED
+#define DEEP_SLEEP_ENABLED 0
+#endif
+
+#define POWER_RESUME_MAGIC 0x50465233     // "PFR3"
+#define POWER_MIN_AWAKE_MS 20000          // stay up this long after waking or working
+#define POWER_DEEP_SLEEP_MIN_MS 60000     // shorter idle periods use light sleep
+#define POWER_COMMAND_POLL_INTERVAL 300000 // longest deep sleep, bounds feed command latency
+#define POWER_WAKE_LEAD_MS 5000           // wake early to reconnect before a feed
+#define POWER_LIGHT_SLEEP_MIN_MS 20       // shorter waits are not worth sleeping
+
+// Decides how the device idles between jobs. While the radio is needed the
+// tasks block with WiFi modem sleep, which the driver manages on its own.
+// Offline, waits are spent in light sleep. With DEEP_SLEEP_ENABLED the
+// device powers down completely until the next schedule, heartbeat or
+// command poll is due.
+//
+// State needed to resume quickly after deep sleep is kept in RTC memory,
+// which survives deep sleep but not a reset or power loss: the compiled
+// schedule table, the access point last associated with and the journal
+// cursor. It is checked with a CRC before use, so a cold boot falls back to
+// the normal start. The time from wake to the first successful Supabase
+// request is measured for every boot.
+class PowerManager {
+public:
+    // Schedule amounts are kept alongside the index so feeds can fire
+    // before the schedules are fetched again
+    struct ResumeState {
+        uint32_t magic;
+        uint32_t sleepCount;
+        ScheduleIndex::Snapshot schedules;
+        int16_t amounts[MAX_INDEXED_SCHEDULES];
+        FeedingJournal::Cursor journal;
+        char ssid[33];
+        uint8_t bssid[6];
+        uint8_t channel;
+        uint32_t lastWakeToRequestMs;    // reported again after the next wake
+        uint32_t crc;
+    };
+
+    struct Stats {
+        uint32_t lightSleeps;
+        uint32_t lightSleepMs;
+        uint32_t wakeToConnectMs;        // 0 until WiFi connects
+        uint32_t wakeToRequestMs;        // 0 until the first request succeeds
+    };
+
+private:
+    static inline RTC_DATA_ATTR ResumeState rtc;
+
+    bool resumed;
+    esp_sleep_wakeup_cause_t wakeCause;
+    unsigned long lastActivity;
+    Stats stats;
+
+    static uint32_t stateCrc(const ResumeState& state) {
+        return crc32(&state, offsetof(ResumeState, crc));
+    }
+
+    static uint32_t sinceBootMs() {
+        return (uint32_t)(esp_timer_get_time() / 1000);
+    }
+
+public:
+    PowerManager() {
+        resumed = false;
+        wakeCause = ESP_SLEEP_WAKEUP_UNDEFINED;
+        lastActivity = 0;
+        stats = Stats();
+    }
+
+    // Call first thing in setup(). Returns true if this boot is a wake from
+    // deep sleep with valid resume state.
+    bool begin() {
+        wakeCause = esp_sleep_get_wakeup_cause();
+        resumed = wakeCause == ESP_SLEEP_WAKEUP_TIMER &&
+                  rtc.magic == POWER_RESUME_MAGIC && rtc.crc == stateCrc(rtc);
+
+        if (resumed) {
+            Serial.printf("Power: woke from deep sleep %u, last wake to first request %u ms\n",
+                          rtc.sleepCount, rtc.lastWakeToRequestMs);
+        } else {
+            memset(&rtc, 0, sizeof(rtc));
+        }
+
+        // Let the driver power the radio down between beacons
+        WiFi.setSleep(true);
+        return resumed;
+    }
+
+    bool isResume() const {
+        return resumed;
+    }
+
+    // Valid after begin() returned true, and written back by deepSleep()
+    ResumeState& state() {
+        return rtc;
+    }
+
+    // Anything that should keep the device awake for a while, such as a
+    // feed or a received command
+    void noteActivity() {
+        lastActivity = millis();
+    }
+
+    void markConnected() {
+        if (stats.wakeToConnectMs == 0) stats.wakeToConnectMs = sinceBootMs();
+    }
+
+    // Call after each successful Supabase request, only the first counts
+    void markRequest() {
+        if (stats.wakeToRequestMs != 0) return;
+        stats.wakeToRequestMs = sinceBootMs();
+        Serial.printf("Power: %s to first request %u ms (WiFi up at %u ms)\n",
+                      resumed ? "wake" : "boot", stats.wakeToRequestMs, stats.wakeToConnectMs);
+    }
+
+    // Light sleep for waitMs. Only call when nothing needs the radio or the
+    // web portal. Returns false without sleeping if the wait is too short
+    // or the sleep failed, and the caller should wait normally instead.
+    bool lightSleep(unsigned long waitMs) {
+        if (waitMs < POWER_LIGHT_SLEEP_MIN_MS) return false;
+
+        Serial.flush();
+        esp_sleep_enable_timer_wakeup((uint64_t)waitMs * 1000);
+        if (esp_light_sleep_start() != ESP_OK) return false;
+
+        stats.lightSleeps++;
+        stats.lightSleepMs += waitMs;
+        return true;
+    }
+
+    // True once the device has been idle long enough to power down.
+    // The caller decides whether anything is still pending.
+    bool canDeepSleep() const {
+        if (!DEEP_SLEEP_ENABLED) return false;
+        unsigned long now = millis();
+        return now >= POWER_MIN_AWAKE_MS && now - lastActivity >= POWER_MIN_AWAKE_MS;
+    }
+
+    // Sleep length for the next due work, or 0 if it is too close to be
+    // worth powering down. untilScheduleMs < 0 means no schedules.
+    static unsigned long deepSleepLength(long untilScheduleMs, unsigned long untilHeartbeatMs) {
+        unsigned long sleepMs = min(untilHeartbeatMs, (unsigned long)POWER_COMMAND_POLL_INTERVAL);
+        if (untilScheduleMs >= 0) sleepMs = min(sleepMs, (unsigned long)untilScheduleMs);
+        if (sleepMs < POWER_DEEP_SLEEP_MIN_MS) return 0;
+        return sleepMs - POWER_WAKE_LEAD_MS;
+    }
+
+    // Seal the resume state filled in by the caller and power down. Does
+    // not return.
+    void deepSleep(unsigned long sleepMs) {
+        if (WiFi.status() == WL_CONNECTED) {
+            strlcpy(rtc.ssid, WiFi.SSID().c_str(), sizeof(rtc.ssid));
+            memcpy(rtc.bssid, WiFi.BSSID(), sizeof(rtc.bssid));
+            rtc.channel = WiFi.channel();
+        }
+        rtc.magic = POWER_RESUME_MAGIC;
+        rtc.sleepCount++;
+        rtc.lastWakeToRequestMs = stats.wakeToRequestMs;
+        rtc.crc = stateCrc(rtc);
+
+        Serial.printf("Power: deep sleep for %lu s\n", sleepMs / 1000);
+        Serial.flush();
+        WiFi.disconnect(true);
+        esp_sleep_enable_timer_wakeup((uint64_t)sleepMs * 1000);
+        esp_deep_sleep_start();
+    }
+
+    esp_sleep_wakeup_cause_t getWakeCause() const {
+        return wakeCause;
+    }
+
+    const Stats& getStats() const {
+        return stats;
+    }
+};
+
+#endif // POWER_MANAGER_H
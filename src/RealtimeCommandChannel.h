@@ -0,0 +1,265 @@
+#ifndef REALTIME_COMMAND_CHANNEL_H
+#define REALTIME_COMMAND_CHANNEL_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <WebSocketsClient.h>
+#include <functional>
+
+#define REALTIME_HEARTBEAT_INTERVAL 25000 // Phoenix drops sockets after 60 s of silence
+#define REALTIME_RECONNECT_INTERVAL 5000
+#define REALTIME_JOIN_TIMEOUT 10000
+#define COMMAND_POLL_MIN_INTERVAL 2000    // fallback polling while the socket is down
+#define COMMAND_POLL_MAX_INTERVAL 60000
+#define COMMAND_SAFETY_POLL_INTERVAL 180000 // slow poll while subscribed, in case the channel goes quiet
+
+// Subscribes to INSERTs on feed_commands for this device over the Supabase
+// Realtime (Phoenix) WebSocket, so new commands arrive as soon as they are
+// written instead of being polled for. While the socket is down the caller
+// falls back to REST polling, backing off while polls come back empty.
+// While subscribed it still polls slowly, because a join can succeed on a
+// channel that never delivers (table missing from the publication, RLS,
+// server-side drops).
+//
+// The endpoint is taken from a ws:// or wss:// URL, so a local WebSocket
+// stand-in (test/firmware/realtime-standin.js) can be used in place of
+// Supabase.
+class RealtimeCommandChannel {
+public:
+    typedef std::function<void(const String& commandId, int amount)> CommandCallback;
+    // Called when the subscription is (re)established, so the caller can
+    // poll once for commands written while it was down
+    typedef std::function<void()> SubscribedCallback;
+
+    struct Stats {
+        uint32_t connects;
+        uint32_t disconnects;
+        uint32_t commands;     // commands delivered over the socket
+        uint32_t polls;        // fallback REST polls
+    };
+
+private:
+    WebSocketsClient ws;
+    String host;
+    uint16_t port;
+    String path;
+    bool secure;
+    String accessToken;
+    String topic;
+    String filter;
+
+    bool connected;
+    bool subscribed;
+    uint32_t ref;
+    String joinRef;
+    unsigned long joinSentAt;
+    unsigned long lastHeartbeat;
+    unsigned long pollInterval;
+
+    CommandCallback commandCallback;
+    SubscribedCallback subscribedCallback;
+    Stats stats;
+
+    void parseUrl(const String& url) {
+        secure = url.startsWith("wss://");
+        int hostStart = url.indexOf("://") + 3;
+        int pathStart = url.indexOf('/', hostStart);
+        if (pathStart < 0) pathStart = url.length();
+
+        String hostPort = url.substring(hostStart, pathStart);
+        int colon = hostPort.indexOf(':');
+        if (colon >= 0) {
+            host = hostPort.substring(0, colon);
+            port = hostPort.substring(colon + 1).toInt();
+        } else {
+            host = hostPort;
+            port = secure ? 443 : 80;
+        }
+        path = pathStart < (int)url.length() ? url.substring(pathStart) : String("/");
+    }
+
+    void send(const char* msgTopic, const char* event, JsonDocument& payload, const String& msgRef) {
+        JsonDocument doc;
+        doc["topic"] = msgTopic;
+        doc["event"] = event;
+        doc["payload"] = payload;
+        doc["ref"] = msgRef;
+        if (joinRef.length() > 0) doc["join_ref"] = joinRef;
+
+        String message;
+        serializeJson(doc, message);
+        ws.sendTXT(message);
+    }
+
+    void join() {
+        JsonDocument payload;
+        JsonObject change = payload["config"]["postgres_changes"].add<JsonObject>();
+        change["event"] = "INSERT";
+        change["schema"] = "public";
+        change["table"] = "feed_commands";
+        change["filter"] = filter;
+        payload["access_token"] = accessToken;
+
+        joinRef = String(++ref);
+        send(topic.c_str(), "phx_join", payload, joinRef);
+        joinSentAt = millis();
+    }
+
+    void heartbeat() {
+        JsonDocument payload;
+        payload.to<JsonObject>();
+        send("phoenix", "heartbeat", payload, String(++ref));
+        lastHeartbeat = millis();
+    }
+
+    void handleMessage(uint8_t* data, size_t length) {
+        // Keep only the fields we read
+        JsonDocument filterDoc;
+        filterDoc["event"] = true;
+        filterDoc["ref"] = true;
+        filterDoc["payload"]["status"] = true;
+        filterDoc["payload"]["data"]["record"]["id"] = true;
+        filterDoc["payload"]["data"]["record"]["amount"] = true;
+        filterDoc["payload"]["data"]["record"]["status"] = true;
+
+        JsonDocument doc;
+        DeserializationError error = deserializeJson(doc, data, length, DeserializationOption::Filter(filterDoc));
+        if (error) {
+            Serial.print("Realtime message parse failed: ");
+            Serial.println(error.c_str());
+            return;
+        }
+
+        String event = doc["event"].as<String>();
+
+        if (event == "phx_reply" && doc["ref"].as<String>() == joinRef) {
+            if (doc["payload"]["status"].as<String>() == "ok") {
+                subscribed = true;
+                pollInterval = COMMAND_POLL_MIN_INTERVAL;
+                Serial.println("Realtime: subscribed to feed_commands");
+                if (subscribedCallback) subscribedCallback();
+            } else {
+                Serial.println("Realtime: join rejected");
+            }
+        } else if (event == "postgres_changes") {
+            JsonVariant record = doc["payload"]["data"]["record"];
+            if (record["status"].as<String>() != "pending") return;
+
+            stats.commands++;
+            if (commandCallback) {
+                commandCallback(record["id"].as<String>(), record["amount"].as<int>());
+            }
+        } else if (event == "phx_error" || event == "phx_close") {
+            Serial.println("Realtime: channel closed, rejoining");
+            subscribed = false;
+            join();
+        }
+    }
+
+    void handleEvent(WStype_t type, uint8_t* payload, size_t length) {
+        switch (type) {
+            case WStype_CONNECTED:
+                connected = true;
+                stats.connects++;
+                lastHeartbeat = millis();
+                join();
+                break;
+            case WStype_DISCONNECTED:
+                if (connected) stats.disconnects++;
+                connected = false;
+                subscribed = false;
+                joinRef = "";
+                break;
+            case WStype_TEXT:
+                handleMessage(payload, length);
+                break;
+            default:
+                break;
+        }
+    }
+
+public:
+    RealtimeCommandChannel() {
+        port = 443;
+        secure = true;
+        connected = false;
+        subscribed = false;
+        ref = 0;
+        joinSentAt = 0;
+        lastHeartbeat = 0;
+        pollInterval = COMMAND_POLL_MIN_INTERVAL;
+        stats = Stats();
+    }
+
+    void onCommand(CommandCallback callback) {
+        commandCallback = callback;
+    }
+
+    void onSubscribed(SubscribedCallback callback) {
+        subscribedCallback = callback;
+    }
+
+    // url is the Realtime endpoint, e.g.
+    // wss://<project>.supabase.co/realtime/v1/websocket?apikey=<key>&vsn=1.0.0
+    void begin(const String& url, const String& token, const String& deviceId) {
+        parseUrl(url);
+        accessToken = token;
+        topic = "realtime:feed_commands:" + deviceId;
+        filter = "device_id=eq." + deviceId;
+
+        ws.onEvent([this](WStype_t type, uint8_t* payload, size_t length) {
+            this->handleEvent(type, payload, length);
+        });
+        ws.setReconnectInterval(REALTIME_RECONNECT_INTERVAL);
+
+        if (secure) {
+            ws.beginSSL(host.c_str(), port, path.c_str());
+        } else {
+            ws.begin(host.c_str(), port, path.c_str());
+        }
+    }
+
+    // Service the socket. Call often; it only reads what is buffered.
+    void loop() {
+        ws.loop();
+        if (!connected) return;
+
+        unsigned long now = millis();
+        if (now - lastHeartbeat >= REALTIME_HEARTBEAT_INTERVAL) {
+            heartbeat();
+        }
+        if (!subscribed && now - joinSentAt >= REALTIME_JOIN_TIMEOUT) {
+            join();
+        }
+    }
+
+    void stop() {
+        ws.disconnect();
+        connected = false;
+        subscribed = false;
+    }
+
+    bool isSubscribed() const {
+        return subscribed;
+    }
+
+    // Interval until the next poll. Pass whether the last poll found
+    // commands: empty polls back off, hits reset to the minimum. While
+    // subscribed, empty polls wait for the slow safety interval instead.
+    unsigned long nextPollInterval(bool foundCommands) {
+        stats.polls++;
+        if (foundCommands) {
+            pollInterval = COMMAND_POLL_MIN_INTERVAL;
+        } else if (pollInterval < COMMAND_POLL_MAX_INTERVAL) {
+            pollInterval = min(pollInterval * 2, (unsigned long)COMMAND_POLL_MAX_INTERVAL);
+        }
+        if (subscribed && !foundCommands) return COMMAND_SAFETY_POLL_INTERVAL;
+        return pollInterval;
+    }
+
+    const Stats& getStats() const {
+        return stats;
+    }
+};
+
+#endif // REALTIME_COMMAND_CHANNEL_H
@@ -0,0 +1,232 @@
+#ifndef SCHEDULE_INDEX_H
+#define SCHEDULE_INDEX_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <functional>
+
+#define MAX_INDEXED_SCHEDULES 10
+#define MAX_SCHEDULE_EVENTS (MAX_INDEXED_SCHEDULES * 7)
+#define MINUTES_PER_DAY 1440
+#define MINUTES_PER_WEEK 10080
+#define SCHEDULE_CATCH_UP_MINUTES 15 // late feeds still served after a stall
+#define SCHEDULE_ID_LENGTH 37         // uuid and terminator
+
+// Feeding schedules compiled into a table of minute-of-week events sorted
+// by time, so finding the next due event is a binary search rather than a
+// string compare against every schedule.
+//
+// Each schedule remembers the absolute minute (unix time / 60) it last
+// fired, so an occurrence fires exactly once however often it is checked,
+// and one missed while the device was busy still fires if it is less than
+// SCHEDULE_CATCH_UP_MINUTES old. Fired state is matched by schedule id, so
+// it survives reloading the schedules. The fired minutes are small enough
+// to keep in flash with saveFired()/restoreFired() after every feed, so a
+// feed due while the power was out is still served after the reset, and
+// one that fired just before it is not served twice.
+//
+// Only the C library is used, so FeederMessages, which takes its sizes
+// from here, builds on a host as well.
+class ScheduleIndex {
+public:
+    // Called for each due occurrence with the caller's schedule number and
+    // how many minutes late it is
+    typedef std::function<void(uint8_t schedule, uint16_t minutesLate)> DueCallback;
+
+private:
+    struct Event {
+        uint16_t minuteOfWeek;
+        uint8_t schedule;
+    };
+
+public:
+    // Plain copy of the index that can be kept in RTC memory across deep
+    // sleep
+    struct Snapshot {
+        Event events[MAX_SCHEDULE_EVENTS];
+        uint8_t eventCount;
+        char ids[MAX_INDEXED_SCHEDULES][SCHEDULE_ID_LENGTH];
+        uint32_t lastFiredMinute[MAX_INDEXED_SCHEDULES];
+    };
+
+    // Fired minutes by schedule id, kept in flash over a cold boot
+    struct Fired {
+        char ids[MAX_INDEXED_SCHEDULES][SCHEDULE_ID_LENGTH];
+        uint32_t lastFiredMinute[MAX_INDEXED_SCHEDULES];
+    };
+
+private:
+    struct Slot {
+        char id[SCHEDULE_ID_LENGTH];
+        uint32_t lastFiredMinute;
+    };
+
+    Event events[MAX_SCHEDULE_EVENTS];
+    uint8_t eventCount;
+    Slot slots[MAX_INDEXED_SCHEDULES];
+    Slot previous[MAX_INDEXED_SCHEDULES]; // fired state before the last clear()
+
+    // First event at or after minuteOfWeek, eventCount if none
+    uint8_t lowerBound(uint16_t minuteOfWeek) const {
+        uint8_t low = 0;
+        uint8_t high = eventCount;
+        while (low < high) {
+            uint8_t mid = (low + high) / 2;
+            if (events[mid].minuteOfWeek < minuteOfWeek) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        return low;
+    }
+
+    void insertEvent(uint16_t minuteOfWeek, uint8_t schedule) {
+        if (eventCount >= MAX_SCHEDULE_EVENTS) return;
+        uint8_t pos = eventCount++;
+        while (pos > 0 && events[pos - 1].minuteOfWeek > minuteOfWeek) {
+            events[pos] = events[pos - 1];
+            pos--;
+        }
+        events[pos].minuteOfWeek = minuteOfWeek;
+        events[pos].schedule = schedule;
+    }
+
+    // Fire events[from, to) that have not fired for this week's occurrence
+    uint8_t fireRange(uint8_t from, uint8_t to, uint32_t nowMinute, uint16_t nowMinuteOfWeek,
+                      const DueCallback& callback) {
+        uint8_t fired = 0;
+        for (uint8_t i = from; i < to; i++) {
+            uint16_t late = (nowMinuteOfWeek + MINUTES_PER_WEEK - events[i].minuteOfWeek) % MINUTES_PER_WEEK;
+            uint32_t occurrence = nowMinute - late;
+            Slot& slot = slots[events[i].schedule];
+
+            if (slot.lastFiredMinute >= occurrence) continue;
+
+            slot.lastFiredMinute = occurrence;
+            fired++;
+            callback(events[i].schedule, late);
+        }
+        return fired;
+    }
+
+public:
+    ScheduleIndex() {
+        eventCount = 0;
+        memset(slots, 0, sizeof(slots));
+        memset(previous, 0, sizeof(previous));
+    }
+
+    // "HH:MM" or "HH:MM:SS" to minutes after midnight, -1 if invalid
+    static int parseTime(const char* time) {
+        const char* colon = strchr(time, ':');
+        if (colon == nullptr || colon == time || strnlen(colon, 3) < 3) return -1;
+        int hours = atoi(time);
+        char digits[3] = {colon[1], colon[2], '\0'};
+        int minutes = atoi(digits);
+        if (hours < 0 || hours > 23 || minutes < 0 || minutes > 59) return -1;
+        return hours * 60 + minutes;
+    }
+
+    static uint16_t minuteOfWeek(const struct tm& timeinfo) {
+        return timeinfo.tm_wday * MINUTES_PER_DAY + timeinfo.tm_hour * 60 + timeinfo.tm_min;
+    }
+
+    // Start a rebuild. Fired state is kept for ids that are added again.
+    void clear() {
+        memcpy(previous, slots, sizeof(slots));
+        memset(slots, 0, sizeof(slots));
+        eventCount = 0;
+    }
+
+    // Add the caller's schedule number `schedule`, firing at minuteOfDay on
+    // each day set in days (Sunday first)
+    bool add(uint8_t schedule, const char* id, int minuteOfDay, const bool days[7]) {
+        if (schedule >= MAX_INDEXED_SCHEDULES || minuteOfDay < 0 || minuteOfDay >= MINUTES_PER_DAY) {
+            return false;
+        }
+
+        strncpy(slots[schedule].id, id, SCHEDULE_ID_LENGTH - 1);
+        slots[schedule].id[SCHEDULE_ID_LENGTH - 1] = '\0';
+        for (uint8_t i = 0; i < MAX_INDEXED_SCHEDULES; i++) {
+            if (previous[i].id[0] != '\0' && strcmp(previous[i].id, slots[schedule].id) == 0) {
+                slots[schedule].lastFiredMinute = previous[i].lastFiredMinute;
+                break;
+            }
+        }
+
+        for (uint8_t day = 0; day < 7; day++) {
+            if (days[day]) insertEvent(day * MINUTES_PER_DAY + minuteOfDay, schedule);
+        }
+        return true;
+    }
+
+    // Fire every occurrence due now or in the catch-up window that has not
+    // fired yet. nowMinute is unix time / 60. Returns the number fired.
+    uint8_t fireDue(uint32_t nowMinute, uint16_t nowMinuteOfWeek, const DueCallback& callback) {
+        if (eventCount == 0) return 0;
+
+        uint8_t end = lowerBound(nowMinuteOfWeek + 1);
+        if (nowMinuteOfWeek >= SCHEDULE_CATCH_UP_MINUTES) {
+            return fireRange(lowerBound(nowMinuteOfWeek - SCHEDULE_CATCH_UP_MINUTES), end,
+                             nowMinute, nowMinuteOfWeek, callback);
+        }
+
+        // The window wraps from the end of Saturday into Sunday
+        uint16_t start = nowMinuteOfWeek + MINUTES_PER_WEEK - SCHEDULE_CATCH_UP_MINUTES;
+        return fireRange(lowerBound(start), eventCount, nowMinute, nowMinuteOfWeek, callback) +
+               fireRange(0, end, nowMinute, nowMinuteOfWeek, callback);
+    }
+
+    // Minutes from nowMinuteOfWeek to the next event after it, or -1 if
+    // there are no events
+    int32_t minutesUntilNext(uint16_t nowMinuteOfWeek) const {
+        if (eventCount == 0) return -1;
+        uint8_t next = lowerBound(nowMinuteOfWeek + 1);
+        if (next < eventCount) return events[next].minuteOfWeek - nowMinuteOfWeek;
+        return events[0].minuteOfWeek + MINUTES_PER_WEEK - nowMinuteOfWeek;
+    }
+
+    void save(Snapshot& snapshot) const {
+        memcpy(snapshot.events, events, sizeof(events));
+        snapshot.eventCount = eventCount;
+        for (uint8_t i = 0; i < MAX_INDEXED_SCHEDULES; i++) {
+            memcpy(snapshot.ids[i], slots[i].id, SCHEDULE_ID_LENGTH);
+            snapshot.lastFiredMinute[i] = slots[i].lastFiredMinute;
+        }
+    }
+
+    void restore(const Snapshot& snapshot) {
+        eventCount = snapshot.eventCount < MAX_SCHEDULE_EVENTS ? snapshot.eventCount : MAX_SCHEDULE_EVENTS;
+        memcpy(events, snapshot.events, eventCount * sizeof(Event));
+        for (uint8_t i = 0; i < MAX_INDEXED_SCHEDULES; i++) {
+            memcpy(slots[i].id, snapshot.ids[i], SCHEDULE_ID_LENGTH);
+            slots[i].id[SCHEDULE_ID_LENGTH - 1] = '\0';
+            slots[i].lastFiredMinute = snapshot.lastFiredMinute[i];
+        }
+    }
+
+    void saveFired(Fired& fired) const {
+        for (uint8_t i = 0; i < MAX_INDEXED_SCHEDULES; i++) {
+            memcpy(fired.ids[i], slots[i].id, SCHEDULE_ID_LENGTH);
+            fired.lastFiredMinute[i] = slots[i].lastFiredMinute;
+        }
+    }
+
+    // Call before the schedules are added, which pick it up by id
+    void restoreFired(const Fired& fired) {
+        for (uint8_t i = 0; i < MAX_INDEXED_SCHEDULES; i++) {
+            memcpy(slots[i].id, fired.ids[i], SCHEDULE_ID_LENGTH);
+            slots[i].id[SCHEDULE_ID_LENGTH - 1] = '\0';
+            slots[i].lastFiredMinute = fired.lastFiredMinute[i];
+        }
+    }
+
+    uint8_t getEventCount() const {
+        return eventCount;
+    }
+};
+
+#endif // SCHEDULE_INDEX_H
@@ -0,0 +1,92 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Bounded single-producer single-consumer queue. One task pushes and one
+// other task pops, without locks: each side only writes its own index and
+// publishes it with release ordering after the slot is written or read.
+// Capacity must be a power of two; one slot is kept empty to tell a full
+// queue from an empty one.
+//
+// Only depends on <atomic>, so it builds on the ESP32 and on a desktop
+// compiler alike.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "SpscQueue capacity must be a power of two");
+
+public:
+    struct Stats {
+        uint32_t pushed;
+        uint32_t dropped;    // pushes refused because the queue was full
+        uint32_t highWater;  // most items queued at once
+    };
+
+private:
+    T slots[Capacity];
+    std::atomic<size_t> head;   // next slot to pop, written by the consumer
+    std::atomic<size_t> tail;   // next slot to push, written by the producer
+    Stats stats;                // written by the producer only
+
+    static size_t next(size_t index) {
+        return (index + 1) & (Capacity - 1);
+    }
+
+public:
+    SpscQueue() : head(0), tail(0) {
+        stats = Stats();
+    }
+
+    // Producer side. Returns false, leaving the queue unchanged, if full.
+    bool push(const T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t n = next(t);
+        if (n == head.load(std::memory_order_acquire)) {
+            stats.dropped++;
+            return false;
+        }
+
+        slots[t] = item;
+        tail.store(n, std::memory_order_release);
+
+        stats.pushed++;
+        uint32_t queued = (n - head.load(std::memory_order_relaxed)) & (Capacity - 1);
+        if (queued > stats.highWater) stats.highWater = queued;
+        return true;
+    }
+
+    // Consumer side. Returns false if empty.
+    bool pop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+
+        item = slots[h];
+        head.store(next(h), std::memory_order_release);
+        return true;
+    }
+
+    // Approximate from either side, exact from the consumer
+    bool isEmpty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    // Items queued. From the producer side it may be more than are left,
+    // never fewer, so capacity() - size() is a safe number of pushes.
+    size_t size() const {
+        return (tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire)) & (Capacity - 1);
+    }
+
+    static constexpr size_t capacity() {
+        return Capacity - 1;
+    }
+
+    // Read from the producer side
+    const Stats& getStats() const {
+        return stats;
+    }
+};
+
+#endif // SPSC_QUEUE_H
@@ -0,0 +1,231 @@
+#ifndef SUPABASE_SESSION_H
+#define SUPABASE_SESSION_H
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <WiFiClientSecure.h>
+#include <ArduinoJson.h>
+#include "HttpBodyStream.h"
+
+#define SUPABASE_HTTP_TIMEOUT 10000 // ms to wait for a response
+#define SUPABASE_URL_LENGTH 384     // project URL plus REST path
+#define SUPABASE_PATH_LENGTH 160    // REST path and query built by callers
+#define SUPABASE_LONG_PATH_LENGTH 320 // paths listing several ids
+#define SUPABASE_BODY_LENGTH 4096   // serialized request body, fits a journal batch
+#define SUPABASE_BODY_TOO_LARGE (-100)
+
+// Keeps one TLS connection to the Supabase project open with HTTP/1.1
+// keep-alive and reuses it for every REST call. A request on a connection
+// the server has since closed is retried once on a fresh handshake when
+// that cannot run it twice: a GET, or any request that failed before it
+// was written out. A PATCH or POST that was sent but got no response may
+// have run, so it is reported to the caller instead.
+//
+// The URL, headers and request body live in buffers sized once at startup,
+// so steady-state requests do not grow the heap with String concatenation.
+class SupabaseSession {
+public:
+    struct Stats {
+        uint32_t requests;     // requests sent
+        uint32_t handshakes;   // new TCP + TLS connections
+        uint32_t reused;       // requests sent on an open connection
+        uint32_t retries;      // requests resent after a reused connection had gone stale
+        uint32_t failures;     // requests that got no HTTP status
+        unsigned long lastRoundTripMs;
+        unsigned long lastHandshakeMs;
+    };
+
+    // Told about every request: round trip, whether it opened a new
+    // connection, and the HTTP status or a negative error
+    typedef void (*RequestObserver)(unsigned long roundTripMs, bool newConnection, int code);
+
+private:
+    WiFiClientSecure client;
+    HTTPClient http;
+    String apiKey;
+    String authorization;
+    String url;            // reserved once, rewritten in place per request
+    unsigned int baseLength;
+    char body[SUPABASE_BODY_LENGTH];
+    size_t bodyLength;
+    HttpBodyStream response;
+    bool streaming;        // response is being read through getBody()
+    Stats stats;
+    bool inRequest;
+    RequestObserver observer;
+
+    // HTTPClient errors raised before the request reached the server
+    static bool notSent(int code) {
+        return code == HTTPC_ERROR_CONNECTION_REFUSED || code == HTTPC_ERROR_SEND_HEADER_FAILED ||
+               code == HTTPC_ERROR_SEND_PAYLOAD_FAILED || code == HTTPC_ERROR_NOT_CONNECTED;
+    }
+
+    int sendOnce(const char* method, const char* prefer, bool& reuse) {
+        reuse = client.connected();
+        unsigned long start = millis();
+
+        http.begin(client, url);
+        http.addHeader("Content-Type", "application/json");
+        http.addHeader("apikey", apiKey);
+        http.addHeader("Authorization", authorization);
+        http.addHeader("Connection", "keep-alive");
+        if (prefer) {
+            http.addHeader("Prefer", prefer);
+        }
+
+        int code = http.sendRequest(method, (uint8_t*)body, bodyLength);
+
+        stats.requests++;
+        stats.lastRoundTripMs = millis() - start;
+        if (reuse) {
+            stats.reused++;
+        } else if (code > 0) {
+            stats.handshakes++;
+            stats.lastHandshakeMs = stats.lastRoundTripMs;
+        }
+        if (observer) {
+            observer(stats.lastRoundTripMs, !reuse, code);
+        }
+
+        return code;
+    }
+
+public:
+    SupabaseSession(const char* projectUrl, const char* apiKey, const char* token)
+        : apiKey(apiKey), authorization(String("Bearer ") + token) {
+        url.reserve(SUPABASE_URL_LENGTH);
+        url = projectUrl;
+        baseLength = url.length();
+        body[0] = '\0';
+        bodyLength = 0;
+        stats = Stats();
+        streaming = false;
+        inRequest = false;
+        observer = nullptr;
+    }
+
+    void setObserver(RequestObserver fn) {
+        observer = fn;
+    }
+
+    // Call once WiFi is up
+    void begin() {
+        // Skip SSL certificate verification (for development only)
+        client.setInsecure();
+        http.setReuse(true);
+        http.useHTTP10(false);
+        http.setTimeout(SUPABASE_HTTP_TIMEOUT);
+
+        // Needed to frame bodies read through getBody()
+        static const char* headerKeys[] = {"Transfer-Encoding"};
+        http.collectHeaders(headerKeys, 1);
+    }
+
+    // Send a request and leave the response open for getString() or
+    // getBody(). Every send() must be followed by end().
+    // The body is whatever was last placed by setBody(), empty otherwise.
+    int send(const char* method, const char* path, const char* prefer = nullptr) {
+        if (inRequest) {
+            end();
+        }
+        inRequest = true;
+
+        // Keep the project URL prefix and replace only the path
+        url.remove(baseLength);
+        url.concat(path);
+
+        bool reused;
+        int code = sendOnce(method, prefer, reused);
+
+        // The server closed the kept-alive connection, retry on a new one
+        // unless the request may already have run
+        if (code < 0 && reused && (strcmp(method, "GET") == 0 || notSent(code))) {
+            stats.retries++;
+            http.end();
+            client.stop();
+            code = sendOnce(method, prefer, reused);
+        }
+
+        if (code < 0) {
+            stats.failures++;
+            client.stop();
+        }
+        bodyLength = 0;
+        return code;
+    }
+
+    // Serialize doc into the body buffer. Returns false if it does not fit.
+    bool setBody(const JsonDocument& doc) {
+        if (measureJson(doc) >= sizeof(body)) {
+            bodyLength = 0;
+            return false;
+        }
+        bodyLength = serializeJson(doc, body, sizeof(body));
+        return true;
+    }
+
+    int get(const char* path) {
+        return send("GET", path);
+    }
+
+    // Writes complete the request themselves since the bodies are not needed
+    int patch(const char* path, const JsonDocument& doc, const char* prefer = "return=minimal") {
+        if (!setBody(doc)) return SUPABASE_BODY_TOO_LARGE;
+        int code = send("PATCH", path, prefer);
+        end();
+        return code;
+    }
+
+    int post(const char* path, const JsonDocument& doc, const char* prefer = "return=minimal") {
+        if (!setBody(doc)) return SUPABASE_BODY_TOO_LARGE;
+        int code = send("POST", path, prefer);
+        end();
+        return code;
+    }
+
+    String getString() {
+        return http.getString();
+    }
+
+    // The response body as a stream read directly from the socket. end()
+    // discards whatever the caller leaves unread.
+    Stream& getBody() {
+        HttpBodyStream::Framing framing = HttpBodyStream::CONTENT_LENGTH;
+        int size = http.getSize();
+        if (http.header("Transfer-Encoding").equalsIgnoreCase("chunked")) {
+            framing = HttpBodyStream::CHUNKED;
+        } else if (size < 0) {
+            framing = HttpBodyStream::UNTIL_CLOSE;
+        }
+        response.begin(http.getStream(), framing, size, SUPABASE_HTTP_TIMEOUT);
+        streaming = true;
+        return response;
+    }
+
+    // Finish the current response but keep the connection open
+    void end() {
+        if (!inRequest) return;
+        if (streaming) {
+            response.drain();
+            streaming = false;
+        }
+        http.end();
+        inRequest = false;
+    }
+
+    // Drop the connection, e.g. when WiFi goes down
+    void close() {
+        end();
+        client.stop();
+    }
+
+    bool isConnected() {
+        return client.connected();
+    }
+
+    const Stats& getStats() const {
+        return stats;
+    }
+};
+
+#endif // SUPABASE_SESSION_H
@@ -0,0 +1,295 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <stdint.h>
+#include <functional>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#define MAX_SCHEDULED_TASKS 16
+#define SCHEDULER_IDLE_WAIT 0xFFFFFFFFUL
+
+// Deadline-ordered cooperative scheduler for loop(). Periodic jobs sit in a
+// min-heap keyed by deadline; runDue() runs every job that is due, highest
+// priority first, and msUntilNext() tells loop() how long it may sleep.
+//
+// A job's jitter is how late it may run, which lets the scheduler coalesce
+// nearby deadlines into one wakeup. Starting past that window counts as an
+// overrun. The clock is injectable so the scheduler runs on a virtual clock
+// off-device.
+class TaskScheduler {
+public:
+    typedef std::function<void()> TaskFn;
+    typedef unsigned long (*ClockFn)();
+    // Told the duration of every run in microseconds, e.g. by a profiler
+    typedef void (*RunObserver)(const char* name, unsigned long runUs);
+
+    struct TaskStats {
+        const char* name;
+        unsigned long periodMs;
+        unsigned long jitterMs;
+        uint8_t priority;
+        uint32_t runs;
+        uint32_t overruns;        // started after deadline + jitter
+        unsigned long maxLateMs;  // worst start delay past the deadline
+        unsigned long maxRunMs;   // longest execution time
+    };
+
+private:
+    struct Task {
+        TaskFn fn;
+        TaskStats stats;
+        unsigned long deadline;
+        bool enabled;
+        bool queued;    // currently in the heap
+    };
+
+    Task tasks[MAX_SCHEDULED_TASKS];
+    uint8_t heap[MAX_SCHEDULED_TASKS]; // task ids ordered by deadline
+    uint8_t heapSize;
+    uint8_t taskCount;
+    ClockFn clock;
+    RunObserver observer;
+    ClockFn usClock;
+
+    // Wraparound-safe "a is before b" for millis() timestamps
+    static bool before(unsigned long a, unsigned long b) {
+        return (long)(a - b) < 0;
+    }
+
+    bool heapLess(uint8_t a, uint8_t b) const {
+        const Task& ta = tasks[heap[a]];
+        const Task& tb = tasks[heap[b]];
+        if (ta.deadline != tb.deadline) return before(ta.deadline, tb.deadline);
+        return ta.stats.priority > tb.stats.priority;
+    }
+
+    void heapSwap(uint8_t a, uint8_t b) {
+        uint8_t tmp = heap[a];
+        heap[a] = heap[b];
+        heap[b] = tmp;
+    }
+
+    void siftUp(uint8_t i) {
+        while (i > 0) {
+            uint8_t parent = (i - 1) / 2;
+            if (!heapLess(i, parent)) break;
+            heapSwap(i, parent);
+            i = parent;
+        }
+    }
+
+    void siftDown(uint8_t i) {
+        while (true) {
+            uint8_t left = 2 * i + 1;
+            uint8_t right = left + 1;
+            uint8_t smallest = i;
+            if (left < heapSize && heapLess(left, smallest)) smallest = left;
+            if (right < heapSize && heapLess(right, smallest)) smallest = right;
+            if (smallest == i) break;
+            heapSwap(i, smallest);
+            i = smallest;
+        }
+    }
+
+    void heapPush(uint8_t id) {
+        if (tasks[id].queued) return;
+        tasks[id].queued = true;
+        heap[heapSize] = id;
+        siftUp(heapSize++);
+    }
+
+    uint8_t heapPop() {
+        uint8_t top = heap[0];
+        tasks[top].queued = false;
+        heap[0] = heap[--heapSize];
+        siftDown(0);
+        return top;
+    }
+
+    void heapRemove(uint8_t id) {
+        for (uint8_t i = 0; i < heapSize; i++) {
+            if (heap[i] == id) {
+                tasks[id].queued = false;
+                heap[i] = heap[--heapSize];
+                if (i < heapSize) {
+                    siftDown(i);
+                    siftUp(i);
+                }
+                return;
+            }
+        }
+    }
+
+    unsigned long now() const {
+        return clock ? clock() : 0;
+    }
+
+public:
+    TaskScheduler() {
+        heapSize = 0;
+        taskCount = 0;
+        observer = nullptr;
+#ifdef ARDUINO
+        clock = millis;
+        usClock = micros;
+#else
+        clock = nullptr;
+        usClock = nullptr;
+#endif
+    }
+
+    // Replace the time source, e.g. with a virtual clock for host builds
+    void setClock(ClockFn fn) {
+        clock = fn;
+    }
+
+    // Report each run to fn, timed with a microsecond clock (micros() on
+    // the device). nullptr turns it off.
+    void setObserver(RunObserver fn, ClockFn microClock = nullptr) {
+        observer = fn;
+        if (microClock) usClock = microClock;
+    }
+
+    // Register a periodic job. Returns the task id, or -1 if the table is full.
+    int addTask(const char* name, unsigned long periodMs, TaskFn fn,
+                uint8_t priority = 0, unsigned long jitterMs = 0, unsigned long firstRunMs = 0) {
+        if (taskCount >= MAX_SCHEDULED_TASKS) return -1;
+
+        uint8_t id = taskCount++;
+        Task& task = tasks[id];
+        task.fn = fn;
+        task.stats = TaskStats();
+        task.stats.name = name;
+        task.stats.periodMs = periodMs;
+        task.stats.jitterMs = jitterMs;
+        task.stats.priority = priority;
+        task.deadline = now() + firstRunMs;
+        task.enabled = true;
+        task.queued = false;
+        heapPush(id);
+        return id;
+    }
+
+    // Run every due task, highest priority first. Returns the number run.
+    int runDue() {
+        unsigned long start = now();
+        uint8_t due[MAX_SCHEDULED_TASKS];
+        uint8_t dueCount = 0;
+
+        while (heapSize > 0 && !before(start, tasks[heap[0]].deadline)) {
+            uint8_t id = heapPop();
+            // Insertion sort by priority keeps deadline order among equals
+            uint8_t pos = dueCount++;
+            while (pos > 0 && tasks[due[pos - 1]].stats.priority < tasks[id].stats.priority) {
+                due[pos] = due[pos - 1];
+                pos--;
+            }
+            due[pos] = id;
+        }
+
+        int ran = 0;
+        for (uint8_t i = 0; i < dueCount; i++) {
+            Task& task = tasks[due[i]];
+
+            // An earlier job in the batch disabled it, or triggered it
+            // again: it runs on the new deadline, not now
+            if (!task.enabled) continue;
+            if (task.queued) {
+                if (before(now(), task.deadline)) continue;
+                heapRemove(due[i]);
+            }
+
+            unsigned long startedAt = now();
+            unsigned long late = startedAt - task.deadline;
+
+            if (late > task.stats.jitterMs) task.stats.overruns++;
+            if (late > task.stats.maxLateMs) task.stats.maxLateMs = late;
+
+            bool observed = observer && usClock;
+            unsigned long startedUs = observed ? usClock() : 0;
+
+            task.fn();
+
+            if (observed) observer(task.stats.name, usClock() - startedUs);
+            unsigned long finishedAt = now();
+            unsigned long runMs = finishedAt - startedAt;
+            if (runMs > task.stats.maxRunMs) task.stats.maxRunMs = runMs;
+            task.stats.runs++;
+            ran++;
+
+            // Rescheduled by trigger() while running
+            if (task.queued) continue;
+
+            // Fixed-rate: keep the phase unless we fell a whole period behind
+            task.deadline += task.stats.periodMs;
+            if (!before(finishedAt, task.deadline)) {
+                task.deadline = finishedAt + task.stats.periodMs;
+            }
+            if (task.enabled) heapPush(due[i]);
+        }
+
+        return ran;
+    }
+
+    // Milliseconds loop() may sleep before the next job must run. Each job
+    // may run up to its jitter late, so this waits for the earliest window end.
+    unsigned long msUntilNext() const {
+        if (heapSize == 0) return SCHEDULER_IDLE_WAIT;
+
+        unsigned long t = now();
+        unsigned long wake = tasks[heap[0]].deadline + tasks[heap[0]].stats.jitterMs;
+        for (uint8_t i = 1; i < heapSize; i++) {
+            const Task& task = tasks[heap[i]];
+            // Deadlines past the current wake time cannot pull it earlier
+            if (!before(task.deadline, wake)) continue;
+            unsigned long end = task.deadline + task.stats.jitterMs;
+            if (before(end, wake)) wake = end;
+        }
+
+        long remaining = (long)(wake - t);
+        return remaining > 0 ? (unsigned long)remaining : 0;
+    }
+
+    // Run a task after delayMs instead of waiting for its next period
+    void trigger(int id, unsigned long delayMs = 0) {
+        if (id < 0 || id >= taskCount || !tasks[id].enabled) return;
+        heapRemove(id);
+        tasks[id].deadline = now() + delayMs;
+        heapPush(id);
+    }
+
+    void setEnabled(int id, bool enabled) {
+        if (id < 0 || id >= taskCount || tasks[id].enabled == enabled) return;
+        tasks[id].enabled = enabled;
+        if (enabled) {
+            tasks[id].deadline = now();
+            heapPush(id);
+        } else {
+            heapRemove(id);
+        }
+    }
+
+    void setPeriod(int id, unsigned long periodMs) {
+        if (id < 0 || id >= taskCount) return;
+        tasks[id].stats.periodMs = periodMs;
+    }
+
+    const TaskStats* getStats(int id) const {
+        if (id < 0 || id >= taskCount) return nullptr;
+        return &tasks[id].stats;
+    }
+
+    uint32_t getOverruns(int id) const {
+        const TaskStats* stats = getStats(id);
+        return stats ? stats->overruns : 0;
+    }
+
+    uint8_t getTaskCount() const {
+        return taskCount;
+    }
+};
+
+#endif // TASK_SCHEDULER_H
@@ -0,0 +1,175 @@
+#ifndef TELEMETRY_AGGREGATOR_H
+#define TELEMETRY_AGGREGATOR_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <time.h>
+
+#define TELEMETRY_HEARTBEAT_INTERVAL 300000 // 5 minutes
+#define TELEMETRY_RETRY_INTERVAL 10000      // after a failed upload
+#define FOOD_LEVEL_DEADBAND 3               // percent
+#define BATTERY_LEVEL_DEADBAND 2            // percent
+#define RSSI_DEADBAND 8                     // dBm
+
+// Collects the device row (food level, battery, RSSI, IP and last_seen)
+// and decides when it is worth uploading. A flush is due only when a field
+// has moved past its deadband since the last upload or the heartbeat
+// interval has expired, so one PATCH replaces the per-field updates.
+class TelemetryAggregator {
+public:
+    struct Deadband {
+        int foodLevel;
+        int batteryLevel;
+        int rssi;
+    };
+
+    struct Stats {
+        uint32_t samples;      // field updates received
+        uint32_t flushes;      // uploads that succeeded
+        uint32_t failures;     // uploads that failed
+        uint32_t heartbeats;   // flushes caused only by the heartbeat
+    };
+
+    typedef unsigned long (*ClockFn)();
+
+private:
+    struct Row {
+        int foodLevel;
+        int batteryLevel;
+        int rssi;
+        String ipAddress;
+    };
+
+    Row current;
+    Row sent;
+    bool hasSent;
+    bool forced;
+    Deadband deadband;
+    unsigned long heartbeatMs;
+    unsigned long lastFlush;
+    unsigned long retryAt;
+    bool retryPending;
+    Stats stats;
+    ClockFn clock;
+
+    static bool moved(int now, int last, int band) {
+        return now >= 0 && abs(now - last) >= band;
+    }
+
+    bool changed() const {
+        if (!hasSent) return true;
+        return moved(current.foodLevel, sent.foodLevel, deadband.foodLevel) ||
+               moved(current.batteryLevel, sent.batteryLevel, deadband.batteryLevel) ||
+               (current.rssi != 0 && abs(current.rssi - sent.rssi) >= deadband.rssi) ||
+               current.ipAddress != sent.ipAddress;
+    }
+
+public:
+    TelemetryAggregator(unsigned long heartbeatMs = TELEMETRY_HEARTBEAT_INTERVAL)
+        : heartbeatMs(heartbeatMs) {
+        current.foodLevel = -1;
+        current.batteryLevel = -1;
+        current.rssi = 0;
+        sent = current;
+        hasSent = false;
+        forced = false;
+        deadband.foodLevel = FOOD_LEVEL_DEADBAND;
+        deadband.batteryLevel = BATTERY_LEVEL_DEADBAND;
+        deadband.rssi = RSSI_DEADBAND;
+        lastFlush = 0;
+        retryAt = 0;
+        retryPending = false;
+        stats = Stats();
+        clock = millis;
+    }
+
+    // Replace the time source, e.g. with a VirtualClock
+    void setClock(ClockFn fn) {
+        clock = fn;
+    }
+
+    void setDeadband(const Deadband& band) {
+        deadband = band;
+    }
+
+    void setHeartbeat(unsigned long ms) {
+        heartbeatMs = ms;
+    }
+
+    void setFoodLevel(int level) {
+        current.foodLevel = level;
+        stats.samples++;
+    }
+
+    void setBatteryLevel(int level) {
+        current.batteryLevel = level;
+        stats.samples++;
+    }
+
+    void setRssi(int rssi) {
+        current.rssi = rssi;
+        stats.samples++;
+    }
+
+    void setIpAddress(const String& ip) {
+        current.ipAddress = ip;
+        stats.samples++;
+    }
+
+    // Upload on the next check regardless of deadbands
+    void requestFlush() {
+        forced = true;
+    }
+
+    bool shouldFlush() const {
+        unsigned long now = clock();
+        if (retryPending && (long)(now - retryAt) < 0) return false;
+        if (forced || retryPending) return true;
+        return changed() || now - lastFlush >= heartbeatMs;
+    }
+
+    // Time until the heartbeat forces an upload, 0 if one is due
+    unsigned long msUntilHeartbeat() const {
+        unsigned long elapsed = clock() - lastFlush;
+        if (forced || !hasSent || elapsed >= heartbeatMs) return 0;
+        return heartbeatMs - elapsed;
+    }
+
+    // Fill doc with the full row image for a PATCH on the devices table
+    void buildPayload(JsonDocument& doc) const {
+        time_t now;
+        time(&now);
+
+        doc["status"] = "online";
+        doc["last_seen"] = now;
+        if (current.foodLevel >= 0) doc["food_level"] = current.foodLevel;
+        if (current.batteryLevel >= 0) doc["battery_level"] = current.batteryLevel;
+        if (current.rssi != 0) doc["wifi_strength"] = current.rssi;
+        if (current.ipAddress.length() > 0) doc["ip_address"] = current.ipAddress;
+    }
+
+    // Record the outcome of an upload built from buildPayload()
+    void flushed(bool success) {
+        unsigned long now = clock();
+        if (!success) {
+            stats.failures++;
+            retryPending = true;
+            retryAt = now + TELEMETRY_RETRY_INTERVAL;
+            return;
+        }
+
+        if (hasSent && !forced && !changed()) stats.heartbeats++;
+        stats.flushes++;
+        sent = current;
+        hasSent = true;
+        forced = false;
+        retryPending = false;
+        lastFlush = now;
+    }
+
+    const Stats& getStats() const {
+        return stats;
+    }
+};
+
+#endif // TELEMETRY_AGGREGATOR_H
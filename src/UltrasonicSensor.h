@@ -0,0 +1,173 @@
+#ifndef ULTRASONIC_SENSOR_H
+#define ULTRASONIC_SENSOR_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <driver/gpio.h>
+#include <esp_timer.h>
+
+#define ULTRASONIC_SAMPLE_INTERVAL 60 // ms between pings, lets echoes die out
+#define ULTRASONIC_ECHO_TIMEOUT 25000 // us, about 4 m round trip
+#define ULTRASONIC_MEDIAN_WINDOW 5
+#define ULTRASONIC_EMA_SHIFT 2        // each sample moves the average by 1/4
+
+// HC-SR04 style sensor sampled in the background. A periodic esp_timer
+// fires the trigger pulse and an edge interrupt on the echo pin timestamps
+// the pulse, so nothing waits on pulseIn(). Each ping is passed through a
+// median filter to drop outliers and an exponential moving average to
+// smooth the rest. The result is published through an atomic, so reading
+// it is constant time and safe from any task.
+class UltrasonicSensor {
+public:
+    struct Stats {
+        uint32_t samples;    // echoes received
+        uint32_t timeouts;   // pings with no echo in time
+    };
+
+private:
+    uint8_t trigPin;
+    uint8_t echoPin;
+    esp_timer_handle_t timer;
+
+    // Written by the echo interrupt
+    volatile int64_t echoStart;
+    volatile uint32_t echoWidth;
+    volatile bool echoReady;
+
+    // Filter state, owned by the timer callback
+    uint16_t window[ULTRASONIC_MEDIAN_WINDOW];
+    uint8_t windowCount;
+    uint8_t windowPos;
+    int32_t average;     // mm << ULTRASONIC_EMA_SHIFT, -1 before the first sample
+    bool pinging;
+
+    std::atomic<int32_t> latestMm;
+    std::atomic<uint32_t> samples;
+    std::atomic<uint32_t> timeouts;
+
+    static void IRAM_ATTR onEcho(void* arg) {
+        UltrasonicSensor* sensor = (UltrasonicSensor*)arg;
+        int64_t now = esp_timer_get_time();
+        if (gpio_get_level((gpio_num_t)sensor->echoPin)) {
+            sensor->echoStart = now;
+        } else if (sensor->echoStart != 0) {
+            sensor->echoWidth = now - sensor->echoStart;
+            sensor->echoStart = 0;
+            sensor->echoReady = true;
+        }
+    }
+
+    static void onTimer(void* arg) {
+        ((UltrasonicSensor*)arg)->tick();
+    }
+
+    // Collect the echo from the previous ping, then send the next one
+    void tick() {
+        if (echoReady) {
+            echoReady = false;
+            addEchoSample(echoWidth);
+        } else if (pinging) {
+            timeouts++;
+        }
+
+        echoStart = 0;
+        digitalWrite(trigPin, HIGH);
+        delayMicroseconds(10);
+        digitalWrite(trigPin, LOW);
+        pinging = true;
+    }
+
+    uint16_t median() const {
+        uint16_t sorted[ULTRASONIC_MEDIAN_WINDOW];
+        for (uint8_t i = 0; i < windowCount; i++) {
+            uint16_t value = window[i];
+            uint8_t pos = i;
+            while (pos > 0 && sorted[pos - 1] > value) {
+                sorted[pos] = sorted[pos - 1];
+                pos--;
+            }
+            sorted[pos] = value;
+        }
+        return sorted[windowCount / 2];
+    }
+
+public:
+    UltrasonicSensor(uint8_t trigPin, uint8_t echoPin) {
+        this->trigPin = trigPin;
+        this->echoPin = echoPin;
+        timer = nullptr;
+        echoStart = 0;
+        echoWidth = 0;
+        echoReady = false;
+        windowCount = 0;
+        windowPos = 0;
+        average = -1;
+        pinging = false;
+        latestMm = -1;
+        samples = 0;
+        timeouts = 0;
+    }
+
+    // Configure the pins and start pinging every intervalMs
+    bool begin(unsigned long intervalMs = ULTRASONIC_SAMPLE_INTERVAL) {
+        pinMode(trigPin, OUTPUT);
+        digitalWrite(trigPin, LOW);
+        pinMode(echoPin, INPUT);
+        attachInterruptArg(echoPin, onEcho, this, CHANGE);
+
+        esp_timer_create_args_t args = {};
+        args.callback = onTimer;
+        args.arg = this;
+        args.name = "ultrasonic";
+        if (esp_timer_create(&args, &timer) != ESP_OK) {
+            Serial.println("Ultrasonic: timer create failed");
+            return false;
+        }
+        return esp_timer_start_periodic(timer, (uint64_t)intervalMs * 1000) == ESP_OK;
+    }
+
+    void stop() {
+        if (timer) esp_timer_stop(timer);
+        detachInterrupt(echoPin);
+        pinging = false;
+    }
+
+    // Feed one echo pulse width through the filters. Called from the timer
+    // callback, and directly when testing the filter off-device.
+    void addEchoSample(uint32_t widthUs) {
+        if (widthUs == 0 || widthUs > ULTRASONIC_ECHO_TIMEOUT) {
+            timeouts++;
+            return;
+        }
+        samples++;
+
+        // Sound travels about 0.343 mm/us, halved for the round trip
+        uint16_t distanceMm = widthUs * 343 / 2000;
+
+        window[windowPos] = distanceMm;
+        windowPos = (windowPos + 1) % ULTRASONIC_MEDIAN_WINDOW;
+        if (windowCount < ULTRASONIC_MEDIAN_WINDOW) windowCount++;
+
+        int32_t value = (int32_t)median() << ULTRASONIC_EMA_SHIFT;
+        if (average < 0) {
+            average = value;
+        } else {
+            average += (value - average) >> ULTRASONIC_EMA_SHIFT;
+        }
+        latestMm.store(average >> ULTRASONIC_EMA_SHIFT, std::memory_order_relaxed);
+    }
+
+    // Filtered distance in mm, -1 until the first echo
+    int32_t distanceMm() const {
+        return latestMm.load(std::memory_order_relaxed);
+    }
+
+    Stats getStats() const {
+        Stats stats;
+        stats.samples = samples.load(std::memory_order_relaxed);
+        stats.timeouts = timeouts.load(std::memory_order_relaxed);
+        return stats;
+    }
+};
+
+#endif // ULTRASONIC_SENSOR_H
@@ -0,0 +1,60 @@
+#ifndef VIRTUAL_CLOCK_H
+#define VIRTUAL_CLOCK_H
+
+#include <stdint.h>
+#include <atomic>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+// Simulated millisecond clock for driving the timing logic without real
+// waits. Time only moves when advance() is called, or with a speed set,
+// with real time multiplied by it, so a scripted day of schedules and
+// dispenses runs in seconds and the same way every time.
+//
+// now() has the ClockFn signature taken by setClock() on TaskScheduler,
+// Dispenser and TelemetryAggregator. There is one clock per program, so
+// everything plugged into it sees the same time.
+class VirtualClock {
+    static inline std::atomic<unsigned long> baseMs{0};   // virtual time at realStart
+    static inline std::atomic<unsigned long> realStart{0};
+    static inline std::atomic<uint32_t> speed{0};         // 0 moves only on advance()
+
+    static unsigned long realMs() {
+#ifdef ARDUINO
+        return millis();
+#else
+        using namespace std::chrono;
+        return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+public:
+    static unsigned long now() {
+        uint32_t factor = speed;
+        if (factor == 0) return baseMs;
+        return baseMs + (realMs() - realStart) * factor;
+    }
+
+    // Jump ahead, e.g. straight to the next deadline a scheduler reports
+    static void advance(unsigned long ms) {
+        baseMs += ms;
+    }
+
+    // Also let time run at factor times real time, 0 to stop it
+    static void setSpeed(uint32_t factor) {
+        baseMs = now();
+        realStart = realMs();
+        speed = factor;
+    }
+
+    static void reset(unsigned long ms = 0) {
+        speed = 0;
+        baseMs = ms;
+    }
+};
+
+#endif // VIRTUAL_CLOCK_H
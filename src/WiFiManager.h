@@ -3,16 +3,68 @@
 
 #include <WiFi.h>
 #include <DNSServer.h>
-#include <WebServer.h>
+#include <ESPAsyncWebServer.h>
+#include <atomic>
 #include <EEPROM.h>
 #include <ArduinoJson.h>
-
-#define EEPROM_SIZE 512
+#include "WiFiScanCache.h"
+#include "JsonStreamWriter.h"
+#include "PortalAssets.h"
+#include "ConfigStore.h"
+
+#define EEPROM_SIZE 512          // legacy settings area, read once to migrate
+#define WIFI_CONFIG_NAMESPACE "wifi"
+#define WIFI_CONFIG_VERSION 1
 #define MAX_NETWORKS 5
 #define CHECK_INTERVAL 30000 // 30 seconds
 #define MAX_RETRIES 3
-
+#define CONNECT_ATTEMPT_TIMEOUT 10000 // ms per network before trying the next
+#define FAST_CONNECT_TIMEOUT 3000     // ms to rejoin the last access point
+#define CONNECT_SETTLE_MS 500         // ignore disconnects left over from the previous attempt
+#define ROAM_CHECK_INTERVAL 60000     // how often a weak link looks for a better AP
+#define ROAM_RSSI_THRESHOLD -75       // dBm below which the link counts as weak
+#define ROAM_HYSTERESIS 8             // dB a visible AP must beat the current one by
+#define SCORE_PRIORITY_WEIGHT 10      // score per priority step
+#define SCORE_UNSEEN_RSSI -95         // dBm assumed for networks missing from the scan
+#define PORTAL_SCAN_INTERVAL 60000    // scan refresh while the setup portal is open
+#define DNS_PORT 53
+
+// Stored networks are joined by a non-blocking state machine driven by
+// WiFi events. update() tries each enabled network in order of score with
+// a timeout per attempt, starting with a directed join of the last access
+// point that worked (its BSSID and channel are cached so no scan is
+// needed). Callers check getState(), or compare getGeneration(), which
+// changes on every connect and disconnect, to notice reconnects.
+//
+// A network's score combines its user priority, the strongest signal for
+// its SSID in the scan cache and how often joining it has failed recently.
+// While the link is weak, passive background scans look for a known AP
+// that is clearly stronger and the device roams to it without waiting for
+// the link to drop.
 class WiFiManager {
+public:
+    enum State {
+        IDLE,
+        CONNECTING,
+        CONNECTED,
+        FAILED        // every network tried, retried after CHECK_INTERVAL
+    };
+
+    struct NetworkScore {
+        int network;          // index in the stored networks, -1 if none
+        int score;
+        int rssi;             // from the scan cache, SCORE_UNSEEN_RSSI if not seen
+        uint8_t failureRate;  // percent, decaying average of join attempts
+    };
+
+    struct Stats {
+        uint32_t roams;
+        uint32_t roamFailures;
+        int roamFromRssi;     // signal before and after the last roam
+        int roamToRssi;
+        NetworkScore chosen;  // network of the current or last connection
+    };
+
 private:
     struct NetworkConfig {
         char ssid[32];
@@ -29,194 +81,551 @@ private:
         uint8_t maxConnections;
     };
 
+    struct AccessPoint {
+        int network;
+        uint8_t bssid[6];
+        uint8_t channel;
+        bool valid;
+    };
+
     NetworkConfig networks[MAX_NETWORKS];
     HotspotConfig hotspotConfig;
-    WebServer* server;
+    ConfigStore config;
+    bool configLoaded;
+    AsyncWebServer* server;
     DNSServer* dnsServer;
     unsigned long lastCheck;
     bool isHotspotActive;
     int connectionRetries;
 
-    // EEPROM management
-    void saveConfig() {
-        EEPROM.put(0, networks);
-        EEPROM.put(sizeof(networks), hotspotConfig);
-        EEPROM.commit();
+    // Connection state machine, owned by update()
+    State state;
+    uint32_t generation;
+    uint8_t candidates[MAX_NETWORKS];  // network indexes by score
+    NetworkScore candidateScores[MAX_NETWORKS];
+    uint8_t candidateCount;
+    int attempt;                       // index into candidates, -1 for the directed join
+    unsigned long attemptStart;
+    unsigned long attemptTimeout;
+    AccessPoint lastAccessPoint;
+    AccessPoint target;                // access point for the directed join
+    bool roaming;
+    bool eventsRegistered;
+
+    // Portal requests are handled on the async TCP task and handed to
+    // update() through these
+    NetworkConfig pendingNetwork;
+    HotspotConfig pendingHotspot;
+    std::atomic<bool> networkPending;
+    std::atomic<bool> hotspotPending;
+    std::atomic<bool> scanRequested;
+
+    // Selection and roaming
+    WiFiScanCache scanCache;
+    uint8_t failureRate[MAX_NETWORKS];
+    unsigned long lastRoamCheck;
+    Stats stats;
+
+    // Set from the WiFi event task, consumed by update()
+    volatile bool linkUp;
+    volatile bool linkDown;
+    volatile uint8_t linkChannel;
+    uint8_t linkBssid[6];
+
+    void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info) {
+        switch (event) {
+            case ARDUINO_EVENT_WIFI_STA_CONNECTED:
+                memcpy(linkBssid, info.wifi_sta_connected.bssid, sizeof(linkBssid));
+                linkChannel = info.wifi_sta_connected.channel;
+                break;
+            case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+                linkUp = true;
+                break;
+            case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+                linkDown = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    int attemptNetwork() const {
+        return attempt < 0 ? target.network : candidates[attempt];
+    }
+
+    NetworkScore scoreNetwork(int i) const {
+        NetworkScore result;
+        const WiFiScanCache::Entry* seen = scanCache.strongest(networks[i].ssid);
+        result.network = i;
+        result.rssi = seen ? seen->rssi : SCORE_UNSEEN_RSSI;
+        result.failureRate = failureRate[i];
+        result.score = networks[i].priority * SCORE_PRIORITY_WEIGHT + (result.rssi + 100) -
+                       failureRate[i] / 2;
+        return result;
+    }
+
+    void recordAttempt(int network, bool success) {
+        if (success) {
+            failureRate[network] -= failureRate[network] / 4;
+        } else {
+            failureRate[network] += (100 - failureRate[network]) / 4;
+        }
+    }
+
+    // Join the directed target, else the candidate's strongest visible AP,
+    // else let the driver scan for the SSID
+    void startAttempt(unsigned long now) {
+        const NetworkConfig& network = networks[attemptNetwork()];
+        linkDown = false;
+        if (attempt < 0) {
+            WiFi.begin(network.ssid, network.password, target.channel, target.bssid);
+            attemptTimeout = FAST_CONNECT_TIMEOUT;
+        } else {
+            const WiFiScanCache::Entry* seen = scanCache.strongest(network.ssid);
+            if (seen) {
+                WiFi.begin(network.ssid, network.password, seen->channel, seen->bssid);
+            } else {
+                WiFi.begin(network.ssid, network.password);
+            }
+            attemptTimeout = CONNECT_ATTEMPT_TIMEOUT;
+        }
+        attemptStart = now;
+    }
+
+    void nextAttempt(unsigned long now) {
+        recordAttempt(attemptNetwork(), false);
+        if (attempt < 0 && roaming) {
+            stats.roamFailures++;
+            roaming = false;
+        }
+        attempt++;
+        if (attempt < candidateCount) {
+            startAttempt(now);
+        } else {
+            roundFailed(now);
+        }
+    }
+
+    void roundFailed(unsigned long now) {
+        state = FAILED;
+        lastCheck = now;
+        connectionRetries++;
+
+        // Open the portal straight away if nothing has connected since boot
+        if ((connectionRetries >= MAX_RETRIES || generation == 0) && !isHotspotActive) {
+            startHotspot();
+        }
+    }
+
+    // Rank the enabled networks and start trying them, with the directed
+    // target first if there is one
+    void startRound() {
+        candidateCount = 0;
+        for (int i = 0; i < MAX_NETWORKS; i++) {
+            if (!networks[i].enabled) continue;
+            NetworkScore score = scoreNetwork(i);
+            uint8_t pos = candidateCount++;
+            while (pos > 0 && candidateScores[pos - 1].score < score.score) {
+                candidates[pos] = candidates[pos - 1];
+                candidateScores[pos] = candidateScores[pos - 1];
+                pos--;
+            }
+            candidates[pos] = i;
+            candidateScores[pos] = score;
+        }
+
+        unsigned long now = millis();
+        if (target.valid && !networks[target.network].enabled) {
+            target.valid = false;
+        }
+        if (candidateCount == 0) {
+            roundFailed(now);
+            return;
+        }
+
+        if (state == CONNECTED) generation++;
+        state = CONNECTING;
+        attempt = target.valid ? -1 : 0;
+        startAttempt(now);
     }
 
+    // Move to a known AP that is clearly stronger than the current one
+    void considerRoaming() {
+        int currentRssi = WiFi.RSSI();
+        if (currentRssi >= ROAM_RSSI_THRESHOLD) return;
+
+        const uint8_t* currentBssid = WiFi.BSSID();
+        const WiFiScanCache::Entry* best = nullptr;
+        int bestNetwork = -1;
+        for (int i = 0; i < MAX_NETWORKS; i++) {
+            if (!networks[i].enabled) continue;
+            const WiFiScanCache::Entry* seen = scanCache.strongest(networks[i].ssid);
+            if (!seen || (currentBssid && memcmp(seen->bssid, currentBssid, 6) == 0)) continue;
+            if (seen->rssi < currentRssi + ROAM_HYSTERESIS) continue;
+            if (!best || seen->rssi > best->rssi) {
+                best = seen;
+                bestNetwork = i;
+            }
+        }
+        if (!best) return;
+
+        stats.roamFromRssi = currentRssi;
+        target.network = bestNetwork;
+        memcpy(target.bssid, best->bssid, sizeof(target.bssid));
+        target.channel = best->channel;
+        target.valid = true;
+        roaming = true;
+        startRound();
+    }
+
+    void connected() {
+        if (state == CONNECTING) {
+            int network = attemptNetwork();
+            recordAttempt(network, true);
+            lastAccessPoint.network = network;
+            memcpy(lastAccessPoint.bssid, linkBssid, sizeof(linkBssid));
+            lastAccessPoint.channel = linkChannel;
+            lastAccessPoint.valid = true;
+            stats.chosen = scoreNetwork(network);
+            stats.chosen.rssi = WiFi.RSSI();
+
+            if (roaming) {
+                stats.roams++;
+                stats.roamToRssi = stats.chosen.rssi;
+                roaming = false;
+            }
+        }
+        lastRoamCheck = millis();
+        state = CONNECTED;
+        generation++;
+        connectionRetries = 0;
+        if (isHotspotActive) {
+            stopHotspot();
+        }
+    }
+
+    // Settings are one record per network plus one for the hotspot, so
+    // a change only rewrites its own record
+    static void networkKey(int slot, char* key) {
+        snprintf(key, 8, "net%d", slot);
+    }
+
+    bool saveNetwork(int slot) {
+        char key[8];
+        networkKey(slot, key);
+        return config.save(key, networks[slot], WIFI_CONFIG_VERSION);
+    }
+
+    bool saveHotspot() {
+        return config.save("hotspot", hotspotConfig, WIFI_CONFIG_VERSION);
+    }
+
+    static bool terminated(const char* text, size_t size) {
+        return memchr(text, '\0', size) != nullptr;
+    }
+
+    // Import settings saved by older firmware in the raw EEPROM layout,
+    // keeping only entries that look like real settings
+    bool migrateEeprom() {
+        NetworkConfig legacyNetworks[MAX_NETWORKS];
+        HotspotConfig legacyHotspot;
+        if (!EEPROM.begin(EEPROM_SIZE)) return false;
+        EEPROM.get(0, legacyNetworks);
+        EEPROM.get(sizeof(legacyNetworks), legacyHotspot);
+        EEPROM.end();
+
+        bool imported = false;
+        for (int i = 0; i < MAX_NETWORKS; i++) {
+            const NetworkConfig& legacy = legacyNetworks[i];
+            if (*(const uint8_t*)&legacy.enabled != 1 || legacy.ssid[0] == '\0' ||
+                !terminated(legacy.ssid, sizeof(legacy.ssid)) ||
+                !terminated(legacy.password, sizeof(legacy.password))) {
+                continue;
+            }
+            networks[i] = legacy;
+            saveNetwork(i);
+            imported = true;
+        }
+
+        if (legacyHotspot.ssid[0] != '\0' && terminated(legacyHotspot.ssid, sizeof(legacyHotspot.ssid)) &&
+            terminated(legacyHotspot.password, sizeof(legacyHotspot.password))) {
+            hotspotConfig = legacyHotspot;
+            saveHotspot();
+            imported = true;
+        }
+        return imported;
+    }
+
+    // Load and validate every record in one pass. Missing or damaged
+    // records fall back to defaults.
     void loadConfig() {
-        EEPROM.get(0, networks);
-        EEPROM.get(sizeof(networks), hotspotConfig);
+        if (configLoaded) return;
+        configLoaded = true;
+
+        bool found = false;
+        for (int i = 0; i < MAX_NETWORKS; i++) {
+            char key[8];
+            networkKey(i, key);
+            if (!config.load(key, networks[i], WIFI_CONFIG_VERSION)) {
+                memset(&networks[i], 0, sizeof(networks[i]));
+            } else {
+                found = true;
+            }
+        }
+        if (config.load("hotspot", hotspotConfig, WIFI_CONFIG_VERSION)) {
+            found = true;
+        } else {
+            memset(&hotspotConfig, 0, sizeof(hotspotConfig));
+        }
+
+        if (!found && migrateEeprom()) {
+            Serial.println("WiFi settings migrated from EEPROM");
+        }
+
+        // Default hotspot if none is configured
+        if (strlen(hotspotConfig.ssid) == 0) {
+            String defaultSSID = "PetFeeder-Setup-" + String((uint32_t)ESP.getEfuseMac(), HEX).substring(0, 4);
+            strncpy(hotspotConfig.ssid, defaultSSID.c_str(), 31);
+            strncpy(hotspotConfig.password, "petfeeder123", 63);
+            hotspotConfig.channel = 1;
+            hotspotConfig.hidden = false;
+            hotspotConfig.maxConnections = 4;
+        }
     }
 
-    // Web server handlers
+    // Captive portal. The async server handles several clients at once,
+    // which matters when a phone and its OS probes all hit it together.
     void setupWebServer() {
-        server = new WebServer(80);
+        server = new AsyncWebServer(80);
         dnsServer = new DNSServer();
 
-        server->on("/", HTTP_GET, [this]() {
-            this->handleRoot();
+        // Answer every name with the portal address so OS captive portal
+        // checks land on the setup page
+        dnsServer->setErrorReplyCode(DNSReplyCode::NoError);
+        dnsServer->start(DNS_PORT, "*", WiFi.softAPIP());
+
+        for (size_t i = 0; i < PORTAL_ASSET_COUNT; i++) {
+            const PortalAsset* asset = &PORTAL_ASSETS[i];
+            server->on(asset->path, HTTP_GET, [asset](AsyncWebServerRequest* request) {
+                sendAsset(request, *asset);
+            });
+        }
+
+        server->on("/scan", HTTP_GET, [this](AsyncWebServerRequest* request) {
+            this->handleScan(request);
         });
 
-        server->on("/scan", HTTP_GET, [this]() {
-            this->handleScan();
+        server->on("/configure", HTTP_POST, [this](AsyncWebServerRequest* request) {
+            this->handleConfigure(request);
         });
 
-        server->on("/configure", HTTP_POST, [this]() {
-            this->handleConfigure();
+        server->on("/hotspot", HTTP_POST, [this](AsyncWebServerRequest* request) {
+            this->handleHotspotConfig(request);
         });
 
-        server->on("/hotspot", HTTP_POST, [this]() {
-            this->handleHotspotConfig();
+        server->onNotFound([](AsyncWebServerRequest* request) {
+            request->redirect("http://" + WiFi.softAPIP().toString() + "/");
         });
 
         server->begin();
     }
 
-    void handleRoot() {
-        String html = "<html><head><title>PetFeeder Setup</title></head><body>";
-        html += "<h1>PetFeeder WiFi Setup</h1>";
-        html += "<button onclick='scanNetworks()'>Scan Networks</button>";
-        html += "<div id='networks'></div>";
-        html += "<script>";
-        html += "function scanNetworks() {";
-        html += "  fetch('/scan').then(r=>r.json()).then(data=>{";
-        html += "    let html = '<ul>';";
-        html += "    data.networks.forEach(n=>{";
-        html += "      html += `<li>${n.ssid} (${n.rssi}dBm) `;";
-        html += "      html += `<button onclick='configure(\"${n.ssid}\")'>Configure</button></li>`;";
-        html += "    });";
-        html += "    html += '</ul>';";
-        html += "    document.getElementById('networks').innerHTML = html;";
-        html += "  });";
-        html += "}";
-        html += "</script>";
-        html += "</body></html>";
-        server->send(200, "text/html", html);
-    }
-
-    void handleScan() {
-        int n = WiFi.scanNetworks();
-        String json = "{\"networks\":[";
-        for (int i = 0; i < n; i++) {
-            if (i > 0) json += ",";
-            json += "{\"ssid\":\"" + WiFi.SSID(i) + "\",\"rssi\":" + String(WiFi.RSSI(i)) + "}";
-        }
-        json += "]}";
-        server->send(200, "application/json", json);
-    }
-
-    void handleConfigure() {
-        if (!server->hasArg("ssid") || !server->hasArg("password")) {
-            server->send(400, "text/plain", "Missing parameters");
+    // Serve a precompressed page, or 304 if the browser has this version
+    static void sendAsset(AsyncWebServerRequest* request, const PortalAsset& asset) {
+        if (request->hasHeader("If-None-Match") &&
+            request->getHeader("If-None-Match")->value() == asset.etag) {
+            request->send(304);
             return;
         }
 
-        String ssid = server->arg("ssid");
-        String password = server->arg("password");
-        int priority = server->hasArg("priority") ? server->arg("priority").toInt() : 0;
+        AsyncWebServerResponse* response =
+            request->beginResponse(200, asset.contentType, asset.data, asset.length);
+        response->addHeader("Content-Encoding", "gzip");
+        response->addHeader("ETag", asset.etag);
+        response->addHeader("Cache-Control", "no-cache");
+        request->send(response);
+    }
 
-        // Find empty slot or lowest priority
-        int slot = 0;
-        for (int i = 0; i < MAX_NETWORKS; i++) {
-            if (!networks[i].enabled || networks[i].priority < networks[slot].priority) {
-                slot = i;
-            }
+    static String param(AsyncWebServerRequest* request, const char* name) {
+        const AsyncWebParameter* value = request->getParam(name, true);
+        return value ? value->value() : String();
+    }
+
+    // Answer from the scan cache straight away. A refresh is requested in
+    // the background if the cache is stale, the page can poll for it.
+    void handleScan(AsyncWebServerRequest* request) {
+        if (scanCache.needsScan(PORTAL_SCAN_INTERVAL)) {
+            scanRequested = true;
         }
 
-        strncpy(networks[slot].ssid, ssid.c_str(), 31);
-        strncpy(networks[slot].password, password.c_str(), 63);
-        networks[slot].priority = priority;
-        networks[slot].enabled = true;
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+        {
+            JsonStreamWriter json(*response);
+            json.beginObject();
+            json.field("scanning", scanCache.isScanning() || scanRequested.load());
+            json.beginArray("networks");
+            scanCache.forEach([&json](const WiFiScanCache::Entry& entry, unsigned long age) {
+                char bssid[18];
+                snprintf(bssid, sizeof(bssid), "%02X:%02X:%02X:%02X:%02X:%02X",
+                         entry.bssid[0], entry.bssid[1], entry.bssid[2],
+                         entry.bssid[3], entry.bssid[4], entry.bssid[5]);
+
+                json.beginObject();
+                json.field("ssid", entry.ssid);
+                json.field("bssid", bssid);
+                json.field("rssi", entry.rssi);
+                json.field("channel", entry.channel);
+                json.field("security", WiFiScanCache::authName(entry.auth));
+                json.field("age", (long)(age / 1000));
+                json.endObject();
+            });
+            json.endArray();
+            json.endObject();
+        }
+        request->send(response);
+    }
 
-        saveConfig();
-        server->send(200, "text/plain", "Configuration saved");
+    void handleConfigure(AsyncWebServerRequest* request) {
+        if (!request->hasParam("ssid", true) || !request->hasParam("password", true)) {
+            request->send(400, "text/plain", "Missing parameters");
+            return;
+        }
+        if (networkPending) {
+            request->send(503, "text/plain", "Busy, try again");
+            return;
+        }
 
-        // Try to connect to the new network
-        connectToBestNetwork();
+        memset(&pendingNetwork, 0, sizeof(pendingNetwork));
+        strncpy(pendingNetwork.ssid, param(request, "ssid").c_str(), 31);
+        strncpy(pendingNetwork.password, param(request, "password").c_str(), 63);
+        pendingNetwork.priority = param(request, "priority").toInt();
+        pendingNetwork.enabled = true;
+        networkPending = true;
+
+        request->send(200, "text/plain", "Configuration saved");
     }
 
-    void handleHotspotConfig() {
-        if (!server->hasArg("ssid") || !server->hasArg("password")) {
-            server->send(400, "text/plain", "Missing parameters");
+    void handleHotspotConfig(AsyncWebServerRequest* request) {
+        if (!request->hasParam("ssid", true) || !request->hasParam("password", true)) {
+            request->send(400, "text/plain", "Missing parameters");
             return;
         }
+        if (hotspotPending) {
+            request->send(503, "text/plain", "Busy, try again");
+            return;
+        }
+
+        memset(&pendingHotspot, 0, sizeof(pendingHotspot));
+        strncpy(pendingHotspot.ssid, param(request, "ssid").c_str(), 31);
+        strncpy(pendingHotspot.password, param(request, "password").c_str(), 63);
+        pendingHotspot.channel = request->hasParam("channel", true) ? param(request, "channel").toInt() : 1;
+        pendingHotspot.hidden = param(request, "hidden") == "true";
+        pendingHotspot.maxConnections = request->hasParam("maxConnections", true) ?
+                                        param(request, "maxConnections").toInt() : 4;
+        hotspotPending = true;
+
+        request->send(200, "text/plain", "Hotspot configuration saved");
+    }
+
+    // Apply changes posted to the portal, on the loop task
+    void applyPortalChanges() {
+        if (networkPending) {
+            // Replace an empty slot or the lowest priority network
+            int slot = 0;
+            for (int i = 0; i < MAX_NETWORKS; i++) {
+                if (!networks[i].enabled || networks[i].priority < networks[slot].priority) {
+                    slot = i;
+                }
+            }
+            networks[slot] = pendingNetwork;
+            networkPending = false;
 
-        String ssid = server->arg("ssid");
-        String password = server->arg("password");
-        uint8_t channel = server->hasArg("channel") ? server->arg("channel").toInt() : 1;
-        bool hidden = server->hasArg("hidden") ? server->arg("hidden") == "true" : false;
-        uint8_t maxConn = server->hasArg("maxConnections") ? server->arg("maxConnections").toInt() : 4;
+            saveNetwork(slot);
 
-        strncpy(hotspotConfig.ssid, ssid.c_str(), 31);
-        strncpy(hotspotConfig.password, password.c_str(), 63);
-        hotspotConfig.channel = channel;
-        hotspotConfig.hidden = hidden;
-        hotspotConfig.maxConnections = maxConn;
+            // Try to connect to the new network
+            connectToBestNetwork();
+        }
+
+        if (hotspotPending) {
+            hotspotConfig = pendingHotspot;
+            hotspotPending = false;
+            saveHotspot();
+        }
 
-        saveConfig();
-        server->send(200, "text/plain", "Hotspot configuration saved");
+        if (scanRequested) {
+            scanRequested = false;
+            scanCache.start();
+        }
     }
 
 public:
-    WiFiManager() {
+    WiFiManager() : config(WIFI_CONFIG_NAMESPACE) {
+        configLoaded = false;
+        server = nullptr;
+        dnsServer = nullptr;
         lastCheck = 0;
         isHotspotActive = false;
         connectionRetries = 0;
-        
-        // Initialize EEPROM
-        EEPROM.begin(EEPROM_SIZE);
-        loadConfig();
-
-        // Set default hotspot config if empty
-        if (strlen(hotspotConfig.ssid) == 0) {
-            String defaultSSID = "PetFeeder-Setup-" + String((uint32_t)ESP.getEfuseMac(), HEX).substring(0, 4);
-            strncpy(hotspotConfig.ssid, defaultSSID.c_str(), 31);
-            strncpy(hotspotConfig.password, "petfeeder123", 63);
-            hotspotConfig.channel = 1;
-            hotspotConfig.hidden = false;
-            hotspotConfig.maxConnections = 4;
-            saveConfig();
+        state = IDLE;
+        generation = 0;
+        candidateCount = 0;
+        attempt = 0;
+        attemptStart = 0;
+        attemptTimeout = 0;
+        lastAccessPoint.valid = false;
+        target.valid = false;
+        roaming = false;
+        eventsRegistered = false;
+        lastRoamCheck = 0;
+        stats = Stats();
+        stats.chosen.network = -1;
+        for (int i = 0; i < MAX_NETWORKS; i++) {
+            failureRate[i] = 0;
         }
+        linkUp = false;
+        linkDown = false;
+        linkChannel = 0;
+        networkPending = false;
+        hotspotPending = false;
+        scanRequested = false;
+        memset(networks, 0, sizeof(networks));
+        memset(&hotspotConfig, 0, sizeof(hotspotConfig));
     }
 
+    // Start joining the stored networks, returns without waiting. The
+    // hotspot opens if none of them connects.
     void begin() {
-        // Try to connect to stored networks first
-        if (!connectToBestNetwork()) {
-            startHotspot();
+        loadConfig();
+        if (!eventsRegistered) {
+            WiFi.onEvent([this](WiFiEvent_t event, WiFiEventInfo_t info) {
+                this->onWiFiEvent(event, info);
+            });
+            eventsRegistered = true;
         }
+        WiFi.mode(WIFI_STA);
+        WiFi.setAutoReconnect(false);
+        connectToBestNetwork();
     }
 
-    bool connectToBestNetwork() {
-        // Sort networks by priority
-        for (int i = 0; i < MAX_NETWORKS - 1; i++) {
-            for (int j = i + 1; j < MAX_NETWORKS; j++) {
-                if (networks[j].enabled && networks[j].priority > networks[i].priority) {
-                    NetworkConfig temp = networks[i];
-                    networks[i] = networks[j];
-                    networks[j] = temp;
-                }
-            }
-        }
-
-        // Try to connect to each enabled network in order of priority
+    // begin(), trying the access point used before deep sleep first
+    void resume(const char* ssid, const uint8_t* bssid, uint8_t channel) {
+        loadConfig();
         for (int i = 0; i < MAX_NETWORKS; i++) {
-            if (networks[i].enabled) {
-                WiFi.begin(networks[i].ssid, networks[i].password);
-                int attempts = 0;
-                while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-                    delay(500);
-                    attempts++;
-                }
-                if (WiFi.status() == WL_CONNECTED) {
-                    if (isHotspotActive) {
-                        stopHotspot();
-                    }
-                    return true;
-                }
+            if (networks[i].enabled && strncmp(networks[i].ssid, ssid, sizeof(networks[i].ssid)) == 0) {
+                lastAccessPoint.network = i;
+                memcpy(lastAccessPoint.bssid, bssid, sizeof(lastAccessPoint.bssid));
+                lastAccessPoint.channel = channel;
+                lastAccessPoint.valid = true;
+                break;
             }
         }
-        return false;
+        begin();
+    }
+
+    // Start a new round of connection attempts
+    void connectToBestNetwork() {
+        target = lastAccessPoint;
+        startRound();
     }
 
     void startHotspot() {
@@ -233,7 +642,7 @@ public:
         if (isHotspotActive) {
             WiFi.softAPdisconnect(true);
             if (server) {
-                server->stop();
+                server->end();
                 delete server;
                 server = nullptr;
             }
@@ -248,37 +657,83 @@ public:
 
     void update() {
         unsigned long currentMillis = millis();
+        applyPortalChanges();
+        bool scanned = scanCache.poll();
         
-        // Check connection status periodically
-        if (currentMillis - lastCheck >= CHECK_INTERVAL) {
-            lastCheck = currentMillis;
-            
-            if (WiFi.status() != WL_CONNECTED) {
-                connectionRetries++;
-                if (connectionRetries >= MAX_RETRIES) {
-                    if (!isHotspotActive) {
-                        startHotspot();
-                    }
-                } else {
-                    connectToBestNetwork();
-                }
-            } else {
-                connectionRetries = 0;
-                if (isHotspotActive) {
-                    stopHotspot();
-                }
+        if (linkUp) {
+            linkUp = false;
+            if (state != CONNECTED) connected();
+        }
+        
+        if (linkDown) {
+            linkDown = false;
+            if (state == CONNECTED) {
+                // Lost the link, start over with a directed rejoin
+                connectToBestNetwork();
+            } else if (state == CONNECTING && currentMillis - attemptStart >= CONNECT_SETTLE_MS) {
+                nextAttempt(currentMillis);
+            }
+        }
+        
+        if (state == CONNECTING && currentMillis - attemptStart >= attemptTimeout) {
+            nextAttempt(currentMillis);
+        }
+        
+        // Retry periodically after every network failed, ranking them on
+        // a fresh scan
+        if (state == FAILED && currentMillis - lastCheck >= CHECK_INTERVAL) {
+            if (scanCache.needsScan(CHECK_INTERVAL)) {
+                scanCache.start();
+            } else if (!scanCache.isScanning()) {
+                connectToBestNetwork();
+            }
+        }
+        
+        // Look for a better access point while the link is weak
+        if (state == CONNECTED) {
+            if (scanned) {
+                considerRoaming();
+            } else if (currentMillis - lastRoamCheck >= ROAM_CHECK_INTERVAL) {
+                lastRoamCheck = currentMillis;
+                if (WiFi.RSSI() < ROAM_RSSI_THRESHOLD) scanCache.start();
             }
         }
 
-        // Handle DNS and web server if hotspot is active
+        // Handle DNS if hotspot is active, keeping the scan results fresh
+        // for the setup page. The web server runs on its own task.
         if (isHotspotActive) {
+            if (scanCache.needsScan(PORTAL_SCAN_INTERVAL)) scanCache.start();
             if (dnsServer) dnsServer->processNextRequest();
-            if (server) server->handleClient();
         }
     }
 
     bool isConnected() {
-        return WiFi.status() == WL_CONNECTED;
+        return state == CONNECTED;
+    }
+
+    State getState() const {
+        return state;
+    }
+
+    // Waiting out CHECK_INTERVAL after a failed round, with no join or scan
+    // in flight. The radio has nothing to do until the retry, so this is
+    // the only disconnected state in which the device may light sleep.
+    bool isBackingOff() const {
+        return state == FAILED && !scanCache.isScanning();
+    }
+
+    // Changes on every connect and disconnect
+    uint32_t getGeneration() const {
+        return generation;
+    }
+
+    // Current score of a stored network
+    NetworkScore getScore(int network) const {
+        return scoreNetwork(network);
+    }
+
+    const Stats& getStats() const {
+        return stats;
     }
 
     bool isHotspotEnabled() {
@@ -0,0 +1,146 @@
+#ifndef WIFI_SCAN_CACHE_H
+#define WIFI_SCAN_CACHE_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <mutex>
+
+#define SCAN_CACHE_SIZE 16
+#define SCAN_MAX_AGE 120000      // ms before a sighting is ignored
+#define SCAN_DWELL_MS 120        // passive listen time per channel
+
+// Access points seen by background scans, kept with the time they were
+// last heard. Scans are started asynchronously and collected by poll(), so
+// nothing waits on the radio. Entries are keyed by BSSID and the oldest is
+// replaced when the cache is full. Scanning and lookups belong to the loop
+// task; forEach() may also be called from web server handlers.
+class WiFiScanCache {
+public:
+    struct Entry {
+        char ssid[33];
+        uint8_t bssid[6];
+        int8_t rssi;
+        uint8_t channel;
+        uint8_t auth;          // wifi_auth_mode_t
+        unsigned long seenAt;
+    };
+
+private:
+    Entry entries[SCAN_CACHE_SIZE];
+    uint8_t count;
+    bool scanning;
+    unsigned long lastStart;
+    uint32_t scans;
+    mutable std::mutex mutex;   // held while entries change or are listed
+
+    Entry* slotFor(const uint8_t* bssid) {
+        uint8_t oldest = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            if (memcmp(entries[i].bssid, bssid, 6) == 0) return &entries[i];
+            if (entries[i].seenAt < entries[oldest].seenAt) oldest = i;
+        }
+        if (count < SCAN_CACHE_SIZE) return &entries[count++];
+        return &entries[oldest];
+    }
+
+    void collect(int found, unsigned long now) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < found; i++) {
+            Entry* entry = slotFor(WiFi.BSSID(i));
+            strlcpy(entry->ssid, WiFi.SSID(i).c_str(), sizeof(entry->ssid));
+            memcpy(entry->bssid, WiFi.BSSID(i), sizeof(entry->bssid));
+            entry->rssi = WiFi.RSSI(i);
+            entry->channel = WiFi.channel(i);
+            entry->auth = WiFi.encryptionType(i);
+            entry->seenAt = now;
+        }
+    }
+
+public:
+    WiFiScanCache() {
+        count = 0;
+        scanning = false;
+        lastStart = 0;
+        scans = 0;
+    }
+
+    // Start a passive scan in the background. Passive scans only listen
+    // for beacons, which disturbs an existing association the least.
+    bool start() {
+        if (scanning) return true;
+        lastStart = millis();
+        scanning = WiFi.scanNetworks(true, false, true, SCAN_DWELL_MS) == WIFI_SCAN_RUNNING;
+        return scanning;
+    }
+
+    // Collect finished scan results. Returns true when new results arrived.
+    bool poll() {
+        if (!scanning) return false;
+
+        int found = WiFi.scanComplete();
+        if (found == WIFI_SCAN_RUNNING) return false;
+
+        scanning = false;
+        if (found < 0) return false;
+
+        collect(found, millis());
+        WiFi.scanDelete();
+        scans++;
+        return true;
+    }
+
+    // Call fn(entry, ageMs) for each access point heard in the last
+    // SCAN_MAX_AGE. Safe from any task.
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        unsigned long now = millis();
+        for (uint8_t i = 0; i < count; i++) {
+            unsigned long age = now - entries[i].seenAt;
+            if (age <= SCAN_MAX_AGE) fn(entries[i], age);
+        }
+    }
+
+    static const char* authName(uint8_t auth) {
+        switch (auth) {
+            case WIFI_AUTH_OPEN: return "open";
+            case WIFI_AUTH_WEP: return "wep";
+            case WIFI_AUTH_WPA_PSK: return "wpa";
+            case WIFI_AUTH_WPA2_PSK: return "wpa2";
+            case WIFI_AUTH_WPA_WPA2_PSK: return "wpa/wpa2";
+            case WIFI_AUTH_WPA2_ENTERPRISE: return "wpa2-enterprise";
+            case WIFI_AUTH_WPA3_PSK: return "wpa3";
+            case WIFI_AUTH_WPA2_WPA3_PSK: return "wpa2/wpa3";
+            default: return "unknown";
+        }
+    }
+
+    bool isScanning() const {
+        return scanning;
+    }
+
+    // True if no scan has been started in the last maxAgeMs
+    bool needsScan(unsigned long maxAgeMs) const {
+        return !scanning && (scans == 0 || millis() - lastStart >= maxAgeMs);
+    }
+
+    // Strongest access point for ssid heard in the last SCAN_MAX_AGE, or
+    // nullptr if none
+    const Entry* strongest(const char* ssid) const {
+        unsigned long now = millis();
+        const Entry* best = nullptr;
+        for (uint8_t i = 0; i < count; i++) {
+            const Entry& entry = entries[i];
+            if (now - entry.seenAt > SCAN_MAX_AGE || strcmp(entry.ssid, ssid) != 0) continue;
+            if (!best || entry.rssi > best->rssi) best = &entry;
+        }
+        return best;
+    }
+
+    // True if a scan finished recently enough to say what is in range
+    bool isFresh() const {
+        return scans > 0 && millis() - lastStart <= SCAN_MAX_AGE;
+    }
+};
+
+#endif // WIFI_SCAN_CACHE_H
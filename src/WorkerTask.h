@@ -0,0 +1,106 @@
+#ifndef WORKER_TASK_H
+#define WORKER_TASK_H
+
+#include <stdint.h>
+#include <functional>
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+// A long-running task with a body that loops forever, and a wakeup that
+// lets another task cut its wait short, for example after pushing to a
+// queue it reads. On the ESP32 this is a FreeRTOS task pinned to a core and
+// woken with a task notification. Elsewhere it is a std::thread and a
+// condition variable, so code built on it can run in desktop tests.
+class WorkerTask {
+public:
+    typedef std::function<void()> BodyFn;
+
+private:
+    BodyFn body;
+
+#ifdef ESP_PLATFORM
+    TaskHandle_t handle;
+
+    static void entry(void* arg) {
+        WorkerTask* task = (WorkerTask*)arg;
+        for (;;) {
+            task->body();
+        }
+    }
+#else
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool woken;
+
+    void entry() {
+        for (;;) {
+            body();
+        }
+    }
+#endif
+
+public:
+    WorkerTask() {
+#ifdef ESP_PLATFORM
+        handle = nullptr;
+#else
+        woken = false;
+#endif
+    }
+
+    // Run body repeatedly on its own task. core and priority only apply on
+    // the ESP32, core 0 runs the WiFi stack and core 1 the Arduino loop.
+    bool start(const char* name, uint32_t stackSize, uint8_t priority, int8_t core, BodyFn body) {
+        this->body = body;
+#ifdef ESP_PLATFORM
+        return xTaskCreatePinnedToCore(entry, name, stackSize, this, priority, &handle, core) == pdPASS;
+#else
+        (void)name;
+        (void)stackSize;
+        (void)priority;
+        (void)core;
+        thread = std::thread(&WorkerTask::entry, this);
+        return true;
+#endif
+    }
+
+    // Block the calling task, which must be this one, for up to ms or
+    // until wake() is called
+    void waitFor(uint32_t ms) {
+#ifdef ESP_PLATFORM
+        ulTaskNotifyTake(pdTRUE, ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(ms));
+#else
+        std::unique_lock<std::mutex> lock(mutex);
+        if (ms == UINT32_MAX) {
+            wakeup.wait(lock, [this]() { return woken; });
+        } else {
+            wakeup.wait_for(lock, std::chrono::milliseconds(ms), [this]() { return woken; });
+        }
+        woken = false;
+#endif
+    }
+
+    // Cut the task's current or next waitFor() short. Safe from any task.
+    void wake() {
+#ifdef ESP_PLATFORM
+        if (handle) xTaskNotifyGive(handle);
+#else
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            woken = true;
+        }
+        wakeup.notify_one();
+#endif
+    }
+};
+
+#endif // WORKER_TASK_H
@@ -53,6 +53,11 @@ CREATE TABLE IF NOT EXISTS public.devices (
     mac_address text unique,
     last_seen timestamp with time zone,
     firmware_version text,
+    metrics jsonb, -- profiler summary, sent by firmware built with METRICS_IN_TELEMETRY
+    config jsonb default '{}'::jsonb, -- device settings: max_feed_amount, feed_amount_per_second
+    config_version bigint default 0, -- sync_version at the last config change
+    sync_version bigint default 0, -- bumped by every change the device has to sync
+    local_api_token text, -- bearer token for the device's LAN API, published by the firmware
     created_at timestamp with time zone default timezone('utc'::text, now()),
     updated_at timestamp with time zone default timezone('utc'::text, now())
 );
@@ -84,26 +89,39 @@ CREATE TABLE IF NOT EXISTS public.feeding_schedules (
     days_of_week text[] not null,
     amount integer not null,
     enabled boolean default true,
+    sync_version bigint default 0, -- device sync_version when last changed
     created_at timestamp with time zone default timezone('utc'::text, now()),
     updated_at timestamp with time zone default timezone('utc'::text, now())
 );
 
+-- Schedules removed from a device, kept so device_sync can report deletions
+CREATE TABLE IF NOT EXISTS public.feeding_schedule_deletions (
+    schedule_id uuid primary key,
+    device_id uuid references public.devices(id) on delete cascade not null,
+    sync_version bigint not null
+);
+
+-- Devices report feeds without a pet or user: user_id is filled in from
+-- the device owner by fill_feeding_history()
 CREATE TABLE IF NOT EXISTS public.feeding_history (
     id uuid default uuid_generate_v4() primary key,
     device_id uuid references public.devices(id) on delete cascade not null,
-    pet_id uuid references public.pets(id) on delete cascade not null,
+    pet_id uuid references public.pets(id) on delete set null,
     user_id uuid references public.profiles(id) not null,
     amount integer not null,
     type text default 'manual',
     status text default 'completed',
     schedule_id uuid references public.feeding_schedules(id) on delete set null,
+    device_seq bigint, -- device journal sequence number, makes uploads idempotent
+    command_id uuid, -- feed command this feed carried out, completed by the insert
+    fed_at timestamp with time zone, -- device clock at the feed, created_at if it was not set
     created_at timestamp with time zone default timezone('utc'::text, now())
 );
 
 -- Additional table for device statistics
 CREATE TABLE IF NOT EXISTS public.device_stats (
     id uuid default uuid_generate_v4() primary key,
-    device_id uuid references public.devices(id) on delete cascade not null,
+    device_id uuid references public.devices(id) on delete cascade not null unique,
     total_feedings integer default 0,
     total_amount integer default 0,
     last_maintenance timestamp with time zone,
@@ -132,6 +150,7 @@ ALTER TABLE public.feeding_schedules ENABLE ROW LEVEL SECURITY;
 ALTER TABLE public.feeding_history ENABLE ROW LEVEL SECURITY;
 ALTER TABLE public.device_stats ENABLE ROW LEVEL SECURITY;
 ALTER TABLE public.feed_commands ENABLE ROW LEVEL SECURITY;
+ALTER TABLE public.feeding_schedule_deletions ENABLE ROW LEVEL SECURITY;
 
 -- Profiles policies
 CREATE POLICY "Profiles are viewable by owner"
@@ -176,14 +195,26 @@ CREATE POLICY "Users can delete their feeding schedules"
     ON public.feeding_schedules FOR DELETE
     USING (auth.uid() = user_id);
 
+-- Schedule deletions are only written by the sync triggers
+CREATE POLICY "Users can view their schedule deletions"
+    ON public.feeding_schedule_deletions FOR SELECT
+    USING (EXISTS (
+      SELECT 1 FROM public.devices d
+      WHERE d.id = device_id AND d.owner_id = auth.uid()
+    ));
+
 -- Feeding History
 CREATE POLICY "Users can view their feeding history"
     ON public.feeding_history FOR SELECT
     USING (auth.uid() = user_id);
 
+-- Checked after fill_feeding_history() has set user_id
 CREATE POLICY "Users can insert feeding history"
     ON public.feeding_history FOR INSERT
-    WITH CHECK (auth.uid() = user_id);
+    WITH CHECK (auth.uid() = user_id AND EXISTS (
+      SELECT 1 FROM public.devices d
+      WHERE d.id = device_id AND d.owner_id = auth.uid()
+    ));
 
 -- User Preferences
 CREATE POLICY "Users can view their own preferences"
@@ -220,6 +251,8 @@ CREATE POLICY "Users can update their feed commands"
 CREATE INDEX idx_devices_owner_id ON public.devices(owner_id);
 CREATE INDEX idx_feeding_schedules_device_id ON public.feeding_schedules(device_id);
 CREATE INDEX idx_feeding_schedules_user_id ON public.feeding_schedules(user_id);
+CREATE INDEX idx_feeding_schedules_sync ON public.feeding_schedules(device_id, sync_version);
+CREATE INDEX idx_feeding_schedule_deletions_sync ON public.feeding_schedule_deletions(device_id, sync_version);
 CREATE INDEX idx_feeding_history_device_id ON public.feeding_history(device_id);
 CREATE INDEX idx_feeding_history_user_id ON public.feeding_history(user_id);
 CREATE INDEX idx_user_profiles_username ON public.profiles(username);
@@ -228,15 +261,30 @@ CREATE INDEX idx_feeding_history_pet_id ON public.feeding_history(pet_id);
 CREATE INDEX idx_feeding_schedules_pet_id ON public.feeding_schedules(pet_id);
 CREATE INDEX idx_devices_last_seen ON public.devices(last_seen);
 CREATE INDEX idx_feeding_history_created_at ON public.feeding_history(created_at);
+CREATE UNIQUE INDEX idx_feeding_history_device_seq ON public.feeding_history(device_id, device_seq);
 CREATE INDEX idx_feed_commands_device_id ON public.feed_commands(device_id);
 CREATE INDEX idx_feed_commands_user_id ON public.feed_commands(user_id);
+CREATE INDEX idx_feed_commands_pending ON public.feed_commands(device_id, created_at) WHERE status = 'pending';
 CREATE INDEX idx_devices_mac_address ON public.devices(mac_address);
 
 -- Drop existing triggers and functions first
 DROP TRIGGER IF EXISTS on_auth_user_created ON auth.users;
 DROP TRIGGER IF EXISTS device_stats_trigger ON public.devices;
+DROP TRIGGER IF EXISTS feed_command_completed_trigger ON public.feeding_history;
+DROP TRIGGER IF EXISTS feeding_history_fill_trigger ON public.feeding_history;
+DROP TRIGGER IF EXISTS feeding_schedules_sync_trigger ON public.feeding_schedules;
+DROP TRIGGER IF EXISTS feeding_schedules_delete_sync_trigger ON public.feeding_schedules;
+DROP TRIGGER IF EXISTS device_config_sync_trigger ON public.devices;
 DROP FUNCTION IF EXISTS public.handle_new_user();
 DROP FUNCTION IF EXISTS update_device_stats();
+DROP FUNCTION IF EXISTS complete_feed_command();
+DROP FUNCTION IF EXISTS fill_feeding_history();
+DROP FUNCTION IF EXISTS bump_device_sync_version(uuid);
+DROP FUNCTION IF EXISTS sync_feeding_schedule();
+DROP FUNCTION IF EXISTS sync_feeding_schedule_delete();
+DROP FUNCTION IF EXISTS sync_device_config();
+DROP FUNCTION IF EXISTS public.device_sync(uuid, bigint);
+DROP FUNCTION IF EXISTS public.device_sync(uuid, bigint, integer);
 
 -- Functions
 CREATE OR REPLACE FUNCTION public.handle_new_user()
@@ -275,6 +323,173 @@ BEGIN
 END;
 $$ LANGUAGE plpgsql;
 
+-- Devices claim commands by moving them from pending to processing and
+-- report the feed in feeding_history, which completes the command here
+-- instead of in a separate request
+CREATE OR REPLACE FUNCTION complete_feed_command()
+RETURNS trigger AS $$
+BEGIN
+  UPDATE public.feed_commands
+  SET status = 'completed', updated_at = timezone('utc'::text, now())
+  WHERE id = NEW.command_id AND device_id = NEW.device_id;
+  RETURN NEW;
+END;
+$$ LANGUAGE plpgsql SECURITY DEFINER;
+
+-- Rows uploaded by the firmware carry the device and what it fed. The
+-- owner comes from the device, and the feed time falls back to the
+-- insert time when the device clock was not set.
+CREATE OR REPLACE FUNCTION fill_feeding_history()
+RETURNS trigger AS $$
+BEGIN
+  IF NEW.user_id IS NULL THEN
+    SELECT owner_id INTO NEW.user_id FROM public.devices WHERE id = NEW.device_id;
+  END IF;
+  NEW.fed_at := COALESCE(NEW.fed_at, NEW.created_at);
+  RETURN NEW;
+END;
+$$ LANGUAGE plpgsql SECURITY DEFINER;
+
+-- Device sync. Every change a device has to pick up bumps the device's
+-- sync_version and is stamped with the new value, so device_sync returns
+-- everything above the version the device last saw. Bumping locks the
+-- device row until commit, so changes to one device commit in version
+-- order and a sync can never skip one that commits late.
+CREATE OR REPLACE FUNCTION bump_device_sync_version(p_device_id uuid)
+RETURNS bigint AS $$
+DECLARE
+  v_version bigint;
+BEGIN
+  UPDATE public.devices
+  SET sync_version = sync_version + 1
+  WHERE id = p_device_id
+  RETURNING sync_version INTO v_version;
+  RETURN COALESCE(v_version, 0);
+END;
+$$ LANGUAGE plpgsql SECURITY DEFINER;
+
+-- Only for the sync triggers, not callable through the API
+REVOKE EXECUTE ON FUNCTION bump_device_sync_version(uuid) FROM PUBLIC, anon, authenticated;
+
+CREATE OR REPLACE FUNCTION sync_feeding_schedule()
+RETURNS trigger AS $$
+BEGIN
+  -- Moved to another device, the old one sees it as deleted
+  IF TG_OP = 'UPDATE' AND NEW.device_id IS DISTINCT FROM OLD.device_id THEN
+    INSERT INTO public.feeding_schedule_deletions (schedule_id, device_id, sync_version)
+    VALUES (OLD.id, OLD.device_id, bump_device_sync_version(OLD.device_id))
+    ON CONFLICT (schedule_id) DO UPDATE
+      SET device_id = EXCLUDED.device_id, sync_version = EXCLUDED.sync_version;
+  END IF;
+
+  NEW.sync_version := bump_device_sync_version(NEW.device_id);
+  RETURN NEW;
+END;
+$$ LANGUAGE plpgsql SECURITY DEFINER;
+
+CREATE OR REPLACE FUNCTION sync_feeding_schedule_delete()
+RETURNS trigger AS $$
+BEGIN
+  INSERT INTO public.feeding_schedule_deletions (schedule_id, device_id, sync_version)
+  VALUES (OLD.id, OLD.device_id, bump_device_sync_version(OLD.device_id))
+  ON CONFLICT (schedule_id) DO UPDATE
+    SET device_id = EXCLUDED.device_id, sync_version = EXCLUDED.sync_version;
+  RETURN OLD;
+END;
+$$ LANGUAGE plpgsql SECURITY DEFINER;
+
+CREATE OR REPLACE FUNCTION sync_device_config()
+RETURNS trigger AS $$
+BEGIN
+  IF NEW.config IS DISTINCT FROM OLD.config THEN
+    NEW.sync_version := OLD.sync_version + 1;
+    NEW.config_version := NEW.sync_version;
+  END IF;
+  RETURN NEW;
+END;
+$$ LANGUAGE plpgsql;
+
+-- Called by the firmware once a minute with the last version it applied.
+-- Returns a flat array the device reads one element at a time, each tagged
+-- with its kind and in this order:
+--   {"kind": "sync", "version", "full", "config"}   always first
+--   {"kind": "command", "id", "amount"}             claimed feed commands
+--   {"kind": "deleted", "id"}                       schedules removed
+--   {"kind": "schedule", "id", "time", "amount", "enabled", "days"}
+-- config is null unless it changed. Schedules use the firmware's encoding:
+-- time as HH:MM and days as seven booleans from Sunday. Up to p_limit
+-- pending commands, oldest first, are claimed (moved to processing) by the
+-- same call. "full" asks the device to replace its table, for a first sync
+-- or a device ahead of the server.
+CREATE OR REPLACE FUNCTION public.device_sync(p_device_id uuid, p_since bigint DEFAULT 0, p_limit integer DEFAULT 4)
+RETURNS jsonb
+LANGUAGE plpgsql
+AS $$
+DECLARE
+  v_device public.devices%ROWTYPE;
+  v_full boolean;
+  v_since bigint;
+  v_commands jsonb;
+BEGIN
+  SELECT * INTO v_device FROM public.devices WHERE id = p_device_id;
+  IF NOT FOUND THEN
+    RAISE EXCEPTION 'Unknown device %', p_device_id;
+  END IF;
+
+  v_full := p_since > v_device.sync_version OR (p_since <= 0 AND v_device.sync_version > 0);
+  v_since := CASE WHEN v_full THEN 0 ELSE p_since END;
+
+  WITH claimed AS (
+    UPDATE public.feed_commands
+    SET status = 'processing', updated_at = timezone('utc'::text, now())
+    WHERE id IN (
+      SELECT c.id FROM public.feed_commands c
+      WHERE c.device_id = p_device_id AND c.status = 'pending'
+      ORDER BY c.created_at, c.id
+      LIMIT GREATEST(p_limit, 0)
+      FOR UPDATE SKIP LOCKED
+    )
+    RETURNING id, amount, created_at
+  )
+  SELECT COALESCE(jsonb_agg(jsonb_build_object('kind', 'command', 'id', id, 'amount', amount)
+                            ORDER BY created_at, id), '[]'::jsonb)
+  INTO v_commands
+  FROM claimed;
+
+  RETURN jsonb_build_array(jsonb_build_object(
+      'kind', 'sync',
+      'version', v_device.sync_version,
+      'full', v_full,
+      'config', CASE WHEN v_full OR v_device.config_version > v_since THEN v_device.config END
+    ))
+    || v_commands
+    || CASE WHEN v_full THEN '[]'::jsonb ELSE COALESCE((
+      SELECT jsonb_agg(jsonb_build_object('kind', 'deleted', 'id', d.schedule_id))
+      FROM public.feeding_schedule_deletions d
+      WHERE d.device_id = p_device_id AND d.sync_version > v_since
+    ), '[]'::jsonb) END
+    || COALESCE((
+      SELECT jsonb_agg(jsonb_build_object(
+        'kind', 'schedule',
+        'id', s.id,
+        'time', to_char(s.time_of_day, 'HH24:MI'),
+        'amount', s.amount,
+        'enabled', s.enabled,
+        -- days_of_week holds day names, "monday" or "Mon"
+        'days', (
+          SELECT jsonb_agg(EXISTS (
+            SELECT 1 FROM unnest(s.days_of_week) AS w(name)
+            WHERE lower(left(w.name, 3)) = wd.abbr
+          ) ORDER BY wd.n)
+          FROM unnest(ARRAY['sun', 'mon', 'tue', 'wed', 'thu', 'fri', 'sat']) WITH ORDINALITY AS wd(abbr, n)
+        )
+      ))
+      FROM public.feeding_schedules s
+      WHERE s.device_id = p_device_id AND s.sync_version > v_since
+    ), '[]'::jsonb);
+END;
+$$;
+
 -- Triggers
 CREATE TRIGGER on_auth_user_created
   AFTER INSERT ON auth.users
@@ -286,6 +501,32 @@ CREATE TRIGGER device_stats_trigger
   FOR EACH ROW
   EXECUTE FUNCTION update_device_stats();
 
+CREATE TRIGGER feeding_schedules_sync_trigger
+  BEFORE INSERT OR UPDATE ON public.feeding_schedules
+  FOR EACH ROW
+  EXECUTE FUNCTION sync_feeding_schedule();
+
+CREATE TRIGGER feeding_schedules_delete_sync_trigger
+  AFTER DELETE ON public.feeding_schedules
+  FOR EACH ROW
+  EXECUTE FUNCTION sync_feeding_schedule_delete();
+
+CREATE TRIGGER device_config_sync_trigger
+  BEFORE UPDATE ON public.devices
+  FOR EACH ROW
+  EXECUTE FUNCTION sync_device_config();
+
+CREATE TRIGGER feeding_history_fill_trigger
+  BEFORE INSERT ON public.feeding_history
+  FOR EACH ROW
+  EXECUTE FUNCTION fill_feeding_history();
+
+CREATE TRIGGER feed_command_completed_trigger
+  AFTER INSERT ON public.feeding_history
+  FOR EACH ROW
+  WHEN (NEW.command_id IS NOT NULL)
+  EXECUTE FUNCTION complete_feed_command();
+
 -- Add status check constraint
 ALTER TABLE public.devices 
   ADD CONSTRAINT device_status_check 
@@ -294,7 +535,7 @@ ALTER TABLE public.devices
 -- Add feeding history type check
 ALTER TABLE public.feeding_history 
   ADD CONSTRAINT feeding_type_check 
-  CHECK (type IN ('manual', 'scheduled', 'error'));
+  CHECK (type IN ('manual', 'scheduled', 'local', 'error'));
 
 -- Add feed command status check constraint
 ALTER TABLE public.feed_commands 
@@ -303,4 +544,14 @@ ALTER TABLE public.feed_commands
 
 ALTER TABLE public.feed_commands 
   ADD CONSTRAINT feed_command_amount_check 
-  CHECK (amount > 0);
\ No newline at end of file
+  CHECK (amount > 0);
+-- Publish feed_commands to Supabase Realtime so devices get new commands
+-- pushed instead of polling for them
+DO $$
+BEGIN
+    IF NOT EXISTS (SELECT 1 FROM pg_publication_tables
+                   WHERE pubname = 'supabase_realtime'
+                     AND schemaname = 'public' AND tablename = 'feed_commands') THEN
+        ALTER PUBLICATION supabase_realtime ADD TABLE public.feed_commands;
+    END IF;
+END $$;
@@ -1,11 +1,33 @@
 #include <Arduino.h>
 #include "WiFiManager.h"
+#include "Dispenser.h"
+#include "TaskScheduler.h"
+#include "SupabaseSession.h"
+#include "TelemetryAggregator.h"
+#include "RealtimeCommandChannel.h"
+#include "FeedingJournal.h"
+#include "DeviceIdentity.h"
+#include "JsonArrayReader.h"
+#include "ScheduleIndex.h"
+#include "UltrasonicSensor.h"
+#include "BatteryMonitor.h"
+#include "PowerManager.h"
+#include "ConfigStore.h"
+#include "SpscQueue.h"
+#include "WorkerTask.h"
+#include "FeederMessages.h"
+#include "Metrics.h"
+#include "FlowModel.h"
+#include "LocalAuth.h"
 #include <ESP32Servo.h>
 #include <HTTPClient.h>
 #include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
-#include <EEPROM.h>
+#include <ESPAsyncWebServer.h>
+#include <ESPmDNS.h>
 #include <time.h>
+#include <atomic>
+#include <mutex>
 
 // Pin Definitions
 #define SERVO_PIN 13
@@ -19,21 +41,170 @@
 #define SUPABASE_API_KEY "your-supabase-anon-key"
 #define SUPABASE_JWT_TOKEN "your-jwt-token" // Generated after user authentication
 
+// Realtime endpoint for feed command push, can point at a local ws:// stand-in
+#ifndef SUPABASE_REALTIME_URL
+#define SUPABASE_REALTIME_URL "wss://your-project-id.supabase.co/realtime/v1/websocket?apikey=" SUPABASE_API_KEY "&vsn=1.0.0"
+#endif
+
 // Constants
 #define FEED_AMOUNT_PER_SECOND 5 // grams per second
 #define MAX_FEED_AMOUNT 100 // maximum amount in grams
 
+// Local web server for /metrics and the LAN API, on another port than the
+// setup portal. Advertised over mDNS as _petfeeder._tcp.
+#define LOCAL_SERVER_PORT 8080
+#define LOCAL_HISTORY_LIMIT 20   // most feeding events one history request returns
+#define MDNS_SERVICE "petfeeder"
+
+// Also upload a metrics summary with the device row
+#ifndef METRICS_IN_TELEMETRY
+#define METRICS_IN_TELEMETRY 0
+#endif
+
+// Settings namespace, separate from the WiFi manager's
+#define SETTINGS_NAMESPACE "feeder"
+#define SCHEDULES_VERSION 2
+#define FLOW_VERSION 1
+#define FIRED_VERSION 1
+
+// The resolved devices row UUID, in a namespace the network task owns
+#define IDENTITY_NAMESPACE "identity"
+#define IDENTITY_VERSION 1
+#define UUID_RETRY_INTERVAL 30000 // between failed devices lookups
+
+// Wait after a feed settles before reading the level for the flow model
+#define FLOW_SETTLE_MS 3000
+
+// Task periods
+#define WIFI_UPDATE_INTERVAL 100       // WiFi manager and captive portal
+#define TIME_SYNC_INTERVAL 3600000     // Every hour
+#define STATUS_UPDATE_INTERVAL 60000   // Every minute
+#define SCHEDULE_CHECK_INTERVAL 600000 // Longest sleep between schedule checks
+#define TIME_RETRY_INTERVAL 30000      // Schedule checks until the clock is set
+#define REALTIME_SERVICE_INTERVAL 50   // Realtime socket
+#define SYNC_INTERVAL 60000            // Every minute
+#define JOURNAL_DRAIN_INTERVAL 30000   // Retry uploading feeding history
+#define JOURNAL_BATCH_SIZE 20          // Feeding events per bulk insert
+#define COMMAND_STATUS_BATCH 6         // Command ids per bulk status update
+#define FOOD_LEVEL_INTERVAL 100        // Food and battery level while feeding
+#define FOOD_LEVEL_IDLE_INTERVAL 5000  // Food and battery level otherwise
+#define SENSOR_REPORT_INTERVAL 60000   // Longest gap between samples sent for telemetry
+#define BATTERY_SAMPLE_INTERVAL 1000   // ADC burst collection
+#define POWER_CHECK_INTERVAL 1000      // Deep sleep eligibility
+
+// Worker tasks. The WiFi stack runs on core 0, so networking shares it and
+// the servo and sensors get core 1 to themselves.
+#define NETWORK_TASK_STACK 12288       // TLS handshakes need the room
+#define NETWORK_TASK_PRIORITY 1
+#define NETWORK_TASK_CORE 0
+#define CONTROL_TASK_STACK 4096
+#define CONTROL_TASK_PRIORITY 3        // servo timing beats uploads
+#define CONTROL_TASK_CORE 1
+
 // Create instances
 WiFiManager wifiManager;
 Servo feederServo;
-WiFiClientSecure client;
-HTTPClient http;
+UltrasonicSensor foodSensor(TRIG_PIN, ECHO_PIN);
+BatteryMonitor battery(BATTERY_LEVEL_PIN);
+SupabaseSession supabase(SUPABASE_URL, SUPABASE_API_KEY, SUPABASE_JWT_TOKEN);
+Dispenser dispenser(feederServo, LED_PIN, FEED_AMOUNT_PER_SECOND);
+TaskScheduler scheduler;          // network task jobs
+TaskScheduler controlScheduler;   // control task jobs
+TelemetryAggregator telemetry;
+RealtimeCommandChannel realtime;
+FeedingJournal journal;
+DeviceIdentity device;
+ScheduleIndex scheduleIndex;
+PowerManager power;
+ConfigStore settings(SETTINGS_NAMESPACE);
+ConfigStore identityStore(IDENTITY_NAMESPACE);
+WorkerTask networkTask;
+WorkerTask controlTask;
+Metrics metrics;
+FlowModel flowModel(FEED_AMOUNT_PER_SECOND);
+AsyncWebServer localServer(LOCAL_SERVER_PORT);
+AsyncWebSocket localSocket("/ws");
+LocalAuth localAuth;
+
+// Queues between the tasks, each with one producer and one consumer
+SpscQueue<FeedRequest, MESSAGE_QUEUE_DEPTH> feedRequests;       // network -> control
+SpscQueue<FeedRequest, MESSAGE_QUEUE_DEPTH> localFeedRequests;  // web server -> control
+SpscQueue<ScheduleTable, SCHEDULE_QUEUE_DEPTH> scheduleUpdates; // network -> control
+SpscQueue<FeedEvent, MESSAGE_QUEUE_DEPTH> feedEvents;           // control -> network
+SpscQueue<SensorSample, MESSAGE_QUEUE_DEPTH> sensorSamples;     // control -> network
+
+// Published by the network task for the control task's sleep decisions
+struct NetworkStatus {
+    std::atomic<bool> offline;          // WiFi backing off between join rounds, no portal to serve
+    std::atomic<bool> idle;             // nothing left to upload, portal closed
+    std::atomic<uint32_t> wakeAt;       // millis() when the next network job is due
+    std::atomic<uint32_t> heartbeatAt;  // millis() when the next heartbeat is due
+    std::atomic<uint32_t> journalHead;
+    std::atomic<uint32_t> journalAcked;
+};
+NetworkStatus networkStatus;
+
+// Published by the control task for the local API, which answers from the
+// web server's task
+struct LocalStatus {
+    std::atomic<int16_t> foodLevel;
+    std::atomic<int16_t> batteryLevel;
+    std::atomic<bool> dispensing;
+    std::atomic<int16_t> lastFeedAmount;
+    std::atomic<uint32_t> lastFeedAt;   // unix time, 0 if none since boot
+    std::atomic<int16_t> feedSlots;     // requests the dispenser can still queue
+};
+LocalStatus localStatus;
+
+// Newest journal entries, newest first, for /api/history. The network task
+// owns the journal and refreshes this copy after each append; the web
+// server's task only reads it, under the lock.
+struct RecentHistory {
+    std::mutex lock;
+    FeedingJournal::Entry entries[LOCAL_HISTORY_LIMIT];
+    uint16_t count;
+};
+RecentHistory recentHistory;
 
 // Global variables
-unsigned long lastStatusUpdate = 0;
-unsigned long lastScheduleCheck = 0;
-unsigned long lastTimeSync = 0;
-struct tm timeinfo;
+int scheduleTask = -1;
+int commandTask = -1;
+int journalTask = -1;
+int foodTask = -1;
+bool commandsPolled = false; // a command poll succeeded since boot
+unsigned long uuidRetryAt = 0; // earliest next devices lookup while unresolved
+bool localTokenPublished = false; // devices row has the local API token
+bool mdnsStarted = false;
+
+// Arrival times of queued local feeds, in dispense order, for measuring
+// request to hopper latency. Owned by the control task.
+uint32_t localFeedArrivals[DISPENSER_QUEUE_SIZE];
+uint8_t localFeedHead = 0;
+uint8_t localFeedCount = 0;
+uint32_t activeLocalFeedUs = 0;
+uint32_t wifiGeneration = 0; // last WiFi connect/disconnect handled
+
+// Claimed commands waiting for a bulk status update, owned by the network
+// task. Completed commands need none, the history insert completes them.
+struct CommandStatusBatch {
+    const char* status;
+    uint8_t count;
+    char ids[COMMAND_STATUS_BATCH][COMMAND_ID_LENGTH];
+};
+CommandStatusBatch failedCommands = {"error", 0, {}};     // rejected by the control task
+CommandStatusBatch releasedCommands = {"pending", 0, {}}; // claimed but not queued, claim again
+uint8_t unresolvedCommands = 0; // sent to the control task, not yet queued or rejected
+
+// Feed being measured for the flow model, owned by the control task
+struct FlowSample {
+    bool active;                // hopper opened, sample not taken yet
+    bool settled;               // feed complete, waiting for the sensor
+    int amount;
+    int levelBefore;
+    unsigned long holdMs;
+    unsigned long completedAt;
+};
+FlowSample flowSample;
 
 // Feeding schedule structure
 struct FeedingSchedule {
@@ -44,95 +215,598 @@ struct FeedingSchedule {
     bool days[7]; // Sunday to Saturday
 };
 
-FeedingSchedule schedules[10]; // Maximum 10 schedules
+// Owned by the control task once it starts. The network task sends
+// replacements as a ScheduleTable, which is also how they are kept in flash
+// so a cold boot without WiFi still feeds.
+FeedingSchedule schedules[MAX_INDEXED_SCHEDULES];
 int scheduleCount = 0;
+DeviceConfig deviceConfig;
+
+// The network task's copy of the synced schedules and config. Each sync
+// applies its changes here and sends the whole table to the control task.
+ScheduleTable syncedTable;
 
 // Function declarations
 // Function declarations
 void setupHardware();
+void setupTasks();
+void setupMetrics();
+void setupLocalApi();
+void startMdns();
+bool localAuthorized(AsyncWebServerRequest* request);
+int queueLocalFeed(int amount, uint32_t receivedUs);
+void writeLocalStatus(JsonDocument& doc);
+void broadcastFeedEvent(const FeedEvent& event);
+void startFeedRequest(const FeedRequest& request);
+void startTasks();
+void networkLoop();
+void controlLoop();
 void handleFeeding();
-void updateFoodLevel();
+void sampleSensors();
+void updateFlowModel();
 void syncWithSupabase();
 void updateDeviceStatus();
-void loadSchedules();
+bool applySyncedSchedule(ScheduleTable& table, JsonObject obj);
+void removeSyncedSchedule(ScheduleTable& table, const char* id);
+void readSyncedConfig(JsonObject obj, DeviceConfig& config);
+void applyDeviceConfig(const DeviceConfig& config);
 void checkSchedules();
-void checkForManualFeedCommand();
-void updateCommandStatus(String commandId, String status);
-void logFeedingEvent(int amount, String type);
-void feed(int amount);
+void buildScheduleIndex();
+bool claimFeedCommands();
+void handleFeedCommand(const String& commandId, int amount);
+void queueCommandStatus(CommandStatusBatch& batch, const char* commandId);
+bool flushCommandStatus(CommandStatusBatch& batch);
+void logFeedingEvent(int amount, const String& type, time_t timestamp, const char* commandId = "");
+void drainJournal();
+bool formatUtcTime(time_t t, char* out, size_t size);
+bool feed(int amount, const String& type, const String& commandId = "");
+void handleFeedRequests();
+void publishFeedSlots();
+size_t claimableCommands();
+void applyScheduleUpdates();
+void applyScheduleTable(const ScheduleTable& table);
+void reportFeed(FeedEvent::Kind kind, int amount, const char* type, const char* commandId, unsigned long actualHoldMs);
+void handleControlMessages();
+void publishNetworkStatus();
+void refreshRecentHistory();
+void onDispenseProgress(const Dispenser::Request& request, Dispenser::State state, unsigned long elapsedMs, unsigned long holdMs);
+void onDispenseComplete(const Dispenser::Request& request, unsigned long actualHoldMs);
 int readFoodLevel();
 int readBatteryLevel();
-void updateBatteryLevel();
+void flushTelemetry();
+void restoreSchedules();
+void saveStoredSchedules(const ScheduleTable& table);
+bool loadStoredSchedules();
+void saveFiredSchedules();
+void loadFiredSchedules();
+void enterDeepSleepIfIdle();
+void onWiFiConnected();
+void loadDeviceIdentity();
+bool resolveDeviceUuid();
+void startRealtime();
 
 void setup() {
     Serial.begin(115200);
     
+    // Check for state kept in RTC memory over deep sleep
+    bool resumed = power.begin();
+    
     // Initialize hardware
     setupHardware();
+    dispenser.onProgress(onDispenseProgress);
+    dispenser.onComplete(onDispenseComplete);
+    publishFeedSlots();
+    
+    // Open the settings namespace
+    settings.begin();
+    
+    // Open times come from the learned flow rate
+    FlowModel::Snapshot flow;
+    if (settings.load("flow", flow, FLOW_VERSION)) {
+        flowModel.restore(flow);
+    }
+    dispenser.setHoldTime([](int grams) {
+        return flowModel.holdMs(grams, readFoodLevel());
+    });
+    
+    // Recover feeding events not yet uploaded
+    journal.begin(resumed ? &power.state().journal : nullptr);
+    refreshRecentHistory();
     
-    // Initialize EEPROM
-    EEPROM.begin(512);
+    // Start WiFi manager, rejoining the last access point after deep sleep
+    if (resumed && power.state().ssid[0] != '\0') {
+        wifiManager.resume(power.state().ssid, power.state().bssid, power.state().channel);
+    } else {
+        wifiManager.begin();
+    }
+    device.begin();
+    loadDeviceIdentity();
+    localAuth.begin(SUPABASE_JWT_TOKEN, device.id());
+    
+    // Profile jobs and requests, and serve the results and the LAN API
+    setupMetrics();
+    setupLocalApi();
+    
+    // Schedules kept over deep sleep can fire before they are fetched
+    // again, after a cold boot fall back to the copy in flash. Syncing
+    // continues from the version stored with that copy either way.
+    loadStoredSchedules();
+    if (resumed) {
+        restoreSchedules();
+        applyDeviceConfig(syncedTable.config);
+    } else {
+        loadFiredSchedules();
+        applyScheduleTable(syncedTable);
+    }
+    
+    // Configure the shared keep-alive session to Supabase
+    supabase.begin();
     
-    // Start WiFi manager
-    wifiManager.begin();
+    // Subscribe to feed commands, the socket connects once WiFi is up and
+    // the device UUID is known. A pushed command is only a hint: it is
+    // claimed like a polled one, so the socket and a poll can never both
+    // dispense it.
+    realtime.onCommand([](const String&, int) {
+        scheduler.trigger(commandTask);
+    });
+    realtime.onSubscribed([]() {
+        scheduler.trigger(commandTask);
+    });
+    if (device.hasUuid()) {
+        startRealtime();
+    }
     
     // Wait for connection or hotspot mode
     while (!wifiManager.isConnected() && !wifiManager.isHotspotEnabled()) {
+        wifiManager.update();
         delay(100);
     }
+    wifiGeneration = wifiManager.getGeneration();
     
     if (wifiManager.isConnected()) {
+        power.markConnected();
+        
         // Initialize time
         configTime(0, 0, "pool.ntp.org", "time.nist.gov");
-        
-        // Skip SSL certificate verification (for development only)
-        client.setInsecure();
+        resolveDeviceUuid();
         
         // Update device status
+        telemetry.requestFlush();
         updateDeviceStatus();
+        startMdns();
         
-        // Load feeding schedules
-        loadSchedules();
+        // Catch up on schedule and config changes made while away
+        syncWithSupabase();
     }
+    
+    setupTasks();
+    startTasks();
 }
 
+// Everything runs on the two worker tasks
 void loop() {
-    // Update WiFi manager
-    wifiManager.update();
+    vTaskDelete(NULL);
+}
+
+// Start the worker tasks. The network task talks to WiFi and Supabase, the
+// control task runs the dispenser, sensors and schedules, so a slow request
+// never delays the servo. They only share the queues and networkStatus.
+void startTasks() {
+    publishNetworkStatus();
     
-    // If connected to WiFi, sync with Supabase
-    if (wifiManager.isConnected()) {
-        // Update time periodically
-        if (millis() - lastTimeSync > 3600000) { // Every hour
-            getLocalTime(&timeinfo);
-            lastTimeSync = millis();
+    if (!controlTask.start("control", CONTROL_TASK_STACK, CONTROL_TASK_PRIORITY, CONTROL_TASK_CORE, controlLoop)) {
+        Serial.println("Failed to start control task");
+    }
+    if (!networkTask.start("network", NETWORK_TASK_STACK, NETWORK_TASK_PRIORITY, NETWORK_TASK_CORE, networkLoop)) {
+        Serial.println("Failed to start network task");
+    }
+}
+
+// One pass of the network task
+void networkLoop() {
+    // Run periodic jobs that are due
+    scheduler.runDue();
+    
+    // Upload what the control task reported
+    unsigned long start = micros();
+    handleControlMessages();
+    metrics.recordPhase("messages", micros() - start);
+    publishNetworkStatus();
+    
+    // Sleep until the next job is due or the control task reports something
+    networkTask.waitFor(min(scheduler.msUntilNext(), SCHEDULER_IDLE_WAIT));
+}
+
+// One pass of the control task
+void controlLoop() {
+    // Pick up commands and schedules from the network task
+    handleFeedRequests();
+    applyScheduleUpdates();
+    
+    // Run periodic jobs that are due
+    controlScheduler.runDue();
+    
+    // Handle local operations
+    dispenser.update();
+    publishFeedSlots();
+    handleFeeding();
+    
+    // Sleep until the next job or dispenser step is due. Light sleep stops
+    // both cores and the radio, so it is only safe with no servo pulse to
+    // hold and WiFi backing off between join rounds, with no network job
+    // due before then either. A join or scan in progress keeps it awake.
+    unsigned long wait = min(controlScheduler.msUntilNext(), dispenser.msUntilNextStep());
+    if (wait == 0) {
+        return;
+    }
+    if (networkStatus.offline && !dispenser.isBusy()) {
+        long untilNetwork = (long)(networkStatus.wakeAt - (uint32_t)millis());
+        if (untilNetwork > 0 && power.lightSleep(min(wait, (unsigned long)untilNetwork))) {
+            return;
+        }
+    }
+    controlTask.waitFor(min(wait, SCHEDULER_IDLE_WAIT));
+}
+
+// Register the periodic jobs of both tasks. Jobs that talk to Supabase are
+// skipped while WiFi is down.
+void setupTasks() {
+    // name, period, job, priority, jitter, first run
+    scheduler.addTask("wifi", WIFI_UPDATE_INTERVAL, []() {
+        wifiManager.update();
+        if (wifiManager.getGeneration() != wifiGeneration) {
+            wifiGeneration = wifiManager.getGeneration();
+            if (wifiManager.isConnected()) onWiFiConnected();
+        }
+    }, 3, 20);
+    
+    scheduler.addTask("time", TIME_SYNC_INTERVAL, []() {
+        struct tm timeinfo;
+        if (wifiManager.isConnected()) getLocalTime(&timeinfo);
+    }, 0, 60000, TIME_SYNC_INTERVAL);
+    
+    scheduler.addTask("status", STATUS_UPDATE_INTERVAL, []() {
+        if (wifiManager.isConnected()) updateDeviceStatus();
+    }, 1, 5000, STATUS_UPDATE_INTERVAL);
+    
+    scheduler.addTask("realtime", REALTIME_SERVICE_INTERVAL, []() {
+        if (wifiManager.isConnected() && device.hasUuid()) realtime.loop();
+    }, 3, 20);
+    
+    // Commands are pushed over realtime. Poll to catch up after subscribing
+    // or a push, as a fallback that backs off while the socket is down, and
+    // slowly while subscribed in case the channel never delivers.
+    commandTask = scheduler.addTask("commands", COMMAND_POLL_MIN_INTERVAL, []() {
+        if (!wifiManager.isConnected()) return;
+        bool found = claimFeedCommands();
+        scheduler.setPeriod(commandTask, realtime.nextPollInterval(found));
+    }, 2, 500);
+    
+    journalTask = scheduler.addTask("journal", JOURNAL_DRAIN_INTERVAL, []() {
+        if (wifiManager.isConnected()) drainJournal();
+    }, 1, 5000, 0);
+    
+    scheduler.addTask("sync", SYNC_INTERVAL, []() {
+        if (wifiManager.isConnected()) syncWithSupabase();
+    }, 0, 5000);
+    
+    // Control task. Reschedules itself for the next due feed, runs offline too.
+    scheduleTask = controlScheduler.addTask("schedules", SCHEDULE_CHECK_INTERVAL, []() {
+        checkSchedules();
+    }, 2, 0, 0);
+    
+    controlScheduler.addTask("battery", BATTERY_SAMPLE_INTERVAL, []() {
+        battery.update();
+    }, 0, 200);
+    
+    foodTask = controlScheduler.addTask("food", FOOD_LEVEL_IDLE_INTERVAL, []() {
+        sampleSensors();
+    }, 0, 50);
+    
+    controlScheduler.addTask("power", POWER_CHECK_INTERVAL, []() {
+        enterDeepSleepIfIdle();
+    }, 0, 0, POWER_CHECK_INTERVAL);
+}
+
+// Time every job on both tasks and every Supabase request, and serve the
+// results in the Prometheus text format on the local web server
+void setupMetrics() {
+    scheduler.setObserver([](const char* name, unsigned long runUs) {
+        metrics.recordPhase(name, runUs);
+    });
+    controlScheduler.setObserver([](const char* name, unsigned long runUs) {
+        metrics.recordPhase(name, runUs);
+    });
+    supabase.setObserver([](unsigned long roundTripMs, bool newConnection, int code) {
+        metrics.recordRequest(roundTripMs, newConnection, code);
+    });
+    
+    // Runs on the web server's task, reads the counters as they are. Needs
+    // the local API token like the rest of the LAN API.
+    localServer.on("/metrics", HTTP_GET, [](AsyncWebServerRequest* request) {
+        if (!localAuthorized(request)) {
+            request->send(401, "application/json", "{\"error\":\"unauthorized\"}");
+            return;
+        }
+        AsyncResponseStream* response = request->beginResponseStream("text/plain; version=0.0.4");
+        metrics.write(*response);
+        flowModel.write(*response);
+        response->print("# TYPE feeder_local_auth_rejected_total counter\n");
+        response->printf("feeder_local_auth_rejected_total %u\n", localAuth.getStats().rejected);
+        request->send(response);
+    });
+}
+
+// Authenticated LAN API for the web app on the same network: feed, status,
+// food level and recent history over HTTP, and a WebSocket at /ws that
+// accepts feeds and pushes every feed as it progresses. A local feed skips
+// Supabase on the way in, and is journaled and uploaded like any other.
+// Handlers run on the web server's task.
+void setupLocalApi() {
+    localServer.on("/api/status", HTTP_GET, [](AsyncWebServerRequest* request) {
+        if (!localAuthorized(request)) {
+            request->send(401, "application/json", "{\"error\":\"unauthorized\"}");
+            return;
+        }
+        JsonDocument doc;
+        writeLocalStatus(doc);
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+        serializeJson(doc, *response);
+        request->send(response);
+    });
+    
+    localServer.on("/api/food", HTTP_GET, [](AsyncWebServerRequest* request) {
+        if (!localAuthorized(request)) {
+            request->send(401, "application/json", "{\"error\":\"unauthorized\"}");
+            return;
+        }
+        int level = localStatus.foodLevel;
+        JsonDocument doc;
+        doc["food_level"] = level;
+        if (level >= 0) {
+            doc["grams"] = level * FLOW_HOPPER_GRAMS / 100;
+        }
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+        serializeJson(doc, *response);
+        request->send(response);
+    });
+    
+    localServer.on("/api/history", HTTP_GET, [](AsyncWebServerRequest* request) {
+        if (!localAuthorized(request)) {
+            request->send(401, "application/json", "{\"error\":\"unauthorized\"}");
+            return;
+        }
+        int limit = LOCAL_HISTORY_LIMIT;
+        if (request->hasParam("limit")) {
+            limit = constrain(request->getParam("limit")->value().toInt(), 1, LOCAL_HISTORY_LIMIT);
         }
         
-        // Update device status periodically
-        if (millis() - lastStatusUpdate > 60000) { // Every minute
-            updateDeviceStatus();
-            lastStatusUpdate = millis();
+        // From the network task's copy of the journal, so feeds not
+        // uploaded yet are included
+        uint32_t acked = networkStatus.journalAcked;
+        JsonDocument doc;
+        JsonArray rows = doc.to<JsonArray>();
+        {
+            std::lock_guard<std::mutex> guard(recentHistory.lock);
+            uint16_t count = min((uint16_t)limit, recentHistory.count);
+            for (uint16_t i = 0; i < count; i++) {
+                const FeedingJournal::Entry& entry = recentHistory.entries[i];
+                JsonObject row = rows.add<JsonObject>();
+                row["seq"] = entry.seq;
+                row["amount"] = entry.amount;
+                row["type"] = entry.type;
+                row["timestamp"] = entry.timestamp;
+                if (entry.commandId[0] != '\0') {
+                    row["command_id"] = entry.commandId;
+                }
+                row["synced"] = entry.seq <= acked;
+            }
+        }
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+        serializeJson(doc, *response);
+        request->send(response);
+    });
+    
+    // amount as a form or query parameter
+    localServer.on("/api/feed", HTTP_POST, [](AsyncWebServerRequest* request) {
+        uint32_t receivedUs = micros();
+        if (!localAuthorized(request)) {
+            request->send(401, "application/json", "{\"error\":\"unauthorized\"}");
+            return;
+        }
+        int amount = 0;
+        if (request->hasParam("amount", true)) {
+            amount = request->getParam("amount", true)->value().toInt();
+        } else if (request->hasParam("amount")) {
+            amount = request->getParam("amount")->value().toInt();
         }
         
-        // Check feeding schedules
-        if (millis() - lastScheduleCheck > 30000) { // Every 30 seconds
-            checkSchedules();
-            lastScheduleCheck = millis();
+        int code = queueLocalFeed(amount, receivedUs);
+        char body[48];
+        snprintf(body, sizeof(body), "{\"queued\":%s,\"amount\":%d}", code == 202 ? "true" : "false", amount);
+        request->send(code, "application/json", body);
+    });
+    
+    // Browsers cannot set headers on a WebSocket, so it takes ?token=
+    localSocket.setFilter(localAuthorized);
+    localSocket.onEvent([](AsyncWebSocket*, AsyncWebSocketClient* client, AwsEventType type,
+                           void* arg, uint8_t* data, size_t length) {
+        if (type == WS_EVT_CONNECT) {
+            JsonDocument doc;
+            doc["event"] = "status";
+            writeLocalStatus(doc);
+            char buffer[256];
+            serializeJson(doc, buffer, sizeof(buffer));
+            client->text(buffer);
+            return;
+        }
+        if (type != WS_EVT_DATA) {
+            return;
         }
         
-        // Check for manual feed commands
-        checkForManualFeedCommand();
+        // Single-frame text messages only: {"feed": grams}
+        AwsFrameInfo* frame = (AwsFrameInfo*)arg;
+        if (!frame->final || frame->index != 0 || frame->len != length || frame->opcode != WS_TEXT) {
+            return;
+        }
+        uint32_t receivedUs = micros();
+        JsonDocument doc;
+        if (deserializeJson(doc, data, length) || !doc["feed"].is<int>()) {
+            client->text("{\"event\":\"error\",\"error\":\"expected a feed amount\"}");
+            return;
+        }
         
-        // Sync with Supabase
-        syncWithSupabase();
+        int amount = doc["feed"];
+        int code = queueLocalFeed(amount, receivedUs);
+        char reply[64];
+        snprintf(reply, sizeof(reply), "{\"event\":\"ack\",\"queued\":%s,\"amount\":%d}",
+                 code == 202 ? "true" : "false", amount);
+        client->text(reply);
+    });
+    localServer.addHandler(&localSocket);
+    
+    localServer.begin();
+}
+
+// Advertise the local API once WiFi is up, as petfeeder-<id>.local
+void startMdns() {
+    if (mdnsStarted) {
+        return;
     }
     
-    // Handle local operations
-    handleFeeding();
-    updateFoodLevel();
+    char hostname[32];
+    snprintf(hostname, sizeof(hostname), "petfeeder-%s", device.id());
+    if (!MDNS.begin(hostname)) {
+        Serial.println("mDNS failed to start");
+        return;
+    }
+    MDNS.addService(MDNS_SERVICE, "tcp", LOCAL_SERVER_PORT);
+    MDNS.addServiceTxt(MDNS_SERVICE, "tcp", "id", device.id());
+    MDNS.addServiceTxt(MDNS_SERVICE, "tcp", "api", "/api");
+    mdnsStarted = true;
+    
+    Serial.printf("Local API at http://%s.local:%d/api\n", hostname, LOCAL_SERVER_PORT);
+}
+
+// True if the request carries the local API token, as a bearer header or
+// as a token parameter
+bool localAuthorized(AsyncWebServerRequest* request) {
+    const char* token = nullptr;
+    if (request->hasHeader("Authorization")) {
+        const String& value = request->getHeader("Authorization")->value();
+        if (value.startsWith("Bearer ")) {
+            token = value.c_str() + 7;
+        }
+    } else if (request->hasParam("token")) {
+        token = request->getParam("token")->value().c_str();
+    }
+    return localAuth.check(token);
+}
+
+// Web server task: pass a local feed to the control task. Returns the HTTP
+// status to answer with; how the feed goes is pushed over the WebSocket.
+int queueLocalFeed(int amount, uint32_t receivedUs) {
+    if (amount <= 0) {
+        return 400;
+    }
+    
+    FeedRequest request;
+    request.amount = constrain(amount, INT16_MIN, INT16_MAX);
+    strlcpy(request.type, "local", sizeof(request.type));
+    request.commandId[0] = '\0';
+    request.receivedUs = receivedUs;
+    
+    if (!localFeedRequests.push(request)) {
+        return 503;
+    }
+    controlTask.wake();
+    return 202;
+}
+
+// What the local API reports as status, from values the tasks publish
+void writeLocalStatus(JsonDocument& doc) {
+    doc["device_id"] = device.id();
+    doc["food_level"] = (int)localStatus.foodLevel;
+    doc["battery_level"] = (int)localStatus.batteryLevel;
+    doc["dispensing"] = (bool)localStatus.dispensing;
+    doc["last_feed_amount"] = (int)localStatus.lastFeedAmount;
+    doc["last_feed_at"] = (uint32_t)localStatus.lastFeedAt;
+    doc["journal_pending"] = networkStatus.journalHead - networkStatus.journalAcked;
+    doc["uptime_ms"] = millis();
+}
+
+// Catch up on work that waited for the network after a reconnect
+void onWiFiConnected() {
+    const WiFiManager::Stats& stats = wifiManager.getStats();
+    Serial.printf("WiFi connected to %s (score %d, %d dBm, %u%% failures), %u roams, %u failed\n",
+                  wifiManager.getCurrentSSID().c_str(), stats.chosen.score, stats.chosen.rssi,
+                  stats.chosen.failureRate, stats.roams, stats.roamFailures);
+    
+    power.markConnected();
+    telemetry.requestFlush();
+    scheduler.trigger(journalTask);
+    startMdns();
+}
+
+// Load the devices row UUID stored for this board by resolveDeviceUuid()
+void loadDeviceIdentity() {
+    identityStore.begin();
+    DeviceIdentity::Snapshot stored;
+    if (identityStore.load("device", stored, IDENTITY_VERSION) && device.restore(stored)) {
+        Serial.printf("Device UUID: %s\n", device.uuid());
+    }
+}
+
+// Look up the devices row UUID for this MAC and keep it in flash, so only
+// the first boot of a new board pays for the round trip. Requests that
+// reference the device wait for this; failures retry every
+// UUID_RETRY_INTERVAL.
+bool resolveDeviceUuid() {
+    if (device.hasUuid()) {
+        return true;
+    }
+    if ((long)(millis() - uuidRetryAt) < 0) {
+        return false;
+    }
+    uuidRetryAt = millis() + UUID_RETRY_INTERVAL;
+    
+    char path[SUPABASE_PATH_LENGTH];
+    snprintf(path, sizeof(path), "/rest/v1/devices?mac_address=eq.%s&select=id", device.id());
+    
+    int httpResponseCode = supabase.send("GET", path);
+    if (httpResponseCode != 200) {
+        supabase.end();
+        Serial.print("Error resolving device UUID: ");
+        Serial.println(httpResponseCode);
+        return false;
+    }
+    
+    JsonDocument doc;
+    DeserializationError error = deserializeJson(doc, supabase.getBody());
+    supabase.end();
     
-    // Small delay to prevent tight loops
-    delay(100);
+    const char* uuid = doc[0]["id"];
+    if (error || uuid == nullptr) {
+        Serial.printf("Device %s is not registered\n", device.id());
+        return false;
+    }
+    
+    device.setUuid(uuid);
+    DeviceIdentity::Snapshot snapshot;
+    device.save(snapshot);
+    if (!identityStore.save("device", snapshot, IDENTITY_VERSION)) {
+        Serial.println("Failed to store device UUID");
+    }
+    Serial.printf("Device UUID: %s\n", device.uuid());
+    
+    startRealtime();
+    return true;
+}
+
+// Subscribe to this device's feed commands. Needs the devices row UUID,
+// which is what feed_commands.device_id holds.
+void startRealtime() {
+    realtime.begin(SUPABASE_REALTIME_URL, SUPABASE_JWT_TOKEN, device.uuid());
 }
 
 void setupHardware() {
@@ -142,9 +816,15 @@ void setupHardware() {
     feederServo.attach(SERVO_PIN);
     feederServo.write(0); // Initial position
     
-    // Initialize ultrasonic sensor
-    pinMode(TRIG_PIN, OUTPUT);
-    pinMode(ECHO_PIN, INPUT);
+    // Start background sampling of the ultrasonic sensor
+    if (!foodSensor.begin()) {
+        Serial.println("Failed to start food level sensor");
+    }
+    
+    // Start background sampling of the battery voltage
+    if (!battery.begin()) {
+        Serial.println("Failed to start battery monitor");
+    }
     
     // Initialize LED
     pinMode(LED_PIN, OUTPUT);
@@ -156,286 +836,760 @@ void handleFeeding() {
     // For example, check a button press to trigger manual feeding
 }
 
-void updateFoodLevel() {
-    // Read food level from sensor
-    int foodLevel = readFoodLevel();
+// Send the food and battery levels to the network task for telemetry. The
+// network task is only woken when a level has moved past its telemetry
+// deadband or SENSOR_REPORT_INTERVAL has passed, not on every sample.
+// Sampled quickly only while a feed is being dispensed or measured.
+void sampleSensors() {
+    static SensorSample reported = {-1, -1};
+    static unsigned long reportedAt = 0;
     
-    // If connected to WiFi, update food level in Supabase
-    if (wifiManager.isConnected()) {
-        String deviceId = WiFi.macAddress();
-        deviceId.replace(":", "");
-        
-        // Create JSON payload
-        JsonDocument doc;
-        doc["food_level"] = foodLevel;
-        
-        String jsonPayload;
-        serializeJson(doc, jsonPayload);
-        
-        // Send to Supabase
-        http.begin(client, String(SUPABASE_URL) + "/rest/v1/devices?id=eq." + deviceId);
-        http.addHeader("Content-Type", "application/json");
-        http.addHeader("apikey", SUPABASE_API_KEY);
-        http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-        http.addHeader("Prefer", "return=minimal");
-        
-        int httpResponseCode = http.PATCH(jsonPayload);
-        
-        if (httpResponseCode == 204) {
-            Serial.println("Food level updated successfully");
-        } else {
-            Serial.print("Error updating food level: ");
-            Serial.println(httpResponseCode);
-        }
-        
-        http.end();
-        
-        // Also update battery level if available
-        updateBatteryLevel();
+    SensorSample sample;
+    sample.foodLevel = readFoodLevel();
+    sample.batteryLevel = readBatteryLevel();
+    localStatus.foodLevel = sample.foodLevel;
+    localStatus.batteryLevel = sample.batteryLevel;
+    
+    bool moved = (sample.foodLevel >= 0 && abs(sample.foodLevel - reported.foodLevel) >= FOOD_LEVEL_DEADBAND) ||
+                 (sample.batteryLevel >= 0 && abs(sample.batteryLevel - reported.batteryLevel) >= BATTERY_LEVEL_DEADBAND);
+    if ((moved || millis() - reportedAt >= SENSOR_REPORT_INTERVAL) && sensorSamples.push(sample)) {
+        reported = sample;
+        reportedAt = millis();
+        networkTask.wake();
     }
+    
+    updateFlowModel();
+    
+    bool feeding = dispenser.isBusy() || flowSample.active;
+    controlScheduler.setPeriod(foodTask, feeding ? FOOD_LEVEL_INTERVAL : FOOD_LEVEL_IDLE_INTERVAL);
 }
 
+// Once the level has settled after a feed, fit the measured drop into the
+// flow model and keep the result in flash
+void updateFlowModel() {
+    if (!flowSample.active || !flowSample.settled || millis() - flowSample.completedAt < FLOW_SETTLE_MS) {
+        return;
+    }
+    flowSample.active = false;
+    
+    int levelAfter = readFoodLevel();
+    if (!flowModel.addSample(flowSample.amount, flowSample.holdMs, flowSample.levelBefore, levelAfter)) {
+        return;
+    }
+    
+    FlowModel::Snapshot flow;
+    flowModel.save(flow);
+    if (!settings.save("flow", flow, FLOW_VERSION)) {
+        Serial.println("Failed to store flow model");
+    }
+    
+    const FlowModel::Stats& stats = flowModel.getStats();
+    Serial.printf("Flow model: %.2f g/s at %d%%, last error %+.0f%%, average %.0f%%, %u correction feeds\n",
+                  flowModel.rateAt(levelAfter), levelAfter, stats.lastError * 100, stats.errorAvg * 100,
+                  (unsigned)stats.corrections);
+}
+
+// One round trip to the device_sync RPC. It returns the schedules changed
+// and deleted since our sync version, the config if it changed, and claims
+// pending commands in the same call, so the backend reads a few indexed
+// rows however many schedules there are. The changes are applied to
+// syncedTable, which goes to the control task whole when anything moved.
 void syncWithSupabase() {
-    // This function handles any additional synchronization with Supabase
-    // It's called periodically when WiFi is connected
+    if (!resolveDeviceUuid()) {
+        return;
+    }
+    
+    // Commands come back claimed, take no more than the dispenser can queue
+    JsonDocument request;
+    request["p_device_id"] = device.uuid();
+    request["p_since"] = syncedTable.syncVersion;
+    request["p_limit"] = claimableCommands();
+    supabase.setBody(request);
+    
+    int httpResponseCode = supabase.send("POST", "/rest/v1/rpc/device_sync");
+    
+    if (httpResponseCode != 200) {
+        Serial.print("Error syncing with Supabase: ");
+        Serial.println(httpResponseCode);
+        supabase.end();
+        return;
+    }
+    
+    // Claimed by the call, they are ours to run or release
+    commandsPolled = true;
+    
+    // Keep only the fields we read
+    JsonDocument filter;
+    filter["kind"] = true;
+    filter["version"] = true;
+    filter["full"] = true;
+    filter["config"] = true;
+    filter["id"] = true;
+    filter["time"] = true;
+    filter["amount"] = true;
+    filter["enabled"] = true;
+    filter["days"] = true;
+    
+    // Work on a copy so a full queue or a broken response leaves the old
+    // version to retry from
+    ScheduleTable table = syncedTable;
+    uint32_t version = 0;
+    bool full = false;
+    bool header = false;
+    int removed = 0;
+    int changed = 0;
+    
+    // One element at a time straight from the response, the sync header
+    // comes first, then commands, deletions and schedules
+    JsonArrayReader reader(supabase.getBody(), filter);
+    JsonDocument row;
+    while (reader.next(row)) {
+        const char* kind = row["kind"] | "";
+        if (strcmp(kind, "sync") == 0) {
+            header = true;
+            version = row["version"] | 0;
+            full = row["full"] | false;
+            if (full) {
+                table.count = 0;
+                table.config = DeviceConfig();
+            }
+            if (!row["config"].isNull()) {
+                readSyncedConfig(row["config"], table.config);
+            }
+        } else if (strcmp(kind, "command") == 0) {
+            handleFeedCommand(row["id"].as<String>(), row["amount"].as<int>());
+        } else if (!header) {
+            continue;
+        } else if (strcmp(kind, "deleted") == 0) {
+            removeSyncedSchedule(table, row["id"] | "");
+            removed++;
+        } else if (strcmp(kind, "schedule") == 0) {
+            if (applySyncedSchedule(table, row.as<JsonObject>())) {
+                changed++;
+            }
+        }
+    }
+    bool failed = reader.failed();
+    if (failed) {
+        Serial.print("deserializeJson() failed: ");
+        Serial.println(reader.errorString());
+    }
+    supabase.end();
+    
+    if (failed || !header || (version == syncedTable.syncVersion && !full)) {
+        return;
+    }
+    table.syncVersion = version;
+    
+    // The control task applies them and keeps them in flash
+    if (!scheduleUpdates.push(table)) {
+        Serial.println("Schedule update queue full, retrying on the next sync");
+        return;
+    }
+    syncedTable = table;
+    controlTask.wake();
+    
+    Serial.printf("Synced to version %u%s: %d schedules changed, %d removed, %u total\n",
+                  version, full ? " (full)" : "", changed, removed, table.count);
+}
+
+// Insert or replace one schedule of a sync response, matched by id
+bool applySyncedSchedule(ScheduleTable& table, JsonObject obj) {
+    const char* id = obj["id"] | "";
+    
+    uint8_t i = 0;
+    while (i < table.count && strcmp(table.entries[i].id, id) != 0) {
+        i++;
+    }
+    if (i == table.count) {
+        if (table.count == MAX_INDEXED_SCHEDULES) {
+            Serial.print("Too many schedules, ignoring ");
+            Serial.println(id);
+            return false;
+        }
+        table.count++;
+    }
+    
+    strlcpy(table.entries[i].id, id, sizeof(table.entries[i].id));
+    strlcpy(table.entries[i].time, obj["time"] | "", sizeof(table.entries[i].time));
+    table.entries[i].amount = obj["amount"].as<int>();
+    table.entries[i].enabled = obj["enabled"].as<bool>();
+    
+    // Parse days
+    JsonArray days = obj["days"].as<JsonArray>();
+    for (int d = 0; d < 7; d++) {
+        table.entries[i].days[d] = days[d].as<bool>();
+    }
+    return true;
+}
+
+// Drop a deleted schedule, keeping the rest in order
+void removeSyncedSchedule(ScheduleTable& table, const char* id) {
+    for (uint8_t i = 0; i < table.count; i++) {
+        if (strcmp(table.entries[i].id, id) == 0) {
+            memmove(&table.entries[i], &table.entries[i + 1], (table.count - i - 1) * sizeof(table.entries[0]));
+            table.count--;
+            return;
+        }
+    }
+}
+
+// Read the device config object, keys that are missing keep their default
+void readSyncedConfig(JsonObject obj, DeviceConfig& config) {
+    config = DeviceConfig();
+    config.maxFeedAmount = constrain(obj["max_feed_amount"] | 0, 0, INT16_MAX);
+    config.feedRate = max(obj["feed_amount_per_second"] | 0.0f, 0.0f);
 }
 
 // Update device status in Supabase
 void updateDeviceStatus() {
-    String deviceId = WiFi.macAddress();
-    deviceId.replace(":", "");
+    telemetry.setRssi(WiFi.RSSI());
+    telemetry.setIpAddress(WiFi.localIP().toString());
+    flushTelemetry();
+}
+
+// Upload the device row as a single PATCH when a field has moved past its
+// deadband or the heartbeat interval has expired
+void flushTelemetry() {
+    if (!wifiManager.isConnected() || !telemetry.shouldFlush() || !resolveDeviceUuid()) {
+        return;
+    }
     
-    // Get current time
-    time_t now;
-    time(&now);
+    char path[SUPABASE_PATH_LENGTH];
+    snprintf(path, sizeof(path), "/rest/v1/devices?id=eq.%s", device.uuid());
     
     // Create JSON payload
     JsonDocument doc;
-    doc["status"] = "online";
-    doc["last_seen"] = now;
-    doc["ip_address"] = WiFi.localIP().toString();
-    doc["wifi_strength"] = WiFi.RSSI();
-    
-    String jsonPayload;
-    serializeJson(doc, jsonPayload);
+    telemetry.buildPayload(doc);
+    if (!localTokenPublished) {
+        doc["local_api_token"] = localAuth.getToken();
+    }
+    if (METRICS_IN_TELEMETRY) {
+        metrics.addToPayload(doc["metrics"].to<JsonObject>());
+    }
     
     // Send to Supabase
-    http.begin(client, String(SUPABASE_URL) + "/rest/v1/devices?id=eq." + deviceId);
-    http.addHeader("Content-Type", "application/json");
-    http.addHeader("apikey", SUPABASE_API_KEY);
-    http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-    http.addHeader("Prefer", "return=minimal");
-    
-    int httpResponseCode = http.PATCH(jsonPayload);
+    int httpResponseCode = supabase.patch(path, doc);
     
     if (httpResponseCode == 204) {
+        telemetry.flushed(true);
+        localTokenPublished = true;
+        power.markRequest();
         Serial.println("Device status updated successfully");
         digitalWrite(LED_PIN, HIGH); // Turn on LED to indicate online status
+        
+        const SupabaseSession::Stats& stats = supabase.getStats();
+        Serial.printf("Supabase session: %u requests, %u handshakes, %u reused, %u retries (last handshake %lu ms)\n",
+                      stats.requests, stats.handshakes, stats.reused, stats.retries, stats.lastHandshakeMs);
+        Serial.printf("Telemetry: %u samples, %u uploads (%u heartbeats)\n",
+                      telemetry.getStats().samples, telemetry.getStats().flushes, telemetry.getStats().heartbeats);
     } else {
+        telemetry.flushed(false);
         Serial.print("Error updating device status: ");
         Serial.println(httpResponseCode);
         digitalWrite(LED_PIN, LOW); // Turn off LED to indicate error
     }
+}
+
+// Compile the enabled schedules into the minute-of-week index
+void buildScheduleIndex() {
+    scheduleIndex.clear();
+    for (int i = 0; i < scheduleCount; i++) {
+        if (!schedules[i].enabled) continue;
+        
+        int minuteOfDay = ScheduleIndex::parseTime(schedules[i].time.c_str());
+        if (!scheduleIndex.add(i, schedules[i].id.c_str(), minuteOfDay, schedules[i].days)) {
+            Serial.print("Invalid schedule time: ");
+            Serial.println(schedules[i].time);
+        }
+    }
     
-    http.end();
+    // Recompute the next wakeup
+    controlScheduler.trigger(scheduleTask);
 }
 
-// Load feeding schedules from Supabase
-void loadSchedules() {
-    String deviceId = WiFi.macAddress();
-    deviceId.replace(":", "");
+// Apply schedules sent by syncWithSupabase() and keep them in flash
+void applyScheduleUpdates() {
+    ScheduleTable table;
+    bool updated = false;
+    while (scheduleUpdates.pop(table)) {
+        updated = true;
+    }
+    if (!updated) {
+        return;
+    }
     
-    http.begin(client, String(SUPABASE_URL) + "/rest/v1/feeding_schedules?device_id=eq." + deviceId + "&select=*");
-    http.addHeader("Content-Type", "application/json");
-    http.addHeader("apikey", SUPABASE_API_KEY);
-    http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
+    applyScheduleTable(table);
+    saveStoredSchedules(table);
+}
+
+// Replace the schedule list and config, and rebuild the index
+void applyScheduleTable(const ScheduleTable& table) {
+    applyDeviceConfig(table.config);
     
-    int httpResponseCode = http.GET();
+    scheduleCount = min((int)table.count, MAX_INDEXED_SCHEDULES);
+    for (int i = 0; i < scheduleCount; i++) {
+        schedules[i].id = table.entries[i].id;
+        schedules[i].time = table.entries[i].time;
+        schedules[i].amount = table.entries[i].amount;
+        schedules[i].enabled = table.entries[i].enabled;
+        memcpy(schedules[i].days, table.entries[i].days, sizeof(schedules[i].days));
+    }
+    buildScheduleIndex();
+}
+
+// Use the limits and default flow rate set in the web app
+void applyDeviceConfig(const DeviceConfig& config) {
+    deviceConfig = config;
+    flowModel.setDefaultRate(config.feedRate > 0 ? config.feedRate : FEED_AMOUNT_PER_SECOND);
+}
+
+// Keep the schedules in flash. Nothing is written unless they changed.
+void saveStoredSchedules(const ScheduleTable& table) {
+    if (!settings.save("schedules", table, SCHEDULES_VERSION)) {
+        Serial.println("Failed to store schedules");
+    }
+}
+
+// Load the schedules stored by saveStoredSchedules() into syncedTable,
+// false if none. The next sync then asks for everything.
+bool loadStoredSchedules() {
+    if (!settings.load("schedules", syncedTable, SCHEDULES_VERSION)) {
+        memset(&syncedTable, 0, sizeof(syncedTable));
+        return false;
+    }
     
-    if (httpResponseCode == 200) {
-        String response = http.getString();
-        
-        // Parse JSON response
-        JsonDocument doc;
-        DeserializationError error = deserializeJson(doc, response);
-        
-        if (error) {
-            Serial.print("deserializeJson() failed: ");
-            Serial.println(error.c_str());
-            return;
-        }
-        
-        // Clear existing schedules
-        scheduleCount = 0;
-        
-        // Process schedules
-        JsonArray array = doc.as<JsonArray>();
-        for (JsonObject obj : array) {
-            if (scheduleCount < 10) { // Maximum 10 schedules
-                schedules[scheduleCount].id = obj["id"].as<String>();
-                schedules[scheduleCount].time = obj["time"].as<String>();
-                schedules[scheduleCount].amount = obj["amount"].as<int>();
-                schedules[scheduleCount].enabled = obj["enabled"].as<bool>();
-                
-                // Parse days
-                JsonArray days = obj["days"].as<JsonArray>();
-                for (int i = 0; i < 7; i++) {
-                    schedules[scheduleCount].days[i] = days[i].as<bool>();
-                }
-                
-                scheduleCount++;
-            }
-        }
-        
-        Serial.print("Loaded ");
-        Serial.print(scheduleCount);
-        Serial.println(" schedules");
-    } else {
-        Serial.print("Error loading schedules: ");
-        Serial.println(httpResponseCode);
+    Serial.printf("Loaded %u stored schedules at sync version %u\n", syncedTable.count, syncedTable.syncVersion);
+    return true;
+}
+
+// Keep the minute each schedule last fired in flash, so a reset around
+// feeding time neither repeats nor skips the feed
+void saveFiredSchedules() {
+    ScheduleIndex::Fired fired;
+    scheduleIndex.saveFired(fired);
+    if (!settings.save("fired", fired, FIRED_VERSION)) {
+        Serial.println("Failed to store fired schedules");
+    }
+}
+
+// After a cold boot, before the schedules are indexed
+void loadFiredSchedules() {
+    ScheduleIndex::Fired fired;
+    if (settings.load("fired", fired, FIRED_VERSION)) {
+        scheduleIndex.restoreFired(fired);
     }
+}
+
+// Rebuild the schedule table from the copy kept over deep sleep. Only the
+// index and amounts are kept, the time strings are not needed to fire.
+void restoreSchedules() {
+    const PowerManager::ResumeState& state = power.state();
+    scheduleIndex.restore(state.schedules);
     
-    http.end();
+    scheduleCount = 0;
+    for (int i = 0; i < MAX_INDEXED_SCHEDULES; i++) {
+        schedules[i].id = state.schedules.ids[i];
+        schedules[i].amount = state.amounts[i];
+        schedules[i].enabled = schedules[i].id.length() > 0;
+        if (schedules[i].enabled) scheduleCount = i + 1;
+    }
+    
+    Serial.print("Restored ");
+    Serial.print(scheduleIndex.getEventCount());
+    Serial.println(" schedule events");
 }
 
-// Check if any scheduled feeding is due
+// Power down until the next schedule, heartbeat or command poll once
+// nothing is left to do. Stays up while the portal is open or feeding
+// events are waiting to upload. Runs on the control task, the network
+// task's side comes from networkStatus.
+void enterDeepSleepIfIdle() {
+    if (!power.canDeepSleep() || dispenser.isBusy() || !networkStatus.idle || !feedEvents.isEmpty()) {
+        return;
+    }
+    
+    long untilSchedule = -1;
+    struct tm timeinfo;
+    if (getLocalTime(&timeinfo, 0)) {
+        int32_t minutes = scheduleIndex.minutesUntilNext(ScheduleIndex::minuteOfWeek(timeinfo));
+        if (minutes > 0) untilSchedule = minutes * 60000L - timeinfo.tm_sec * 1000L;
+    }
+    
+    long untilHeartbeat = (long)(networkStatus.heartbeatAt - (uint32_t)millis());
+    unsigned long sleepMs = PowerManager::deepSleepLength(untilSchedule, untilHeartbeat > 0 ? untilHeartbeat : 0);
+    if (sleepMs == 0) {
+        return;
+    }
+    
+    PowerManager::ResumeState& state = power.state();
+    scheduleIndex.save(state.schedules);
+    for (int i = 0; i < MAX_INDEXED_SCHEDULES; i++) {
+        state.amounts[i] = i < scheduleCount ? schedules[i].amount : 0;
+    }
+    state.journal.headSeq = networkStatus.journalHead;
+    state.journal.ackedSeq = networkStatus.journalAcked;
+    
+    power.deepSleep(sleepMs);
+}
+
+// Fire scheduled feedings that are due, then sleep until the next one
 void checkSchedules() {
-    if (!getLocalTime(&timeinfo)) {
+    struct tm timeinfo;
+    if (!getLocalTime(&timeinfo, 0)) {
         Serial.println("Failed to obtain time");
+        controlScheduler.trigger(scheduleTask, TIME_RETRY_INTERVAL);
         return;
     }
     
-    char timeStr[6];
-    sprintf(timeStr, "%02d:%02d", timeinfo.tm_hour, timeinfo.tm_min);
-    String currentTime = String(timeStr);
-    int currentDay = timeinfo.tm_wday; // 0 = Sunday
+    time_t now;
+    time(&now);
+    uint16_t minuteOfWeek = ScheduleIndex::minuteOfWeek(timeinfo);
     
-    for (int i = 0; i < scheduleCount; i++) {
-        if (schedules[i].enabled && 
-            schedules[i].days[currentDay] && 
-            currentTime == schedules[i].time) {
-            
-            // Time to feed!
-            Serial.print("Scheduled feeding: ");
-            Serial.print(schedules[i].amount);
-            Serial.println(" grams");
-            
-            feed(schedules[i].amount);
-            
-            // Log feeding event
-            logFeedingEvent(schedules[i].amount, "scheduled");
-            
-            // Small delay to prevent multiple triggers
-            delay(60000);
+    uint8_t fired = scheduleIndex.fireDue(now / 60, minuteOfWeek, [](uint8_t i, uint16_t minutesLate) {
+        // Time to feed!
+        Serial.print("Scheduled feeding: ");
+        Serial.print(schedules[i].amount);
+        Serial.print(" grams");
+        if (minutesLate > 0) {
+            Serial.print(", ");
+            Serial.print(minutesLate);
+            Serial.print(" min late");
         }
+        Serial.println();
+        
+        // Logged by onDispenseComplete() once the hopper is closed
+        feed(schedules[i].amount, "scheduled");
+    });
+    if (fired > 0) {
+        saveFiredSchedules();
+    }
+    
+    // Wake at the start of the next due minute. The period caps the sleep
+    // so a clock adjustment is picked up.
+    int32_t minutes = scheduleIndex.minutesUntilNext(minuteOfWeek);
+    if (minutes > 0) {
+        unsigned long wait = (unsigned long)minutes * 60000UL - timeinfo.tm_sec * 1000UL;
+        controlScheduler.trigger(scheduleTask, min(wait, (unsigned long)SCHEDULE_CHECK_INTERVAL));
     }
 }
 
-// Check for manual feed commands from Supabase
-void checkForManualFeedCommand() {
-    String deviceId = WiFi.macAddress();
-    deviceId.replace(":", "");
+// Claim pending feed commands from Supabase, returns true if any were
+// pending. A single conditional PATCH moves them to processing and returns
+// the rows it changed, so a command is handed out once even if a poll
+// races a realtime push or another request.
+bool claimFeedCommands() {
+    bool found = false;
+    if (!resolveDeviceUuid()) {
+        return false;
+    }
+    
+    // Claim no more than the dispenser can queue, the rest stay pending
+    // for the next poll instead of being claimed and rejected
+    size_t slots = claimableCommands();
+    if (slots == 0) {
+        return false;
+    }
     
-    http.begin(client, String(SUPABASE_URL) + "/rest/v1/feed_commands?device_id=eq." + deviceId + "&status=eq.pending&select=*");
-    http.addHeader("Content-Type", "application/json");
-    http.addHeader("apikey", SUPABASE_API_KEY);
-    http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
+    char path[SUPABASE_PATH_LENGTH];
+    snprintf(path, sizeof(path), "/rest/v1/feed_commands?device_id=eq.%s&status=eq.pending&select=id,amount&order=created_at,id&limit=%u",
+             device.uuid(), (unsigned)slots);
     
-    int httpResponseCode = http.GET();
+    JsonDocument claim;
+    claim["status"] = "processing";
+    supabase.setBody(claim);
+    
+    int httpResponseCode = supabase.send("PATCH", path, "return=representation");
     
     if (httpResponseCode == 200) {
-        String response = http.getString();
+        commandsPolled = true;
         
-        // Parse JSON response
-        JsonDocument doc;
-        DeserializationError error = deserializeJson(doc, response);
+        // Keep only the fields we read
+        JsonDocument filter;
+        filter["id"] = true;
+        filter["amount"] = true;
         
-        if (error) {
-            Serial.print("deserializeJson() failed: ");
-            Serial.println(error.c_str());
-            return;
+        // Process commands one at a time straight from the response
+        JsonArrayReader reader(supabase.getBody(), filter);
+        JsonDocument obj;
+        while (reader.next(obj)) {
+            found = true;
+            handleFeedCommand(obj["id"].as<String>(), obj["amount"].as<int>());
         }
         
-        // Process commands
-        JsonArray array = doc.as<JsonArray>();
-        for (JsonObject obj : array) {
-            String commandId = obj["id"].as<String>();
-            int amount = obj["amount"].as<int>();
-            
-            // Execute feed command
-            Serial.print("Manual feeding command: ");
-            Serial.print(amount);
-            Serial.println(" grams");
-            
-            feed(amount);
-            
-            // Log feeding event
-            logFeedingEvent(amount, "manual");
-            
-            // Update command status to completed
-            updateCommandStatus(commandId, "completed");
+        if (reader.failed()) {
+            Serial.print("deserializeJson() failed: ");
+            Serial.println(reader.errorString());
         }
     } else {
-        Serial.print("Error checking feed commands: ");
+        Serial.print("Error claiming feed commands: ");
         Serial.println(httpResponseCode);
     }
     
-    http.end();
+    supabase.end();
+    return found;
 }
 
-// Update command status in Supabase
-void updateCommandStatus(String commandId, String status) {
-    JsonDocument doc;
-    doc["status"] = status;
+// Pass a claimed feed command to the control task. Its answer comes back
+// through handleControlMessages().
+void handleFeedCommand(const String& commandId, int amount) {
+    FeedRequest request;
+    request.amount = constrain(amount, INT16_MIN, INT16_MAX);
+    strlcpy(request.type, "manual", sizeof(request.type));
+    strlcpy(request.commandId, commandId.c_str(), sizeof(request.commandId));
+    request.receivedUs = 0;
     
-    String jsonPayload;
-    serializeJson(doc, jsonPayload);
+    if (!feedRequests.push(request)) {
+        Serial.println("Feed request queue full, releasing command");
+        queueCommandStatus(releasedCommands, request.commandId);
+        return;
+    }
+    unresolvedCommands++;
+    controlTask.wake();
+}
+
+// Remember a claimed command for the next bulk status update
+void queueCommandStatus(CommandStatusBatch& batch, const char* commandId) {
+    // Never sent from here: this can run while a claim response is still
+    // streaming in on the session. The journal task sends the batch once
+    // the claim is done. claimableCommands() leaves room for every claimed
+    // command that could still end up here, so the batch does not fill.
+    if (batch.count == COMMAND_STATUS_BATCH) {
+        Serial.print("Command status batch full, claims should have stopped: ");
+        Serial.println(commandId);
+        return;
+    }
+    strlcpy(batch.ids[batch.count++], commandId, COMMAND_ID_LENGTH);
+    scheduler.trigger(journalTask);
+}
+
+// Set the status of every command in batch with one PATCH on id=in.(...)
+bool flushCommandStatus(CommandStatusBatch& batch) {
+    if (batch.count == 0) {
+        return true;
+    }
     
-    http.begin(client, String(SUPABASE_URL) + "/rest/v1/feed_commands?id=eq." + commandId);
-    http.addHeader("Content-Type", "application/json");
-    http.addHeader("apikey", SUPABASE_API_KEY);
-    http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-    http.addHeader("Prefer", "return=minimal");
+    char path[SUPABASE_LONG_PATH_LENGTH];
+    int length = snprintf(path, sizeof(path), "/rest/v1/feed_commands?id=in.(");
+    for (uint8_t i = 0; i < batch.count; i++) {
+        length += snprintf(path + length, sizeof(path) - length, "%s%s", i ? "," : "", batch.ids[i]);
+    }
+    snprintf(path + length, sizeof(path) - length, ")");
     
-    int httpResponseCode = http.PATCH(jsonPayload);
+    JsonDocument doc;
+    doc["status"] = batch.status;
     
-    if (httpResponseCode == 204) {
-        Serial.println("Command status updated successfully");
-    } else {
+    int httpResponseCode = supabase.patch(path, doc);
+    
+    if (httpResponseCode != 204) {
         Serial.print("Error updating command status: ");
         Serial.println(httpResponseCode);
+        return false;
     }
     
-    http.end();
+    Serial.printf("Set %u commands to %s\n", batch.count, batch.status);
+    batch.count = 0;
+    return true;
 }
 
-// Log feeding event to Supabase
-void logFeedingEvent(int amount, String type) {
-    String deviceId = WiFi.macAddress();
-    deviceId.replace(":", "");
+// Network task: feed commands that can be claimed now. The queue size is
+// read before the slots, so a request moving from the queue to the
+// dispenser in between is counted twice rather than not at all. A local
+// or scheduled feed can still take a slot first; that command is rejected.
+//
+// Every claimed command may still need a status update: released if it
+// does not fit in feedRequests, failed if the control task rejects it.
+// Claims leave room for all of them in the status batches, so a batch
+// that cannot be sent holds back claims instead of losing an update.
+size_t claimableCommands() {
+    int queued = feedRequests.size();
+    int slots = localStatus.feedSlots;
+    int failRoom = COMMAND_STATUS_BATCH - failedCommands.count - unresolvedCommands;
+    int releaseRoom = COMMAND_STATUS_BATCH - releasedCommands.count;
+    int limit = min(min(slots - queued, failRoom), releaseRoom);
+    if (limit <= 0) {
+        return 0;
+    }
+    return min((size_t)limit, feedRequests.capacity() - queued);
+}
+
+// Control task: tell the network task how many more feeds the dispenser
+// can queue
+void publishFeedSlots() {
+    localStatus.feedSlots = DISPENSER_QUEUE_SIZE - dispenser.queued();
+}
+
+// Control task: queue the feeds sent by handleFeedCommand() and the local API
+void handleFeedRequests() {
+    FeedRequest request;
+    while (!feedRequests.isEmpty()) {
+        // Taken from the published slots before the request leaves the
+        // queue, see claimableCommands()
+        localStatus.feedSlots--;
+        feedRequests.pop(request);
+        startFeedRequest(request);
+    }
+    while (localFeedRequests.pop(request)) {
+        startFeedRequest(request);
+    }
+    publishFeedSlots();
+}
+
+// Control task: queue one feed request and report the outcome
+void startFeedRequest(const FeedRequest& request) {
+    // Already dispensing this one, its status is updated on completion
+    if (dispenser.hasCommand(request.commandId)) {
+        reportFeed(FeedEvent::QUEUED, request.amount, request.type, request.commandId, 0);
+        return;
+    }
+    
+    // Execute feed command
+    Serial.print(request.receivedUs ? "Local feed request: " : "Manual feeding command: ");
+    Serial.print(request.amount);
+    Serial.println(" grams");
+    
+    // Logged and marked completed once onDispenseComplete() reports it
+    bool queued = feed(request.amount, request.type, request.commandId);
+    reportFeed(queued ? FeedEvent::QUEUED : FeedEvent::REJECTED,
+               request.amount, request.type, request.commandId, 0);
+    
+    // Timed from arrival until the hopper opens, see onDispenseProgress()
+    if (queued && request.receivedUs && localFeedCount < DISPENSER_QUEUE_SIZE) {
+        localFeedArrivals[(localFeedHead + localFeedCount) % DISPENSER_QUEUE_SIZE] = request.receivedUs;
+        localFeedCount++;
+    }
+}
+
+// Control task: tell the network task what happened to a feed
+void reportFeed(FeedEvent::Kind kind, int amount, const char* type, const char* commandId, unsigned long actualHoldMs) {
+    FeedEvent event;
+    event.kind = kind;
+    event.amount = amount;
+    strlcpy(event.type, type, sizeof(event.type));
+    strlcpy(event.commandId, commandId, sizeof(event.commandId));
+    event.actualHoldMs = actualHoldMs;
     
-    // Get current time
     time_t now;
     time(&now);
+    event.timestamp = now;
     
-    // Create JSON payload
+    if (!feedEvents.push(event)) {
+        Serial.println("Feed event queue full, event dropped");
+        return;
+    }
+    networkTask.wake();
+}
+
+// Network task: act on feed events and sensor samples from the control task
+void handleControlMessages() {
+    FeedEvent event;
+    while (feedEvents.pop(event)) {
+        bool isCommand = event.commandId[0] != '\0';
+        switch (event.kind) {
+            case FeedEvent::QUEUED:
+                // Already marked processing by the claim
+                if (isCommand && unresolvedCommands > 0) {
+                    unresolvedCommands--;
+                }
+                break;
+            case FeedEvent::STARTED:
+                break;
+            case FeedEvent::REJECTED:
+                if (isCommand) {
+                    if (unresolvedCommands > 0) {
+                        unresolvedCommands--;
+                    }
+                    queueCommandStatus(failedCommands, event.commandId);
+                }
+                break;
+            case FeedEvent::COMPLETED:
+                // Journaled even while offline, the upload completes the command
+                logFeedingEvent(event.amount, event.type, event.timestamp, event.commandId);
+                break;
+        }
+        broadcastFeedEvent(event);
+    }
+    
+    // Only the latest reading matters
+    SensorSample sample;
+    bool sampled = false;
+    while (sensorSamples.pop(sample)) {
+        sampled = true;
+    }
+    if (sampled) {
+        telemetry.setFoodLevel(sample.foodLevel);
+        telemetry.setBatteryLevel(sample.batteryLevel);
+        
+        // Upload only if something moved past its deadband
+        flushTelemetry();
+    }
+}
+
+// Network task: push a feed's progress to local API clients
+void broadcastFeedEvent(const FeedEvent& event) {
+    if (localSocket.count() == 0) {
+        return;
+    }
+    
+    static const char* const kinds[] = {"queued", "rejected", "started", "completed"};
+    char message[160];
+    snprintf(message, sizeof(message),
+             "{\"event\":\"feed\",\"state\":\"%s\",\"amount\":%d,\"type\":\"%s\",\"command_id\":\"%s\",\"hold_ms\":%u}",
+             kinds[event.kind], event.amount, event.type, event.commandId, (unsigned)event.actualHoldMs);
+    localSocket.textAll(message);
+}
+
+// Network task: share what the control task needs to decide on sleep
+void publishNetworkStatus() {
+    bool connected = wifiManager.isConnected();
+    bool hotspot = wifiManager.isHotspotEnabled();
+    uint32_t now = millis();
+    
+    networkStatus.offline = !connected && !hotspot && wifiManager.isBackingOff();
+    bool uploaded = journal.pending() == 0 && failedCommands.count == 0 && releasedCommands.count == 0;
+    networkStatus.idle = !hotspot && (!connected || (uploaded && commandsPolled));
+    networkStatus.wakeAt = now + (uint32_t)min(scheduler.msUntilNext(), (unsigned long)POWER_COMMAND_POLL_INTERVAL);
+    networkStatus.heartbeatAt = now + (uint32_t)telemetry.msUntilHeartbeat();
+    
+    FeedingJournal::Cursor cursor = journal.getCursor();
+    networkStatus.journalHead = cursor.headSeq;
+    networkStatus.journalAcked = cursor.ackedSeq;
+}
+
+// Network task: copy the newest journal entries for /api/history. Only
+// runs after an append, so a history request rarely waits on the lock.
+void refreshRecentHistory() {
+    std::lock_guard<std::mutex> guard(recentHistory.lock);
+    recentHistory.count = journal.readRecent(recentHistory.entries, LOCAL_HISTORY_LIMIT);
+}
+
+// Log feeding event, recorded in the journal first and uploaded by drainJournal()
+void logFeedingEvent(int amount, const String& type, time_t timestamp, const char* commandId) {
+    if (journal.append(amount, type, timestamp, commandId)) {
+        refreshRecentHistory();
+        scheduler.trigger(journalTask);
+        return;
+    }
+    
+    // Journal unavailable, upload directly
+    if (!resolveDeviceUuid()) {
+        Serial.println("Error logging feeding event: device not registered");
+        return;
+    }
     JsonDocument doc;
-    doc["device_id"] = deviceId;
+    doc["device_id"] = device.uuid();
     doc["amount"] = amount;
     doc["type"] = type;
-    doc["timestamp"] = now;
-    
-    String jsonPayload;
-    serializeJson(doc, jsonPayload);
+    char fedAt[24];
+    if (formatUtcTime(timestamp, fedAt, sizeof(fedAt))) {
+        doc["fed_at"] = fedAt;
+    }
+    if (commandId[0] != '\0') {
+        doc["command_id"] = commandId;
+    }
     
     // Send to Supabase
-    http.begin(client, String(SUPABASE_URL) + "/rest/v1/feeding_history");
-    http.addHeader("Content-Type", "application/json");
-    http.addHeader("apikey", SUPABASE_API_KEY);
-    http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-    http.addHeader("Prefer", "return=minimal");
-    
-    int httpResponseCode = http.POST(jsonPayload);
+    int httpResponseCode = supabase.post("/rest/v1/feeding_history", doc);
     
     if (httpResponseCode == 201) {
         Serial.println("Feeding event logged successfully");
@@ -443,67 +1597,184 @@ void logFeedingEvent(int amount, String type) {
         Serial.print("Error logging feeding event: ");
         Serial.println(httpResponseCode);
     }
+}
+
+// ISO 8601 UTC time for a timestamptz column. False before the clock has
+// been set, in which case the server uses the upload time.
+bool formatUtcTime(time_t t, char* out, size_t size) {
+    struct tm utc;
+    gmtime_r(&t, &utc);
+    if (utc.tm_year < 2016 - 1900) {
+        return false;
+    }
+    strftime(out, size, "%Y-%m-%dT%H:%M:%SZ", &utc);
+    return true;
+}
+
+// Upload pending journal entries as a single bulk insert. Rows carry the
+// journal sequence number so a replayed batch is ignored by the server,
+// and the feed command they carried out, which the insert completes.
+// Failed and released commands go out in the same pass.
+void drainJournal() {
+    flushCommandStatus(failedCommands);
+    flushCommandStatus(releasedCommands);
+    
+    FeedingJournal::Entry entries[JOURNAL_BATCH_SIZE];
+    uint16_t count = journal.readPending(entries, JOURNAL_BATCH_SIZE);
+    if (count == 0 || !resolveDeviceUuid()) {
+        return;
+    }
     
-    http.end();
+    // Create JSON payload
+    JsonDocument doc;
+    JsonArray rows = doc.to<JsonArray>();
+    for (uint16_t i = 0; i < count; i++) {
+        JsonObject row = rows.add<JsonObject>();
+        row["device_id"] = device.uuid();
+        row["amount"] = entries[i].amount;
+        row["type"] = entries[i].type;
+        row["device_seq"] = entries[i].seq;
+        
+        // Every row of a bulk insert needs the same keys
+        char fedAt[24];
+        if (formatUtcTime(entries[i].timestamp, fedAt, sizeof(fedAt))) {
+            row["fed_at"] = fedAt;
+        } else {
+            row["fed_at"] = nullptr;
+        }
+        if (entries[i].commandId[0] != '\0') {
+            row["command_id"] = entries[i].commandId;
+        } else {
+            row["command_id"] = nullptr;
+        }
+    }
+    
+    // Send to Supabase
+    unsigned long start = millis();
+    int httpResponseCode = supabase.post("/rest/v1/feeding_history?on_conflict=device_id,device_seq", doc,
+                                         "return=minimal,resolution=ignore-duplicates");
+    unsigned long duration = millis() - start;
+    
+    if (httpResponseCode == 201) {
+        journal.acknowledge(entries[count - 1].seq, count, duration);
+        Serial.printf("Uploaded %u feeding events in %lu ms, %u still pending\n",
+                      count, duration, journal.pending());
+        
+        // Keep draining while there is a backlog
+        if (journal.pending() > 0) {
+            scheduler.trigger(journalTask, 100);
+        }
+    } else {
+        Serial.print("Error uploading feeding history: ");
+        Serial.println(httpResponseCode);
+    }
 }
 
-// Feed function - dispenses food by rotating servo
-void feed(int amount) {
+// Feed function - queues food to be dispensed by the servo
+bool feed(int amount, const String& type, const String& commandId) {
     // Validate amount
     if (amount <= 0) {
         Serial.println("Invalid feed amount");
-        return;
+        return false;
     }
     
-    if (amount > MAX_FEED_AMOUNT) {
+    int maxAmount = deviceConfig.maxFeedAmount > 0 ? deviceConfig.maxFeedAmount : MAX_FEED_AMOUNT;
+    if (amount > maxAmount) {
         Serial.print("Feed amount exceeds maximum. Limiting to ");
-        Serial.print(MAX_FEED_AMOUNT);
+        Serial.print(maxAmount);
         Serial.println(" grams");
-        amount = MAX_FEED_AMOUNT;
+        amount = maxAmount;
     }
     
-    // Calculate feeding time based on amount
-    int feedTimeMs = (amount * 1000) / FEED_AMOUNT_PER_SECOND;
+    if (!dispenser.enqueue(amount, type, commandId)) {
+        Serial.println("Feed queue full, request dropped");
+        return false;
+    }
+    power.noteActivity();
+    flowModel.noteFeed(type != "scheduled", millis());
     
-    Serial.print("Feeding ");
+    Serial.print("Queued feeding of ");
     Serial.print(amount);
     Serial.print(" grams for ");
-    Serial.print(feedTimeMs);
+    Serial.print(flowModel.holdMs(amount, readFoodLevel()));
     Serial.println(" ms");
+    return true;
+}
+
+// Report dispenser state changes
+void onDispenseProgress(const Dispenser::Request& request, Dispenser::State state, unsigned long elapsedMs, unsigned long holdMs) {
+    static Dispenser::State lastState = Dispenser::IDLE;
+    if (state == lastState) {
+        return;
+    }
+    lastState = state;
     
-    // Turn on status LED
-    digitalWrite(LED_PIN, HIGH);
-    
-    // Open the feeder (rotate servo to open position)
-    feederServo.write(180); // Open position
+    // Measure this feed, dropping one still waiting to be measured
+    if (state == Dispenser::OPENING) {
+        flowSample.active = true;
+        flowSample.settled = false;
+        flowSample.amount = request.amount;
+        flowSample.levelBefore = readFoodLevel();
+        controlScheduler.trigger(foodTask);
+        
+        localStatus.dispensing = true;
+        reportFeed(FeedEvent::STARTED, request.amount, request.type.c_str(), request.commandId.c_str(), 0);
+        
+        // Local request to hopper opening, the latency the LAN API is for
+        activeLocalFeedUs = 0;
+        if (request.type == "local" && localFeedCount > 0) {
+            activeLocalFeedUs = localFeedArrivals[localFeedHead];
+            localFeedHead = (localFeedHead + 1) % DISPENSER_QUEUE_SIZE;
+            localFeedCount--;
+            metrics.recordPhase("local_feed_start", micros() - activeLocalFeedUs);
+        }
+    }
     
-    // Wait for calculated time
-    delay(feedTimeMs);
+    Serial.print("Feeder ");
+    Serial.print(Dispenser::stateName(state));
+    Serial.print(" (");
+    Serial.print(elapsedMs);
+    Serial.print("/");
+    Serial.print(holdMs);
+    Serial.println(" ms)");
+}
+
+// Runs once the hopper is closed and the food has settled. The network
+// task journals it and completes the command.
+void onDispenseComplete(const Dispenser::Request& request, unsigned long actualHoldMs) {
+    Serial.print("Feeding complete (actual duration: ");
+    Serial.print(actualHoldMs);
+    Serial.println(" ms)");
     
-    // Close the feeder (rotate servo back to closed position)
-    feederServo.write(0); // Closed position
+    // The flow model reads the level once the sensor has caught up
+    flowSample.settled = true;
+    flowSample.holdMs = actualHoldMs;
+    flowSample.completedAt = millis();
     
-    // Turn off status LED
-    digitalWrite(LED_PIN, LOW);
+    localStatus.dispensing = false;
+    localStatus.lastFeedAmount = request.amount;
+    time_t now;
+    time(&now);
+    localStatus.lastFeedAt = now;
+    if (activeLocalFeedUs) {
+        metrics.recordPhase("local_feed_done", micros() - activeLocalFeedUs);
+        activeLocalFeedUs = 0;
+    }
     
-    Serial.println("Feeding complete");
+    reportFeed(FeedEvent::COMPLETED, request.amount, request.type.c_str(),
+               request.commandId.c_str(), actualHoldMs);
 }
 
-// Read food level from sensor
+// Read food level from the filtered sensor reading, -1 until the sensor
+// has taken one. Never waits on the sensor.
 int readFoodLevel() {
-    // Using ultrasonic sensor to measure food level
-    // Send a pulse
-    digitalWrite(TRIG_PIN, LOW);
-    delayMicroseconds(2);
-    digitalWrite(TRIG_PIN, HIGH);
-    delayMicroseconds(10);
-    digitalWrite(TRIG_PIN, LOW);
-    
-    // Measure the response
-    long duration = pulseIn(ECHO_PIN, HIGH);
+    int32_t distanceMm = foodSensor.distanceMm();
+    if (distanceMm < 0) {
+        return -1;
+    }
     
     // Calculate distance in cm
-    int distance = duration * 0.034 / 2;
+    int distance = distanceMm / 10;
     
     // Convert distance to food level percentage
     // Assuming 5cm is empty (0%) and 30cm is full (100%)
@@ -514,68 +1785,10 @@ int readFoodLevel() {
     distance = constrain(distance, minDistance, maxDistance);
     
     // Map distance to percentage (inverted: closer = more food)
-    int foodLevel = map(distance, maxDistance, minDistance, 0, 100);
-    
-    Serial.print("Food level: ");
-    Serial.print(foodLevel);
-    Serial.println("%");
-    
-    return foodLevel;
+    return map(distance, maxDistance, minDistance, 0, 100);
 }
 
-// Read battery level
+// Read battery level from the background monitor, -1 until it has a reading
 int readBatteryLevel() {
-    // Read analog value from battery monitoring pin
-    int rawValue = analogRead(BATTERY_LEVEL_PIN);
-    
-    // Convert analog reading to voltage
-    // ESP32 ADC is typically 12-bit (0-4095)
-    float voltage = rawValue * (3.3 / 4095.0) * 2; // Multiply by 2 if using a voltage divider
-    
-    // Convert voltage to percentage
-    // Assuming 3.0V is 0% and 4.2V is 100% (for a LiPo battery)
-    int percentage = map(voltage * 100, 300, 420, 0, 100);
-    percentage = constrain(percentage, 0, 100);
-    
-    Serial.print("Battery level: ");
-    Serial.print(percentage);
-    Serial.println("%");
-    
-    return percentage;
+    return battery.percent();
 }
-
-// Update battery level in Supabase
-void updateBatteryLevel() {
-    if (wifiManager.isConnected()) {
-        String deviceId = WiFi.macAddress();
-        deviceId.replace(":", "");
-        
-        // Read battery level
-        int batteryLevel = readBatteryLevel();
-        
-        // Create JSON payload
-        JsonDocument doc;
-        doc["battery_level"] = batteryLevel;
-        
-        String jsonPayload;
-        serializeJson(doc, jsonPayload);
-        
-        // Send to Supabase
-        http.begin(client, String(SUPABASE_URL) + "/rest/v1/devices?id=eq." + deviceId);
-        http.addHeader("Content-Type", "application/json");
-        http.addHeader("apikey", SUPABASE_API_KEY);
-        http.addHeader("Authorization", "Bearer " + String(SUPABASE_JWT_TOKEN));
-        http.addHeader("Prefer", "return=minimal");
-        
-        int httpResponseCode = http.PATCH(jsonPayload);
-        
-        if (httpResponseCode == 204) {
-            Serial.println("Battery level updated successfully");
-        } else {
-            Serial.print("Error updating battery level: ");
-            Serial.println(httpResponseCode);
-        }
-        
-        http.end();
-    }
-}
\ No newline at end of file
@@ -14,7 +14,7 @@ import { format } from "date-fns";
 
 interface FeedingHistoryItem {
   id: string;
-  type: 'manual' | 'scheduled';
+  type: 'manual' | 'scheduled' | 'local';
   timestamp: number;
   amount?: number;
 }
@@ -34,7 +34,7 @@ interface FeedingEvent {
   device_id: string;
   timestamp: string;
   amount: number;
-  type: 'manual' | 'scheduled';
+  type: 'manual' | 'scheduled' | 'local';
 }
 
 interface FeedingStats {
@@ -0,0 +1,110 @@
+-- The firmware's feeding history upload against DatabaseSchema.sql: rows
+-- from drainJournal() are inserted the way PostgREST runs them, as the
+-- device owner under RLS, and must fill in the owner, keep the feed time,
+-- complete the command they carried out and ignore a replayed batch.
+--
+-- Loads the schema into a transaction and rolls it back. On a plain
+-- Postgres it first creates the parts of Supabase the schema relies on.
+
+\set ON_ERROR_STOP on
+\set owner '11111111-1111-4111-8111-111111111111'
+\set stranger '22222222-2222-4222-8222-222222222222'
+\set device '33333333-3333-4333-8333-333333333333'
+\set command '44444444-4444-4444-8444-444444444444'
+
+-- drainJournal()'s body: one manual feed completing a command, one
+-- scheduled feed made before the clock was set
+\set rows '[{"device_id":"33333333-3333-4333-8333-333333333333","amount":20,"type":"manual","device_seq":1,"fed_at":"2024-06-09T07:30:00Z","command_id":"44444444-4444-4444-8444-444444444444"},{"device_id":"33333333-3333-4333-8333-333333333333","amount":30,"type":"scheduled","device_seq":2,"fed_at":null,"command_id":null}]'
+
+BEGIN;
+
+-- Supabase stand-ins, left alone where they exist
+CREATE EXTENSION IF NOT EXISTS "uuid-ossp";
+CREATE SCHEMA IF NOT EXISTS auth;
+CREATE TABLE IF NOT EXISTS auth.users (
+    id uuid primary key,
+    email text,
+    raw_user_meta_data jsonb,
+    email_confirmed_at timestamp with time zone
+);
+DO $$
+BEGIN
+    IF NOT EXISTS (SELECT 1 FROM pg_roles WHERE rolname = 'anon') THEN
+        CREATE ROLE anon NOLOGIN;
+    END IF;
+    IF NOT EXISTS (SELECT 1 FROM pg_roles WHERE rolname = 'authenticated') THEN
+        CREATE ROLE authenticated NOLOGIN;
+    END IF;
+    IF NOT EXISTS (SELECT 1 FROM pg_proc p JOIN pg_namespace n ON n.oid = p.pronamespace
+                   WHERE n.nspname = 'auth' AND p.proname = 'uid') THEN
+        CREATE FUNCTION auth.uid() RETURNS uuid LANGUAGE sql STABLE
+        AS 'SELECT nullif(current_setting(''request.jwt.claim.sub'', true), '''')::uuid';
+    END IF;
+    IF NOT EXISTS (SELECT 1 FROM pg_publication WHERE pubname = 'supabase_realtime') THEN
+        CREATE PUBLICATION supabase_realtime;
+    END IF;
+END $$;
+
+\ir ../../src/lib/DatabaseSchema.sql
+
+GRANT USAGE ON SCHEMA public, auth TO anon, authenticated;
+GRANT ALL ON ALL TABLES IN SCHEMA public TO anon, authenticated;
+
+-- An owner with a device and a command it has claimed, and another user
+INSERT INTO auth.users (id, email) VALUES (:'owner', 'owner@example.com'), (:'stranger', 'stranger@example.com');
+INSERT INTO public.devices (id, owner_id, mac_address) VALUES (:'device', :'owner', 'A0B1C2D3E4F5');
+INSERT INTO public.feed_commands (id, device_id, user_id, amount, status)
+VALUES (:'command', :'device', :'owner', 20, 'processing');
+
+-- POST /rest/v1/feeding_history?on_conflict=device_id,device_seq with
+-- resolution=ignore-duplicates, sent twice as after a lost response
+SET LOCAL ROLE authenticated;
+SET LOCAL "request.jwt.claim.sub" = :'owner';
+
+INSERT INTO public.feeding_history (device_id, amount, type, device_seq, fed_at, command_id)
+SELECT device_id, amount, type, device_seq, fed_at, command_id
+FROM json_populate_recordset(NULL::public.feeding_history, :'rows')
+ON CONFLICT (device_id, device_seq) DO NOTHING;
+
+INSERT INTO public.feeding_history (device_id, amount, type, device_seq, fed_at, command_id)
+SELECT device_id, amount, type, device_seq, fed_at, command_id
+FROM json_populate_recordset(NULL::public.feeding_history, :'rows')
+ON CONFLICT (device_id, device_seq) DO NOTHING;
+
+RESET ROLE;
+
+DO $$
+DECLARE
+    v_owner uuid := '11111111-1111-4111-8111-111111111111';
+    v_command uuid := '44444444-4444-4444-8444-444444444444';
+BEGIN
+    ASSERT (SELECT count(*) FROM public.feeding_history) = 2,
+        'replayed batch was inserted again';
+    ASSERT NOT EXISTS (SELECT 1 FROM public.feeding_history WHERE user_id IS DISTINCT FROM v_owner),
+        'user_id not filled in from the device owner';
+    ASSERT (SELECT fed_at FROM public.feeding_history WHERE device_seq = 1) = '2024-06-09T07:30:00Z'::timestamptz,
+        'fed_at not kept';
+    ASSERT (SELECT fed_at = created_at FROM public.feeding_history WHERE device_seq = 2),
+        'fed_at not taken from created_at without a device time';
+    ASSERT (SELECT status FROM public.feed_commands WHERE id = v_command) = 'completed',
+        'feed command not completed by the insert';
+END $$;
+
+-- Someone else's token cannot add history to the device
+SET LOCAL ROLE authenticated;
+SET LOCAL "request.jwt.claim.sub" = :'stranger';
+
+DO $$
+BEGIN
+    BEGIN
+        INSERT INTO public.feeding_history (device_id, amount, type, device_seq)
+        VALUES ('33333333-3333-4333-8333-333333333333', 10, 'manual', 3);
+        RAISE EXCEPTION 'insert for another owner''s device was allowed';
+    EXCEPTION WHEN insufficient_privilege THEN
+        NULL;
+    END;
+END $$;
+
+RESET ROLE;
+\echo 'feeding_history_insert: ok'
+ROLLBACK;
@@ -0,0 +1,36 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdio.h>
+
+// Minimal checks for the host builds of the firmware headers. A failed
+// CHECK is reported and counted, and the test keeps going so one run shows
+// every failure. TEST_RESULT() is the exit code for main().
+static int testFailures = 0;
+static int testChecks = 0;
+
+#define CHECK(cond) \
+    do { \
+        testChecks++; \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            testFailures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        testChecks++; \
+        long long checkA = (long long)(a); \
+        long long checkB = (long long)(b); \
+        if (checkA != checkB) { \
+            fprintf(stderr, "%s:%d: CHECK_EQ failed: %s == %s (%lld vs %lld)\n", \
+                    __FILE__, __LINE__, #a, #b, checkA, checkB); \
+            testFailures++; \
+        } \
+    } while (0)
+
+#define TEST_RESULT(name) \
+    (printf("%s: %d checks, %d failed\n", name, testChecks, testFailures), testFailures ? 1 : 0)
+
+#endif // HOST_TEST_H
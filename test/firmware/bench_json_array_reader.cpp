@@ -0,0 +1,177 @@
+// Parse time and peak JSON heap for a schedule response of 10, 100 and
+// 1000 rows, read through HttpBodyStream as a chunked body. Compares
+// JsonArrayReader, one filtered element at a time, with deserializing the
+// whole filtered array into one document as the firmware used to.
+#include <Client.h>
+#include <ArduinoJson.h>
+#include "HttpBodyStream.h"
+#include "JsonArrayReader.h"
+
+#include <string>
+
+#define BENCH_CHUNK_SIZE 1024 // chunk size PostgREST responses arrive in
+
+// Counts what ArduinoJson allocates. Each block carries its size in front,
+// since deallocate() is not told how big it was.
+class CountingAllocator : public ArduinoJson::Allocator {
+private:
+    size_t current;
+    size_t peak;
+
+public:
+    CountingAllocator() : current(0), peak(0) {
+    }
+
+    void* allocate(size_t size) override {
+        size_t* block = (size_t*)malloc(sizeof(size_t) + size);
+        if (!block) return nullptr;
+        *block = size;
+        current += size;
+        peak = max(peak, current);
+        return block + 1;
+    }
+
+    void deallocate(void* ptr) override {
+        if (!ptr) return;
+        size_t* block = (size_t*)ptr - 1;
+        current -= *block;
+        free(block);
+    }
+
+    void* reallocate(void* ptr, size_t size) override {
+        if (!ptr) return allocate(size);
+        size_t* block = (size_t*)ptr - 1;
+        size_t old = *block;
+        block = (size_t*)realloc(block, sizeof(size_t) + size);
+        if (!block) return nullptr;
+        *block = size;
+        current = current - old + size;
+        peak = max(peak, current);
+        return block + 1;
+    }
+
+    void resetPeak() {
+        peak = current;
+    }
+
+    size_t getCurrent() const {
+        return current;
+    }
+
+    size_t getPeak() const {
+        return peak;
+    }
+};
+
+// Rows as the feeding_schedules API returns them, with the columns the
+// filter drops
+static std::string scheduleRows(int rows) {
+    std::string json = "[";
+    char row[512];
+    for (int i = 0; i < rows; i++) {
+        snprintf(row, sizeof(row),
+                 "%s{\"id\":\"5f0c6a4e-0000-4000-8000-%012d\","
+                 "\"pet_id\":\"8b1d2c3e-1111-4000-8000-000000000001\","
+                 "\"device_id\":\"1c2d3e4f-2222-4000-8000-000000000002\","
+                 "\"user_id\":\"9a8b7c6d-3333-4000-8000-000000000003\","
+                 "\"time\":\"%02d:%02d\",\"amount\":%d,\"enabled\":%s,"
+                 "\"days\":[true,true,false,true,false,true,true],"
+                 "\"created_at\":\"2024-05-01T08:00:00.000000+00:00\","
+                 "\"updated_at\":\"2024-05-02T08:00:00.000000+00:00\"}",
+                 i ? "," : "", i, (i / 60) % 24, i % 60, 10 + i % 40, i % 7 ? "true" : "false");
+        json += row;
+    }
+    json += "]";
+    return json;
+}
+
+// Frame a body with chunked transfer encoding
+static std::string chunked(const std::string& body) {
+    std::string framed;
+    char header[16];
+    for (size_t offset = 0; offset < body.size(); offset += BENCH_CHUNK_SIZE) {
+        size_t length = min((size_t)BENCH_CHUNK_SIZE, body.size() - offset);
+        snprintf(header, sizeof(header), "%zx\r\n", length);
+        framed += header;
+        framed.append(body, offset, length);
+        framed += "\r\n";
+    }
+    framed += "0\r\n\r\n";
+    return framed;
+}
+
+struct Result {
+    double microsPerParse;
+    size_t peakBytes;
+    int rows;
+};
+
+template <typename Parse>
+static Result measure(const std::string& response, int iterations, CountingAllocator& allocator, Parse parse) {
+    MemoryClient client(response.data(), response.size());
+    Result result = Result();
+    size_t baseline = allocator.getCurrent(); // the filters
+
+    unsigned long start = micros();
+    for (int i = 0; i < iterations; i++) {
+        client.rewind();
+        HttpBodyStream body;
+        body.begin(client, HttpBodyStream::CHUNKED, 0, 1000);
+        allocator.resetPeak();
+        result.rows = parse(body);
+    }
+    result.microsPerParse = (double)(micros() - start) / iterations;
+    result.peakBytes = allocator.getPeak() - baseline;
+    return result;
+}
+
+int main() {
+    CountingAllocator allocator;
+
+    JsonDocument filter(&allocator);
+    filter["id"] = true;
+    filter["time"] = true;
+    filter["amount"] = true;
+    filter["enabled"] = true;
+    filter["days"] = true;
+
+    JsonDocument arrayFilter(&allocator);
+    arrayFilter[0] = filter;
+
+    printf("%6s %10s %14s %12s %14s %12s\n", "rows", "body", "reader us", "reader B", "document us", "document B");
+
+    const int sizes[] = {10, 100, 1000};
+    for (int rows : sizes) {
+        std::string body = scheduleRows(rows);
+        std::string response = chunked(body);
+        int iterations = max(10, 20000 / rows);
+
+        Result streamed = measure(response, iterations, allocator, [&](Stream& stream) {
+            JsonArrayReader reader(stream, filter);
+            JsonDocument element(&allocator);
+            int count = 0;
+            while (reader.next(element)) {
+                count += element["amount"].as<int>() > 0;
+            }
+            return reader.failed() ? -1 : count;
+        });
+
+        Result whole = measure(response, iterations, allocator, [&](Stream& stream) {
+            JsonDocument doc(&allocator);
+            if (deserializeJson(doc, stream, DeserializationOption::Filter(arrayFilter))) return -1;
+            int count = 0;
+            for (JsonObject row : doc.as<JsonArray>()) {
+                count += row["amount"].as<int>() > 0;
+            }
+            return count;
+        });
+
+        if (streamed.rows != rows || whole.rows != rows) {
+            printf("%6d parse failed: reader %d, document %d rows\n", rows, streamed.rows, whole.rows);
+            return 1;
+        }
+        printf("%6d %10zu %14.1f %12zu %14.1f %12zu\n", rows, body.size(),
+               streamed.microsPerParse, streamed.peakBytes, whole.microsPerParse, whole.peakBytes);
+    }
+    return 0;
+}
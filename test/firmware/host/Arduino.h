@@ -0,0 +1,226 @@
+// Host stand-in for the Arduino core: the hardware abstraction the
+// firmware headers in src/ build against off-device. Time, pins, the ADC
+// and pulse timing go through the hooks in HostHal, so a simulation can
+// plug in a VirtualClock and simulated devices while tests and benchmarks
+// keep the real-time defaults. Stream reads go through readBytes() with a
+// timeout, as on the device.
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+
+// Parse straight from Stream like the firmware does
+#ifndef ARDUINOJSON_ENABLE_ARDUINO_STREAM
+#define ARDUINOJSON_ENABLE_ARDUINO_STREAM 1
+#endif
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+using std::max;
+using std::min;
+
+namespace HostHal {
+    inline unsigned long realMicros() {
+        using namespace std::chrono;
+        static const steady_clock::time_point start = steady_clock::now();
+        return (unsigned long)duration_cast<microseconds>(steady_clock::now() - start).count();
+    }
+
+    inline unsigned long realMillis() {
+        return realMicros() / 1000;
+    }
+
+    inline void realDelay(unsigned long ms) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+
+    // millis() and delay(), e.g. VirtualClock::now and VirtualClock::advance
+    inline unsigned long (*clockMs)() = realMillis;
+    inline void (*delayMs)(unsigned long ms) = realDelay;
+
+    // Simulated devices, nullptr reads as a floating pin
+    inline void (*pinWritten)(uint8_t pin, uint8_t value) = nullptr;
+    inline int (*analogIn)(uint8_t pin) = nullptr;
+    inline unsigned long (*pulseIn)(uint8_t pin, uint8_t state, unsigned long timeoutUs) = nullptr;
+}
+
+inline unsigned long millis() {
+    return HostHal::clockMs();
+}
+
+// Always real time, for measuring how long code takes
+inline unsigned long micros() {
+    return HostHal::realMicros();
+}
+
+inline void delay(unsigned long ms) {
+    HostHal::delayMs(ms);
+}
+
+inline void delayMicroseconds(unsigned int) {
+}
+
+inline void yield() {
+}
+
+template <typename T>
+inline T constrain(T value, T low, T high) {
+    return value < low ? low : (value > high ? high : value);
+}
+
+inline void pinMode(uint8_t, uint8_t) {
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t value) {
+    if (HostHal::pinWritten) HostHal::pinWritten(pin, value);
+}
+
+inline int analogRead(uint8_t pin) {
+    return HostHal::analogIn ? HostHal::analogIn(pin) : 0;
+}
+
+inline unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeoutUs = 1000000) {
+    return HostHal::pulseIn ? HostHal::pulseIn(pin, state, timeoutUs) : 0;
+}
+
+// The parts of Arduino's String the headers use
+class String {
+private:
+    std::string value;
+
+public:
+    String(const char* s = "") : value(s ? s : "") {
+    }
+
+    String(const std::string& s) : value(s) {
+    }
+
+    const char* c_str() const {
+        return value.c_str();
+    }
+
+    unsigned int length() const {
+        return value.length();
+    }
+
+    bool operator==(const String& other) const {
+        return value == other.value;
+    }
+
+    bool operator!=(const String& other) const {
+        return value != other.value;
+    }
+
+    String& operator+=(const String& other) {
+        value += other.value;
+        return *this;
+    }
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size-- && write(*buffer++)) n++;
+        return n;
+    }
+
+    size_t print(const char* s) {
+        return write((const uint8_t*)s, strlen(s));
+    }
+
+    size_t println(const char* s = "") {
+        return print(s) + print("\n");
+    }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char buffer[256];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if (length < 0) return 0;
+        return write((const uint8_t*)buffer, min((size_t)length, sizeof(buffer) - 1));
+    }
+};
+
+class Stream : public Print {
+protected:
+    unsigned long timeout = 1000;
+
+    int timedRead() {
+        unsigned long start = millis();
+        do {
+            int c = read();
+            if (c >= 0) return c;
+            yield();
+        } while (millis() - start < timeout);
+        return -1;
+    }
+
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long ms) {
+        timeout = ms;
+    }
+
+    size_t readBytes(char* buffer, size_t length) {
+        size_t count = 0;
+        while (count < length) {
+            int c = timedRead();
+            if (c < 0) break;
+            buffer[count++] = (char)c;
+        }
+        return count;
+    }
+};
+
+// Serial writes to stdout
+class HostSerial : public Stream {
+public:
+    void begin(unsigned long) {
+    }
+
+    size_t write(uint8_t c) override {
+        return fputc(c, stdout) == EOF ? 0 : 1;
+    }
+
+    using Print::write;
+
+    int available() override {
+        return 0;
+    }
+
+    int read() override {
+        return -1;
+    }
+
+    int peek() override {
+        return -1;
+    }
+
+    void flush() {
+        fflush(stdout);
+    }
+};
+
+inline HostSerial Serial;
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,49 @@
+#ifndef HOST_CLIENT_H
+#define HOST_CLIENT_H
+
+#include <Arduino.h>
+
+class Client : public Stream {
+public:
+    virtual uint8_t connected() = 0;
+    using Print::write;
+};
+
+// A connection that plays back a fixed response, for feeding
+// HttpBodyStream without a socket
+class MemoryClient : public Client {
+private:
+    const char* data;
+    size_t length;
+    size_t position;
+
+public:
+    MemoryClient(const char* data, size_t length) : data(data), length(length), position(0) {
+    }
+
+    void rewind() {
+        position = 0;
+    }
+
+    uint8_t connected() override {
+        return position < length;
+    }
+
+    int available() override {
+        return (int)(length - position);
+    }
+
+    int read() override {
+        return position < length ? (uint8_t)data[position++] : -1;
+    }
+
+    int peek() override {
+        return position < length ? (uint8_t)data[position] : -1;
+    }
+
+    size_t write(uint8_t) override {
+        return 0;
+    }
+};
+
+#endif // HOST_CLIENT_H
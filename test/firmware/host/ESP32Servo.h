@@ -0,0 +1,42 @@
+#ifndef HOST_ESP32_SERVO_H
+#define HOST_ESP32_SERVO_H
+
+#include <Arduino.h>
+
+// Servo that remembers the last angle written and when, so a simulation
+// can tell whether the hopper is open
+class Servo {
+private:
+    int angle = 0;
+    unsigned long writtenAt = 0;
+    int pin = -1;
+
+public:
+    int attach(int servoPin) {
+        pin = servoPin;
+        return pin;
+    }
+
+    void detach() {
+        pin = -1;
+    }
+
+    bool attached() const {
+        return pin >= 0;
+    }
+
+    void write(int value) {
+        angle = value;
+        writtenAt = millis();
+    }
+
+    int read() const {
+        return angle;
+    }
+
+    unsigned long lastWriteAt() const {
+        return writtenAt;
+    }
+};
+
+#endif // HOST_ESP32_SERVO_H
@@ -0,0 +1,97 @@
+#ifndef HOST_LITTLEFS_H
+#define HOST_LITTLEFS_H
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// In-memory stand-in for the LittleFS calls the firmware makes. Files are
+// byte vectors keyed by path; tests reach into files to replace or damage
+// them between boots.
+class File {
+private:
+    std::vector<uint8_t>* data;
+    size_t position;
+    bool writable;
+
+public:
+    File() : data(nullptr), position(0), writable(false) {
+    }
+
+    File(std::vector<uint8_t>* data, bool writable) : data(data), position(0), writable(writable) {
+    }
+
+    explicit operator bool() const {
+        return data != nullptr;
+    }
+
+    size_t size() const {
+        return data ? data->size() : 0;
+    }
+
+    bool seek(uint32_t offset) {
+        if (!data || offset > data->size()) return false;
+        position = offset;
+        return true;
+    }
+
+    size_t read(uint8_t* buffer, size_t length) {
+        if (!data) return 0;
+        size_t count = std::min(length, data->size() - position);
+        memcpy(buffer, data->data() + position, count);
+        position += count;
+        return count;
+    }
+
+    size_t write(const uint8_t* buffer, size_t length) {
+        if (!data || !writable) return 0;
+        if (position + length > data->size()) data->resize(position + length);
+        memcpy(data->data() + position, buffer, length);
+        position += length;
+        return length;
+    }
+
+    void close() {
+        data = nullptr;
+    }
+};
+
+class HostLittleFS {
+public:
+    std::map<std::string, std::vector<uint8_t>> files;
+
+    bool begin(bool formatOnFail = false) {
+        (void)formatOnFail;
+        return true;
+    }
+
+    // "r" reads, "r+" reads and writes in place, "w" truncates or creates
+    File open(const char* path, const char* mode) {
+        std::string name(path);
+        std::string how(mode);
+        if (how == "w") {
+            files[name].clear();
+            return File(&files[name], true);
+        }
+        auto it = files.find(name);
+        if (it == files.end()) return File();
+        return File(&it->second, how == "r+");
+    }
+
+    bool rename(const char* from, const char* to) {
+        auto it = files.find(from);
+        if (it == files.end()) return false;
+        files[to] = it->second;
+        files.erase(from);
+        return true;
+    }
+
+    bool remove(const char* path) {
+        return files.erase(path) > 0;
+    }
+};
+
+inline HostLittleFS LittleFS;
+
+#endif // HOST_LITTLEFS_H
@@ -0,0 +1,194 @@
+// Local stand-in for the Supabase Realtime endpoint, for exercising
+// RealtimeCommandChannel without a Supabase project. It speaks just enough
+// of the Phoenix v1 protocol: phx_join is acknowledged, heartbeats are
+// answered, and feed commands typed on stdin are pushed as postgres_changes
+// INSERTs to every joined channel.
+//
+//   node test/firmware/realtime-standin.js [port]
+//
+// Build the firmware with
+//   -DSUPABASE_REALTIME_URL='"ws://<host>:<port>/realtime/v1/websocket"'
+// and type on stdin:
+//   feed <amount>   push a pending command
+//   close           send phx_close, the device rejoins
+//   drop            drop the socket, the device falls back to polling
+//   mute            stop pushing (toggle), the device's safety poll must
+//                   still pick commands up
+import crypto from 'node:crypto';
+import http from 'node:http';
+import readline from 'node:readline';
+
+const port = Number(process.argv[2] || 4000);
+const WS_GUID = '258EAFA5-E914-47DA-95CA-C5AB0DC85B11';
+
+const clients = new Set();
+let muted = false;
+
+function frame(opcode, payload) {
+  const length = payload.length;
+  let header;
+  if (length < 126) {
+    header = Buffer.from([0x80 | opcode, length]);
+  } else if (length < 65536) {
+    header = Buffer.alloc(4);
+    header[0] = 0x80 | opcode;
+    header[1] = 126;
+    header.writeUInt16BE(length, 2);
+  } else {
+    header = Buffer.alloc(10);
+    header[0] = 0x80 | opcode;
+    header[1] = 127;
+    header.writeBigUInt64BE(BigInt(length), 2);
+  }
+  return Buffer.concat([header, payload]);
+}
+
+function send(client, message) {
+  client.socket.write(frame(0x1, Buffer.from(JSON.stringify(message))));
+}
+
+// Pull complete frames off the front of buf. Client frames are always masked.
+function readFrames(client, onFrame) {
+  for (;;) {
+    const buf = client.buffer;
+    if (buf.length < 2) return;
+    const opcode = buf[0] & 0x0f;
+    let length = buf[1] & 0x7f;
+    let offset = 2;
+    if (length === 126) {
+      if (buf.length < 4) return;
+      length = buf.readUInt16BE(2);
+      offset = 4;
+    } else if (length === 127) {
+      if (buf.length < 10) return;
+      length = Number(buf.readBigUInt64BE(2));
+      offset = 10;
+    }
+    if (buf.length < offset + 4 + length) return;
+
+    const mask = buf.subarray(offset, offset + 4);
+    const payload = Buffer.from(buf.subarray(offset + 4, offset + 4 + length));
+    for (let i = 0; i < payload.length; i++) payload[i] ^= mask[i % 4];
+    client.buffer = buf.subarray(offset + 4 + length);
+    onFrame(opcode, payload);
+  }
+}
+
+function handleMessage(client, message) {
+  const reply = (status, response = {}) =>
+    send(client, {
+      topic: message.topic,
+      event: 'phx_reply',
+      payload: { status, response },
+      ref: message.ref,
+      join_ref: message.join_ref,
+    });
+
+  if (message.event === 'phx_join') {
+    const changes = message.payload?.config?.postgres_changes || [];
+    client.topic = message.topic;
+    client.joinRef = message.join_ref || message.ref;
+    client.filter = changes[0]?.filter || '';
+    console.log(`join ${message.topic} filter=${client.filter}`);
+    reply('ok', { postgres_changes: changes.map((change, i) => ({ ...change, id: i + 1 })) });
+  } else if (message.event === 'heartbeat') {
+    reply('ok');
+  } else {
+    console.log(`ignored ${message.event} on ${message.topic}`);
+  }
+}
+
+function pushCommand(amount) {
+  for (const client of clients) {
+    if (!client.topic) continue;
+    const deviceId = client.filter.replace(/^device_id=eq\./, '');
+    const record = {
+      id: crypto.randomUUID(),
+      device_id: deviceId,
+      amount,
+      status: 'pending',
+      created_at: new Date().toISOString(),
+    };
+    send(client, {
+      topic: client.topic,
+      event: 'postgres_changes',
+      payload: {
+        ids: [1],
+        data: { schema: 'public', table: 'feed_commands', type: 'INSERT', record },
+      },
+      ref: null,
+    });
+    console.log(`pushed ${record.id} amount=${amount} to ${client.topic}`);
+  }
+}
+
+const server = http.createServer((req, res) => {
+  res.writeHead(426).end('WebSocket only\n');
+});
+
+server.on('upgrade', (req, socket) => {
+  const key = req.headers['sec-websocket-key'];
+  if (!key) {
+    socket.destroy();
+    return;
+  }
+  const accept = crypto.createHash('sha1').update(key + WS_GUID).digest('base64');
+  socket.write(
+    'HTTP/1.1 101 Switching Protocols\r\n' +
+      'Upgrade: websocket\r\n' +
+      'Connection: Upgrade\r\n' +
+      `Sec-WebSocket-Accept: ${accept}\r\n\r\n`,
+  );
+
+  const client = { socket, buffer: Buffer.alloc(0), topic: null, filter: '' };
+  clients.add(client);
+  console.log(`connected ${socket.remoteAddress} ${req.url}`);
+
+  socket.on('data', (data) => {
+    client.buffer = Buffer.concat([client.buffer, data]);
+    readFrames(client, (opcode, payload) => {
+      if (opcode === 0x1) {
+        try {
+          handleMessage(client, JSON.parse(payload.toString()));
+        } catch (error) {
+          console.log(`bad message: ${error.message}`);
+        }
+      } else if (opcode === 0x8) {
+        socket.end(frame(0x8, Buffer.alloc(0)));
+      } else if (opcode === 0x9) {
+        socket.write(frame(0xa, payload));
+      }
+    });
+  });
+  socket.on('close', () => {
+    clients.delete(client);
+    console.log('disconnected');
+  });
+  socket.on('error', () => socket.destroy());
+});
+
+readline.createInterface({ input: process.stdin }).on('line', (line) => {
+  const [command, arg] = line.trim().split(/\s+/);
+  if (command === 'feed') {
+    if (muted) {
+      console.log('muted, not pushing');
+    } else {
+      pushCommand(Number(arg) || 10);
+    }
+  } else if (command === 'close') {
+    for (const client of clients) {
+      if (client.topic) {
+        send(client, { topic: client.topic, event: 'phx_close', payload: {}, ref: client.joinRef });
+      }
+    }
+  } else if (command === 'drop') {
+    for (const client of clients) client.socket.destroy();
+  } else if (command === 'mute') {
+    muted = !muted;
+    console.log(muted ? 'muted' : 'unmuted');
+  } else if (command) {
+    console.log('commands: feed <amount> | close | drop | mute');
+  }
+});
+
+server.listen(port, () => console.log(`realtime stand-in on ws://localhost:${port}/realtime/v1/websocket`));
@@ -0,0 +1,340 @@
+// Scripted simulation of the control task on a VirtualClock: the same
+// TaskScheduler, ScheduleIndex, Dispenser and FlowModel the firmware runs,
+// against a simulated hopper read through pulseIn() and a servo that
+// remembers its angle. Two weeks of schedules and remote commands run in
+// well under a second and report loop time, heap allocations, dispense
+// latency, how quickly the flow model converges, and the command polls and
+// feed events that would go between the tasks and the server.
+//
+// This does not run main.cpp's setup() and loop(): they need FreeRTOS
+// tasks, TLS, the async web server and ArduinoJson, which the host build
+// does not have. The network task is reduced to the command poll, with the
+// firmware's back-off and a fixed round trip, so command latency covers
+// the wait for the next poll as well as the queue behind other feeds.
+#include "HostTest.h"
+#include <Arduino.h>
+#include <ESP32Servo.h>
+#include "Dispenser.h"
+#include "FeederMessages.h"
+#include "FlowModel.h"
+#include "ScheduleIndex.h"
+#include "SpscQueue.h"
+#include "TaskScheduler.h"
+#include "VirtualClock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <new>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+#define SIM_DAYS 14
+#define SIM_EPOCH 1717891200UL      // Sunday 2024-06-09 00:00 UTC
+#define SIM_COMMAND_EVERY 433       // minutes between remote feed commands
+#define SIM_COMMAND_AMOUNT 15
+#define SIM_REFILL_BELOW 150        // grams left when the owner refills
+#define SIM_DEFAULT_RATE 5          // g/s the firmware assumes, FEED_AMOUNT_PER_SECOND
+#define SIM_ROUND_TRIP_MS 400       // claim request to response
+#define SIM_POLL_MIN_INTERVAL 2000  // COMMAND_POLL_MIN_INTERVAL, socket down
+#define SIM_POLL_MAX_INTERVAL 60000 // COMMAND_POLL_MAX_INTERVAL
+#define SIM_ECHO_PIN 5
+#define SIM_LED_PIN 2
+#define SCHEDULE_CHECK_INTERVAL 60000
+
+// Heap allocations made by the code under test
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+// The hopper. Real flow depends on the fill level and differs from the
+// firmware's default, so the flow model has something to learn.
+struct Hopper {
+    float grams = FLOW_HOPPER_GRAMS;
+    uint32_t noise = 12345;
+    uint32_t refills = 0;
+
+    float trueRate() const {
+        return 3.0f + 0.05f * (grams * 100.0f / FLOW_HOPPER_GRAMS);
+    }
+
+    // Echo width for the food surface, with a few mm of jitter. The
+    // sensor sits 5 cm above a full hopper and 30 cm above an empty one.
+    unsigned long echoUs() {
+        noise = noise * 1103515245u + 12345u;
+        float mm = 300.0f - grams * 250.0f / FLOW_HOPPER_GRAMS + (float)((noise >> 16) % 7) - 3.0f;
+        return (unsigned long)(mm * 2000.0f / 343.0f);
+    }
+};
+
+static Hopper hopper;
+static Servo servo;
+static Dispenser dispenser(servo, SIM_LED_PIN, SIM_DEFAULT_RATE);
+static FlowModel flowModel(SIM_DEFAULT_RATE);
+static ScheduleIndex scheduleIndex;
+static TaskScheduler controlScheduler;
+static TaskScheduler networkScheduler;
+static SpscQueue<FeedRequest, MESSAGE_QUEUE_DEPTH> feedRequests;
+static int scheduleTask = -1;
+static int commandTask = -1;
+
+struct Pending {
+    unsigned long dueAt;       // virtual ms the feed was asked for
+    bool scheduled;
+    int levelBefore;
+};
+
+static std::vector<Pending> pending;
+static std::vector<unsigned long> scheduleLatency;
+static std::vector<unsigned long> commandLatency;
+static std::vector<float> feedError;
+static uint32_t scheduledFeeds = 0;
+
+// Feed commands on the server: created at createdAt, not yet claimed
+static std::vector<FeedRequest> serverCommands;
+// Claimed by the poll in flight, handed to the control task at responseAt
+static std::vector<FeedRequest> claimed;
+static unsigned long responseAt = 0;
+static unsigned long pollInterval = SIM_POLL_MIN_INTERVAL;
+
+// Messages and requests crossing the task and network boundaries
+struct Traffic {
+    uint32_t polls;       // command poll requests
+    uint32_t claims;      // polls that claimed commands
+    uint32_t queued;      // FeedEvent::QUEUED
+    uint32_t started;     // FeedEvent::STARTED
+    uint32_t completed;   // FeedEvent::COMPLETED, one journal row each
+};
+static Traffic traffic = Traffic();
+
+// Same mapping as readFoodLevel() in main.cpp, with pulseIn() standing in
+// for the background ultrasonic sampler
+static int readFoodLevel() {
+    unsigned long width = pulseIn(SIM_ECHO_PIN, HIGH, 25000);
+    if (width == 0) return -1;
+    int distance = constrain((int)(width * 343 / 2000 / 10), 5, 30);
+    return (30 - distance) * 100 / 25;
+}
+
+static time_t virtualTime() {
+    return SIM_EPOCH + VirtualClock::now() / 1000;
+}
+
+static void checkSchedules() {
+    time_t now = virtualTime();
+    struct tm timeinfo;
+    gmtime_r(&now, &timeinfo);
+    uint16_t minuteOfWeek = ScheduleIndex::minuteOfWeek(timeinfo);
+
+    scheduleIndex.fireDue(now / 60, minuteOfWeek, [](uint8_t, uint16_t minutesLate) {
+        unsigned long due = VirtualClock::now() - (VirtualClock::now() % 60000) - minutesLate * 60000UL;
+        if (dispenser.enqueue(30, "scheduled")) {
+            pending.push_back({due, true, -1});
+            scheduledFeeds++;
+            traffic.queued++;
+        }
+    });
+
+    // Wake at the start of the next due minute, as the firmware does
+    int32_t minutes = scheduleIndex.minutesUntilNext(minuteOfWeek);
+    if (minutes > 0) {
+        unsigned long wait = (unsigned long)minutes * 60000UL - timeinfo.tm_sec * 1000UL - VirtualClock::now() % 1000;
+        controlScheduler.trigger(scheduleTask, min(wait, (unsigned long)SCHEDULE_CHECK_INTERVAL));
+    }
+}
+
+static void handleFeedRequests() {
+    FeedRequest request;
+    while (feedRequests.pop(request)) {
+        if (dispenser.enqueue(request.amount, request.type, request.commandId)) {
+            pending.push_back({request.receivedUs, false, -1});
+            traffic.queued++;
+        }
+    }
+}
+
+// Network task stand-in: claim every command created so far with one
+// request, back off while polls come back empty
+static void pollCommands() {
+    traffic.polls++;
+    unsigned long now = VirtualClock::now();
+    auto created = std::partition(serverCommands.begin(), serverCommands.end(),
+                                  [now](const FeedRequest& command) { return command.receivedUs <= now; });
+    bool found = created != serverCommands.begin();
+    if (found) {
+        traffic.claims++;
+        claimed.insert(claimed.end(), serverCommands.begin(), created);
+        serverCommands.erase(serverCommands.begin(), created);
+        responseAt = now + SIM_ROUND_TRIP_MS;
+        pollInterval = SIM_POLL_MIN_INTERVAL;
+    } else {
+        pollInterval = min(pollInterval * 2, (unsigned long)SIM_POLL_MAX_INTERVAL);
+    }
+    networkScheduler.setPeriod(commandTask, pollInterval);
+}
+
+// Hand claimed commands to the control task once the response is in
+static void deliverClaimed() {
+    if (claimed.empty() || VirtualClock::now() < responseAt) return;
+    for (const FeedRequest& request : claimed) {
+        feedRequests.push(request);
+    }
+    claimed.clear();
+}
+
+static void setupSimulation() {
+    VirtualClock::reset();
+    HostHal::clockMs = VirtualClock::now;
+    HostHal::delayMs = VirtualClock::advance;
+    HostHal::pulseIn = [](uint8_t, uint8_t, unsigned long) { return hopper.echoUs(); };
+
+    controlScheduler.setClock(VirtualClock::now);
+    dispenser.setClock(VirtualClock::now);
+    dispenser.setHoldTime([](int grams) {
+        return flowModel.holdMs(grams, readFoodLevel());
+    });
+
+    dispenser.onProgress([](const Dispenser::Request&, Dispenser::State state, unsigned long, unsigned long) {
+        if (state != Dispenser::OPENING || pending.empty()) return;
+        Pending& feed = pending.front();
+        feed.levelBefore = readFoodLevel();
+        unsigned long latency = VirtualClock::now() - feed.dueAt;
+        (feed.scheduled ? scheduleLatency : commandLatency).push_back(latency);
+        flowModel.noteFeed(!feed.scheduled, VirtualClock::now());
+        traffic.started++;
+    });
+
+    dispenser.onComplete([](const Dispenser::Request& request, unsigned long actualHoldMs) {
+        float delivered = min(hopper.grams, hopper.trueRate() * actualHoldMs / 1000.0f);
+        hopper.grams -= delivered;
+        feedError.push_back((delivered - request.amount) / request.amount);
+
+        Pending feed = pending.front();
+        pending.erase(pending.begin());
+        flowModel.addSample(request.amount, actualHoldMs, feed.levelBefore, readFoodLevel());
+        traffic.completed++;
+
+        if (hopper.grams < SIM_REFILL_BELOW) {
+            hopper.grams = FLOW_HOPPER_GRAMS;
+            hopper.refills++;
+        }
+    });
+
+    const bool everyDay[7] = {true, true, true, true, true, true, true};
+    scheduleIndex.add(0, "breakfast", 7 * 60 + 30, everyDay);
+    scheduleIndex.add(1, "lunch", 12 * 60, everyDay);
+    scheduleIndex.add(2, "dinner", 18 * 60 + 30, everyDay);
+
+    scheduleTask = controlScheduler.addTask("schedule", SCHEDULE_CHECK_INTERVAL, checkSchedules, 2, 0, 0);
+
+    networkScheduler.setClock(VirtualClock::now);
+    commandTask = networkScheduler.addTask("commands", SIM_POLL_MIN_INTERVAL, pollCommands, 2, 500);
+}
+
+static unsigned long percentile(std::vector<unsigned long> values, int percent) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[(values.size() - 1) * percent / 100];
+}
+
+static float meanAbs(const std::vector<float>& values, size_t from, size_t to) {
+    float sum = 0;
+    for (size_t i = from; i < to; i++) sum += fabsf(values[i]);
+    return to > from ? sum / (to - from) : 0;
+}
+
+int main() {
+    setupSimulation();
+
+    const unsigned long end = SIM_DAYS * 86400000UL;
+    const unsigned long commandEvery = SIM_COMMAND_EVERY * 60000UL;
+
+    // Commands land at odd seconds, not in step with the poll, and stop
+    // early enough that the last one is carried out before the end
+    serverCommands.reserve(end / commandEvery);
+    for (unsigned long at = commandEvery; at + 2 * SIM_POLL_MAX_INTERVAL < end; at += commandEvery) {
+        FeedRequest request = FeedRequest();
+        request.amount = SIM_COMMAND_AMOUNT;
+        snprintf(request.type, sizeof(request.type), "manual");
+        snprintf(request.commandId, sizeof(request.commandId), "00000000-0000-4000-8000-%012zu",
+                 serverCommands.size());
+        request.receivedUs = at + (serverCommands.size() * 7919) % 60000; // reused as the virtual creation time
+        serverCommands.push_back(request);
+    }
+    const size_t commandCount = serverCommands.size();
+
+    // Reserved up front so only the code under test allocates in the loop
+    std::vector<unsigned long> loopUs;
+    loopUs.reserve(1 << 18);
+    pending.reserve(DISPENSER_QUEUE_SIZE + MESSAGE_QUEUE_DEPTH);
+    claimed.reserve(commandCount);
+    scheduleLatency.reserve(1024);
+    commandLatency.reserve(1024);
+    feedError.reserve(1024);
+    uint64_t allocationsBefore = allocations.load();
+    unsigned long realStart = micros();
+
+    // controlLoop(), with the network task's command poll run on the same clock
+    while (VirtualClock::now() < end) {
+        networkScheduler.runDue();
+        deliverClaimed();
+
+        unsigned long start = micros();
+        handleFeedRequests();
+        controlScheduler.runDue();
+        dispenser.update();
+        loopUs.push_back(micros() - start);
+
+        // Sleep until the next job on either task, dispenser step or poll response
+        unsigned long wait = min(controlScheduler.msUntilNext(), dispenser.msUntilNextStep());
+        wait = min(wait, networkScheduler.msUntilNext());
+        if (!claimed.empty()) wait = min(wait, responseAt - VirtualClock::now());
+        wait = min(wait, end - VirtualClock::now());
+        if (wait > 0) VirtualClock::advance(wait);
+    }
+
+    unsigned long realMs = (micros() - realStart) / 1000;
+    uint64_t allocated = allocations.load() - allocationsBefore;
+    std::vector<unsigned long> sortedLoop = loopUs;
+
+    printf("scenario: %d days, 3 schedules a day, a %d g command every %d min\n",
+           SIM_DAYS, SIM_COMMAND_AMOUNT, SIM_COMMAND_EVERY);
+    printf("virtual time: %d days in %lu ms real\n", SIM_DAYS, realMs);
+    printf("loop: %zu iterations, p50 %lu us, p99 %lu us, max %lu us\n", loopUs.size(),
+           percentile(sortedLoop, 50), percentile(sortedLoop, 99), percentile(sortedLoop, 100));
+    printf("heap: %llu allocations, %.3f per iteration, %.2f per feed\n", (unsigned long long)allocated,
+           (double)allocated / loopUs.size(), (double)allocated / max((size_t)1, feedError.size()));
+    printf("dispense latency: scheduled p50 %lu ms max %lu ms, command p50 %lu ms max %lu ms\n",
+           percentile(scheduleLatency, 50), percentile(scheduleLatency, 100),
+           percentile(commandLatency, 50), percentile(commandLatency, 100));
+    printf("feeds: %zu, %u refills, |error| first 5 %.0f%%, last 20 %.0f%%\n", feedError.size(), hopper.refills,
+           meanAbs(feedError, 0, min((size_t)5, feedError.size())) * 100,
+           meanAbs(feedError, feedError.size() > 20 ? feedError.size() - 20 : 0, feedError.size()) * 100);
+    printf("requests: %u command polls, %u of them claimed commands\n", traffic.polls, traffic.claims);
+    printf("feed events to the network task: %u queued, %u started, %u completed\n",
+           traffic.queued, traffic.started, traffic.completed);
+
+    // Every schedule fires once a day and every command is carried out
+    CHECK_EQ(scheduledFeeds, SIM_DAYS * 3);
+    CHECK_EQ(commandLatency.size(), commandCount);
+    CHECK_EQ(traffic.completed, scheduledFeeds + commandCount);
+    CHECK(percentile(commandLatency, 100) < SIM_POLL_MAX_INTERVAL + SIM_ROUND_TRIP_MS + 60000);
+    CHECK(percentile(scheduleLatency, 100) < 60000);
+    // The flow model has learned the real rate by the end
+    CHECK(meanAbs(feedError, feedError.size() - 20, feedError.size()) < 0.1f);
+    return TEST_RESULT("sim_feeder");
+}
@@ -0,0 +1,127 @@
+// FeederMessages through SpscQueue between two WorkerTasks, built without
+// the Arduino core: every message arrives once and in order, and the
+// throughput and push-to-pop latency with a wake() per push are reported.
+#include "HostTest.h"
+#include "FeederMessages.h"
+#include "SpscQueue.h"
+#include "WorkerTask.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#define THROUGHPUT_MESSAGES 1000000
+#define LATENCY_MESSAGES 2000
+
+static uint32_t nowUs() {
+    using namespace std::chrono;
+    static const steady_clock::time_point start = steady_clock::now();
+    return (uint32_t)duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+static SpscQueue<FeedRequest, MESSAGE_QUEUE_DEPTH> requests;
+static std::atomic<uint32_t> received(0);
+static std::atomic<uint32_t> outOfOrder(0);
+static std::atomic<bool> measuring(false);
+static std::vector<uint32_t> latencies;
+
+static void consume(WorkerTask& task) {
+    FeedRequest request;
+    while (requests.pop(request)) {
+        uint32_t seq = received.load(std::memory_order_relaxed);
+        if ((uint32_t)request.amount != (seq & 0x7fff) || request.commandId[0] != 'c') {
+            outOfOrder++;
+        }
+        if (measuring) {
+            latencies.push_back(nowUs() - request.receivedUs);
+        }
+        received.store(seq + 1, std::memory_order_release);
+    }
+    task.waitFor(10);
+}
+
+static FeedRequest makeRequest(uint32_t seq) {
+    FeedRequest request = FeedRequest();
+    request.amount = (int16_t)(seq & 0x7fff);
+    snprintf(request.type, sizeof(request.type), "manual");
+    snprintf(request.commandId, sizeof(request.commandId), "c%08u", seq);
+    request.receivedUs = nowUs();
+    return request;
+}
+
+static void waitForReceived(uint32_t count) {
+    while (received.load(std::memory_order_acquire) < count) {
+        std::this_thread::yield();
+    }
+}
+
+int main() {
+    // size() counts up to capacity() and back, across the index wrap
+    SpscQueue<FeedRequest, 4> small;
+    FeedRequest item = FeedRequest();
+    for (int round = 0; round < 3; round++) {
+        while (small.push(item)) {}
+        CHECK_EQ(small.size(), small.capacity());
+        CHECK(small.pop(item));
+        CHECK_EQ(small.size(), small.capacity() - 1);
+        while (small.pop(item)) {}
+        CHECK_EQ(small.size(), (size_t)0);
+    }
+
+    // Leaked on purpose: the host WorkerTask thread never returns
+    WorkerTask* consumer = new WorkerTask();
+    CHECK(consumer->start("control", 0, 0, 0, [consumer]() { consume(*consumer); }));
+
+    // Throughput: push as fast as the consumer drains, waking it when full
+    uint32_t start = nowUs();
+    for (uint32_t seq = 0; seq < THROUGHPUT_MESSAGES; seq++) {
+        FeedRequest request = makeRequest(seq);
+        while (!requests.push(request)) {
+            consumer->wake();
+            std::this_thread::yield();
+        }
+    }
+    consumer->wake();
+    waitForReceived(THROUGHPUT_MESSAGES);
+    uint32_t elapsed = nowUs() - start;
+
+    CHECK_EQ(received.load(), (uint32_t)THROUGHPUT_MESSAGES);
+    CHECK_EQ(outOfOrder.load(), 0u);
+    CHECK_EQ(requests.getStats().pushed, (uint32_t)THROUGHPUT_MESSAGES);
+    CHECK(requests.getStats().highWater <= requests.capacity());
+    printf("throughput: %u messages of %zu bytes in %u ms, %.0f/s, %u refused while full\n",
+           THROUGHPUT_MESSAGES, sizeof(FeedRequest), elapsed / 1000,
+           THROUGHPUT_MESSAGES * 1e6 / elapsed, requests.getStats().dropped);
+
+    // Latency: one message at a time, as commands arrive, woken per push
+    latencies.reserve(LATENCY_MESSAGES);
+    measuring = true;
+    uint32_t refused = 0;
+    for (uint32_t i = 0; i < LATENCY_MESSAGES; i++) {
+        uint32_t seq = THROUGHPUT_MESSAGES + i;
+        if (!requests.push(makeRequest(seq))) {
+            refused++;
+            continue;
+        }
+        consumer->wake();
+        waitForReceived(seq + 1);
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    measuring = false;
+
+    CHECK_EQ(refused, 0u);
+    CHECK_EQ(latencies.size(), (size_t)LATENCY_MESSAGES);
+    CHECK_EQ(outOfOrder.load(), 0u);
+    std::sort(latencies.begin(), latencies.end());
+    printf("latency: p50 %u us, p99 %u us, max %u us\n",
+           latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], latencies.back());
+
+    // The consumer thread is still running, leave without unwinding it
+    int result = TEST_RESULT("feeder_messages");
+    fflush(stdout);
+    _Exit(result);
+}
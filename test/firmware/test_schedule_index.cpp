@@ -0,0 +1,141 @@
+// ScheduleIndex on a host: due occurrences fire once, late ones within the
+// catch-up window still fire, the window wraps over the end of the week,
+// fired state kept over a cold boot neither repeats nor skips a feed, and
+// fired state survives a rebuild and a snapshot.
+#include "HostTest.h"
+#include "ScheduleIndex.h"
+
+#define MONDAY (1 * MINUTES_PER_DAY)
+#define WEEK_START 2000000u // absolute minute taken as Sunday 00:00
+
+static const bool EVERY_DAY[7] = {true, true, true, true, true, true, true};
+static const bool SATURDAY_ONLY[7] = {false, false, false, false, false, false, true};
+
+static int fired;
+static uint16_t lastLate;
+
+static uint8_t fire(ScheduleIndex& index, uint16_t minuteOfWeek) {
+    return index.fireDue(WEEK_START + minuteOfWeek, minuteOfWeek, [](uint8_t, uint16_t late) {
+        fired++;
+        lastLate = late;
+    });
+}
+
+static void testParseTime() {
+    CHECK_EQ(ScheduleIndex::parseTime("08:30"), 8 * 60 + 30);
+    CHECK_EQ(ScheduleIndex::parseTime("23:59:00"), 23 * 60 + 59);
+    CHECK_EQ(ScheduleIndex::parseTime("7:05"), 7 * 60 + 5);
+    CHECK_EQ(ScheduleIndex::parseTime("24:00"), -1);
+    CHECK_EQ(ScheduleIndex::parseTime("08:6"), -1);
+    CHECK_EQ(ScheduleIndex::parseTime(":30"), -1);
+    CHECK_EQ(ScheduleIndex::parseTime(""), -1);
+}
+
+static void testFiresOnceAndCatchesUp() {
+    ScheduleIndex index;
+    index.add(0, "breakfast", 8 * 60, EVERY_DAY);
+    fired = 0;
+
+    // Checked before the feed is due
+    CHECK_EQ(fire(index, MONDAY + 7 * 60), 0);
+    CHECK_EQ(fire(index, MONDAY + 8 * 60), 1);
+    CHECK_EQ(fire(index, MONDAY + 8 * 60), 0);
+    CHECK_EQ(index.minutesUntilNext(MONDAY + 8 * 60), MINUTES_PER_DAY);
+
+    // Missed by 10 minutes the next day, still served
+    CHECK_EQ(fire(index, MONDAY + MINUTES_PER_DAY + 8 * 60 + 10), 1);
+    CHECK_EQ(lastLate, 10);
+
+    // Missed by more than the window the day after, dropped
+    CHECK_EQ(fire(index, MONDAY + 2 * MINUTES_PER_DAY + 8 * 60 + SCHEDULE_CATCH_UP_MINUTES + 1), 0);
+    CHECK_EQ(fired, 2);
+}
+
+static ScheduleIndex::Fired coldBoot(ScheduleIndex& before) {
+    ScheduleIndex::Fired stored;
+    before.saveFired(stored);
+    return stored;
+}
+
+static void testColdBoot() {
+    fired = 0;
+
+    // Reset just after the feed fired: not served again
+    ScheduleIndex index;
+    index.add(0, "breakfast", 8 * 60, EVERY_DAY);
+    CHECK_EQ(fire(index, MONDAY + 8 * 60), 1);
+    ScheduleIndex::Fired stored = coldBoot(index);
+
+    ScheduleIndex rebooted;
+    rebooted.restoreFired(stored);
+    rebooted.clear();
+    rebooted.add(0, "lunch", 12 * 60, EVERY_DAY);
+    rebooted.add(1, "breakfast", 8 * 60, EVERY_DAY);
+    CHECK_EQ(fire(rebooted, MONDAY + 8 * 60 + 1), 0);
+    CHECK_EQ(fire(rebooted, MONDAY + MINUTES_PER_DAY + 8 * 60), 1);
+
+    // Power lost before the feed was due, back within the window: served
+    ScheduleIndex early;
+    early.add(0, "breakfast", 8 * 60, EVERY_DAY);
+    CHECK_EQ(fire(early, MONDAY + 7 * 60 + 58), 0);
+    stored = coldBoot(early);
+
+    ScheduleIndex recovered;
+    recovered.restoreFired(stored);
+    recovered.clear();
+    recovered.add(0, "breakfast", 8 * 60, EVERY_DAY);
+    CHECK_EQ(fire(recovered, MONDAY + 8 * 60 + 3), 1);
+    CHECK_EQ(lastLate, 3);
+    CHECK_EQ(fired, 3);
+}
+
+static void testWeekWrap() {
+    ScheduleIndex index;
+    index.add(0, "late", 23 * 60 + 55, SATURDAY_ONLY);
+    fired = 0;
+
+    uint16_t saturday = 6 * MINUTES_PER_DAY;
+    CHECK_EQ(fire(index, saturday), 0);
+    CHECK_EQ(index.minutesUntilNext(saturday), 23 * 60 + 55);
+
+    // Next check is five minutes into Sunday of the following week
+    uint32_t nowMinute = WEEK_START + MINUTES_PER_WEEK + 5;
+    CHECK_EQ(index.fireDue(nowMinute, 5, [](uint8_t, uint16_t late) {
+        fired++;
+        lastLate = late;
+    }), 1);
+    CHECK_EQ(lastLate, 10);
+}
+
+static void testRebuildAndSnapshot() {
+    ScheduleIndex index;
+    index.add(0, "breakfast", 8 * 60, EVERY_DAY);
+    index.add(1, "dinner", 18 * 60, EVERY_DAY);
+    fired = 0;
+    fire(index, MONDAY);
+    CHECK_EQ(fire(index, MONDAY + 8 * 60), 1);
+
+    // Reordered on reload: fired state follows the id, not the slot
+    index.clear();
+    index.add(0, "dinner", 18 * 60, EVERY_DAY);
+    index.add(1, "breakfast", 8 * 60, EVERY_DAY);
+    CHECK_EQ(fire(index, MONDAY + 8 * 60 + 1), 0);
+
+    ScheduleIndex::Snapshot snapshot;
+    index.save(snapshot);
+    ScheduleIndex restored;
+    restored.restore(snapshot);
+    CHECK_EQ(restored.getEventCount(), 14);
+    CHECK_EQ(fire(restored, MONDAY + 8 * 60 + 2), 0);
+    CHECK_EQ(fire(restored, MONDAY + 18 * 60), 1);
+    CHECK_EQ(fired, 2);
+}
+
+int main() {
+    testParseTime();
+    testFiresOnceAndCatchesUp();
+    testColdBoot();
+    testWeekWrap();
+    testRebuildAndSnapshot();
+    return TEST_RESULT("schedule_index");
+}
@@ -0,0 +1,153 @@
+// TaskScheduler on a virtual clock: priority order among due jobs, jitter
+// windows and coalesced wakeups, overrun accounting, fixed-rate periods
+// and trigger(), also on a job already due in the same batch.
+#include "HostTest.h"
+#include "TaskScheduler.h"
+#include "VirtualClock.h"
+
+#include <string>
+
+static std::string order;
+
+static void testPriorityOrder() {
+    VirtualClock::reset();
+    TaskScheduler scheduler;
+    scheduler.setClock(VirtualClock::now);
+    order.clear();
+
+    scheduler.addTask("low", 1000, []() { order += 'l'; }, 0, 0, 100);
+    scheduler.addTask("high", 1000, []() { order += 'h'; }, 5, 0, 100);
+    scheduler.addTask("mid", 1000, []() { order += 'm'; }, 2, 0, 100);
+
+    CHECK_EQ(scheduler.runDue(), 0);
+    CHECK_EQ(scheduler.msUntilNext(), 100);
+
+    VirtualClock::advance(100);
+    CHECK_EQ(scheduler.runDue(), 3);
+    CHECK(order == "hml");
+}
+
+static void testJitterCoalescing() {
+    VirtualClock::reset();
+    TaskScheduler scheduler;
+    scheduler.setClock(VirtualClock::now);
+
+    int a = scheduler.addTask("a", 1000, []() {}, 0, 50, 100);
+    int b = scheduler.addTask("b", 1000, []() {}, 0, 0, 130);
+    int c = scheduler.addTask("c", 1000, []() {}, 0, 100, 400);
+
+    // a may wait for b, c is too far out to pull the wakeup in
+    CHECK_EQ(scheduler.msUntilNext(), 130);
+
+    VirtualClock::advance(130);
+    CHECK_EQ(scheduler.runDue(), 2);
+    CHECK_EQ(scheduler.getStats(a)->runs, 1);
+    CHECK_EQ(scheduler.getStats(a)->maxLateMs, 30);
+    CHECK_EQ(scheduler.getOverruns(a), 0);
+    CHECK_EQ(scheduler.getOverruns(b), 0);
+    CHECK_EQ(scheduler.getStats(c)->runs, 0);
+    CHECK_EQ(scheduler.msUntilNext(), 370);
+}
+
+static void testOverruns() {
+    VirtualClock::reset();
+    TaskScheduler scheduler;
+    scheduler.setClock(VirtualClock::now);
+
+    int slow = scheduler.addTask("slow", 100, []() { VirtualClock::advance(250); }, 1, 0, 0);
+    int late = scheduler.addTask("late", 100, []() {}, 0, 20, 0);
+
+    // slow runs first and holds the clock for 250 ms, so late starts 250 ms
+    // past its deadline and 230 ms past its jitter
+    scheduler.runDue();
+    CHECK_EQ(scheduler.getOverruns(slow), 0);
+    CHECK_EQ(scheduler.getOverruns(late), 1);
+    CHECK_EQ(scheduler.getStats(late)->maxLateMs, 250);
+    CHECK_EQ(scheduler.getStats(slow)->maxRunMs, 250);
+
+    // Fell more than a period behind: the next deadline restarts from the
+    // end of the run instead of firing a burst of catch-up runs
+    CHECK_EQ(scheduler.msUntilNext(), 100);
+    VirtualClock::advance(100);
+    CHECK_EQ(scheduler.runDue(), 2);
+    CHECK_EQ(scheduler.getStats(slow)->runs, 2);
+    CHECK_EQ(scheduler.getOverruns(late), 2);
+}
+
+static void testFixedRate() {
+    VirtualClock::reset();
+    TaskScheduler scheduler;
+    scheduler.setClock(VirtualClock::now);
+
+    int runs = 0;
+    int id = scheduler.addTask("tick", 100, [&runs]() { runs++; }, 0, 10, 0);
+
+    // Running a little late keeps the original phase
+    for (int i = 0; i < 10; i++) {
+        VirtualClock::advance(scheduler.msUntilNext());
+        scheduler.runDue();
+    }
+    CHECK_EQ(runs, 10);
+    CHECK_EQ(scheduler.getOverruns(id), 0);
+    CHECK_EQ(VirtualClock::now(), 9 * 100 + 10);
+}
+
+static void testTrigger() {
+    VirtualClock::reset();
+    TaskScheduler scheduler;
+    scheduler.setClock(VirtualClock::now);
+
+    int runs = 0;
+    int id = scheduler.addTask("poll", 60000, [&runs]() { runs++; }, 0, 0, 60000);
+    scheduler.trigger(id, 50);
+    CHECK_EQ(scheduler.msUntilNext(), 50);
+
+    VirtualClock::advance(50);
+    CHECK_EQ(scheduler.runDue(), 1);
+    CHECK_EQ(scheduler.msUntilNext(), 60000);
+
+    scheduler.setEnabled(id, false);
+    CHECK_EQ(scheduler.msUntilNext(), SCHEDULER_IDLE_WAIT);
+    scheduler.trigger(id);
+    CHECK_EQ(scheduler.runDue(), 0);
+    CHECK_EQ(runs, 1);
+}
+
+static void testTriggerWithinBatch() {
+    VirtualClock::reset();
+    TaskScheduler scheduler;
+    scheduler.setClock(VirtualClock::now);
+    order.clear();
+
+    // All due together, the first pushes one back and disables another
+    int later = -1;
+    int off = -1;
+    scheduler.addTask("first", 1000, [&]() {
+        order += 'f';
+        scheduler.trigger(later, 500);
+        scheduler.setEnabled(off, false);
+    }, 5, 0, 100);
+    later = scheduler.addTask("later", 1000, []() { order += 'l'; }, 1, 0, 100);
+    off = scheduler.addTask("off", 1000, []() { order += 'o'; }, 0, 0, 100);
+
+    VirtualClock::advance(100);
+    CHECK_EQ(scheduler.runDue(), 1);
+    CHECK(order == "f");
+    CHECK_EQ(scheduler.msUntilNext(), 500);
+
+    VirtualClock::advance(500);
+    CHECK_EQ(scheduler.runDue(), 1);
+    CHECK(order == "fl");
+    CHECK_EQ(scheduler.getStats(later)->overruns, 0);
+    CHECK_EQ(scheduler.getStats(off)->runs, 0);
+}
+
+int main() {
+    testPriorityOrder();
+    testJitterCoalescing();
+    testOverruns();
+    testFixedRate();
+    testTrigger();
+    testTriggerWithinBatch();
+    return TEST_RESULT("task_scheduler");
+}